@@ -0,0 +1,706 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <random>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "spre/spre.hpp"
+
+using std::string;
+using std::vector;
+
+// microbenchmarks of every stage, from lexing a query to matching with
+// it, printed as JSON so the numbers could be tracked from one commit to
+// the next. Every benchmark is repeated until it took at least MIN_TIME,
+// the matching ones also check that the engines agree with the Pike VM.
+//
+//     spre_bench [filter]    only the benchmarks whose name contains filter
+
+static const double MIN_TIME = 0.25; // seconds
+
+struct Result
+{
+    string name;
+    size_t iterations;
+    double seconds;
+    size_t bytes; // per iteration, 0 if it is not about throughput
+    size_t items; // per iteration, e.g. tokens or inputs
+    long matched; // -1 if nothing is matched
+};
+
+class Bench
+{
+  public:
+    explicit Bench(const char *filter);
+    ~Bench();
+    bool is_enabled(const string &name) const;
+    template <typename F>
+    bool run(const string &name, size_t bytes, size_t items, F iteration, long matched = -1);
+    void print(bool jit_native) const;
+
+  private:
+    const char *filter_;
+    vector<Result> results_;
+};
+
+Bench::Bench(const char *filter) : filter_(filter)
+{
+}
+
+Bench::~Bench()
+{
+}
+
+inline bool Bench::is_enabled(const string &name) const
+{
+    return filter_ == nullptr || name.find(filter_) != string::npos;
+}
+
+template <typename F>
+inline bool Bench::run(const string &name, size_t bytes, size_t items, F iteration, long matched)
+{
+    // false if the benchmark is filtered out
+    if (!is_enabled(name))
+    {
+        return false;
+    }
+    fprintf(stderr, "%s\n", name.c_str());
+    iteration(); // warm up, e.g. the lazily built DFA states
+
+    Result result{name, 0, 0, bytes, items, matched};
+    auto begin = std::chrono::steady_clock::now();
+    while (result.seconds < MIN_TIME)
+    {
+        iteration();
+        result.iterations++;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+    results_.push_back(result);
+    return true;
+}
+
+inline void Bench::print(bool jit_native) const
+{
+    printf("{\n  \"context\": {\"jit_native\": %s, \"min_time\": %.2f},\n", jit_native ? "true" : "false", MIN_TIME);
+    printf("  \"benchmarks\": [");
+    for (size_t i = 0; i < results_.size(); i++)
+    {
+        const Result &result = results_[i];
+        double per_iteration = result.seconds / static_cast<double>(result.iterations);
+        printf("%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_iteration\": %.1f", i == 0 ? "" : ",",
+               result.name.c_str(), result.iterations, per_iteration * 1e9);
+        if (result.bytes != 0)
+        {
+            printf(", \"bytes_per_second\": %.0f", static_cast<double>(result.bytes) / per_iteration);
+        }
+        if (result.items != 0)
+        {
+            printf(", \"items_per_second\": %.0f", static_cast<double>(result.items) / per_iteration);
+        }
+        if (result.matched >= 0)
+        {
+            printf(", \"matched\": %ld", result.matched);
+        }
+        printf("}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+// the corpora, generated with a fixed seed so every run sees the same ones
+
+static vector<string> make_log_lines(std::mt19937 &rng)
+{
+    const char *levels[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    const char *words[] = {"request", "served", "user", "cache", "miss", "timeout", "took", "retry"};
+    vector<string> inputs;
+    for (size_t i = 0; i < 50000; i++)
+    {
+        string input = "2017-05-";
+        input += std::to_string(10 + rng() % 20) + " " + levels[rng() % 4];
+        for (size_t k = rng() % 12; k > 0; k--)
+        {
+            input += string(" ") + words[rng() % 8];
+        }
+        inputs.push_back(input + " " + std::to_string(rng() % 1000) + "ms");
+    }
+    return inputs;
+}
+
+static vector<string> make_utf8_lines(std::mt19937 &rng)
+{
+    // the log lines, every fourth one with a word outside of ASCII
+    const char *words[] = {"caf\xC3\xA9", "na\xC3\xAFve", "\xE6\x97\xA5\xE6\x9C\xAC", "\xC3\x9C" "ber",
+                           "\xCE\xB1\xCE\xB2\xCE\xB3"};
+    vector<string> inputs = make_log_lines(rng);
+    for (auto &input : inputs)
+    {
+        if (rng() % 4 == 0)
+        {
+            input.insert(input.find(' ') + 1, string(words[rng() % 5]) + " ");
+        }
+    }
+    return inputs;
+}
+
+static vector<string> make_urls(std::mt19937 &rng)
+{
+    const char *schemes[] = {"http://", "https://", "ftp://", "https//"};
+    const char *tlds[] = {".com", ".org", ".io", ".co.uk"};
+    vector<string> inputs;
+    for (size_t i = 0; i < 50000; i++)
+    {
+        string input = schemes[rng() % 4];
+        for (size_t k = 3 + rng() % 12; k > 0; k--)
+        {
+            input += static_cast<char>('a' + rng() % 26);
+        }
+        input += tlds[rng() % 4];
+        for (size_t k = rng() % 4; k > 0; k--)
+        {
+            input += "/";
+            for (size_t n = 1 + rng() % 10; n > 0; n--)
+            {
+                input += static_cast<char>('a' + rng() % 26);
+            }
+        }
+        if (rng() % 3 == 0)
+        {
+            input += "?id=" + std::to_string(rng() % 100000);
+        }
+        inputs.push_back(input);
+    }
+    return inputs;
+}
+
+static vector<string> make_emails(std::mt19937 &rng)
+{
+    vector<string> inputs;
+    for (size_t i = 0; i < 50000; i++)
+    {
+        string input;
+        for (size_t k = 3 + rng() % 10; k > 0; k--)
+        {
+            input += static_cast<char>('a' + rng() % 26);
+        }
+        input += rng() % 8 == 0 ? "#" : "@";
+        for (size_t k = 3 + rng() % 8; k > 0; k--)
+        {
+            input += static_cast<char>('a' + rng() % 26);
+        }
+        input += rng() % 2 == 0 ? ".com" : ".info";
+        inputs.push_back(input);
+    }
+    return inputs;
+}
+
+// the queries
+
+static string make_large_source()
+{
+    // about a megabyte of every kind of token
+    string src;
+    while (src.size() < 1024 * 1024)
+    {
+        src += "begin with capture (letter once or more) as \"name\", literally \"=\", "
+               "any of (digit, letter from a to f, one of \"xX_\") between 1 and 16 times, "
+               "any of (literally \"ms\", literally \"s\") optional, whitespace never or more, ";
+    }
+    return src + "must end";
+}
+
+static string make_flat_source(size_t count)
+{
+    string src;
+    for (size_t i = 0; i < count; i++)
+    {
+        src += i % 2 == 0 ? "letter once or more, " : "literally \"-\", ";
+    }
+    return src + "digit";
+}
+
+static string make_nested_source(size_t depth)
+{
+    string src;
+    for (size_t i = 0; i < depth; i++)
+    {
+        src += "capture (letter, ";
+    }
+    src += "digit";
+    for (size_t i = 0; i < depth; i++)
+    {
+        src += ")";
+    }
+    return src;
+}
+
+static vector<string> make_rule_set(size_t count)
+{
+    // the literals end up in the Aho-Corasick automaton, the others are compiled
+    vector<string> srcs;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i % 4 == 3)
+        {
+            srcs.push_back("literally \"id" + std::to_string(i) + "=\", digit between 1 and " +
+                           std::to_string(1 + i % 9) + " times");
+        }
+        else
+        {
+            srcs.push_back("literally \"keyword" + std::to_string(i) + "\"");
+        }
+    }
+    return srcs;
+}
+
+struct Corpus
+{
+    const char *name;
+    const char *src;
+    vector<string> (*make_inputs)(std::mt19937 &rng);
+};
+
+static size_t count_bytes(const vector<string> &inputs)
+{
+    size_t bytes = 0;
+    for (auto const &input : inputs)
+    {
+        bytes += input.size();
+    }
+    return bytes;
+}
+
+static size_t count_bits(const vector<uint64_t> &bitmap)
+{
+    size_t count = 0;
+    for (auto const &word : bitmap)
+    {
+        for (uint64_t bits = word; bits != 0; bits &= bits - 1)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+static size_t count_tokens(const string &src)
+{
+    spre::Lexer lexer(src);
+    size_t count = 0;
+    while (lexer.get_next_token().get_token_type() != spre::TokenType::END_OF_FILE && !lexer.has_error())
+    {
+        count++;
+    }
+    return count;
+}
+
+static void bench_compile(Bench &bench)
+{
+    string large = make_large_source();
+    bench.run("lex/large", large.size(), count_tokens(large), [&]() { count_tokens(large); });
+
+    const std::pair<const char *, string> sources[] = {
+        {"flat", make_flat_source(200)},
+        {"nested", make_nested_source(64)},
+    };
+    for (auto const &source : sources)
+    {
+        const string &src = source.second;
+        bench.run(string("parse/") + source.first, src.size(), 0, [&]() {
+            spre::Lexer lexer(src);
+            spre::Parser parser(lexer);
+            parser.parse();
+        });
+
+        spre::Lexer lexer(src);
+        spre::Parser parser(lexer);
+        vector<unique_ptr<spre::ExprAST>> asts = parser.parse();
+        bench.run(string("generate/") + source.first, src.size(), 0, [&]() {
+            spre::Generator generator(parser);
+            generator.generate(asts);
+        });
+        bench.run(string("generate/") + source.first + "/ecmascript", src.size(), 0, [&]() {
+            spre::Generator generator(parser, true, spre::Dialect::ECMASCRIPT);
+            generator.generate(asts);
+        });
+    }
+
+    const char *email = "begin with letter once or more, literally \"@\", letter once or more, literally \".\", "
+                        "letter between 2 and 4 times, must end";
+    bench.run("srl/email", strlen(email), 0, [&]() { spre::SRL srl(email); });
+
+    vector<string> srcs = make_rule_set(1000);
+    bench.run("rule_set/1000", 0, srcs.size(), [&]() {
+        spre::RuleSet rules;
+        for (auto const &src : srcs)
+        {
+            rules.add(src);
+        }
+        rules.compile();
+    });
+
+    // the same fragments in every rule, compiled once with a fragment cache
+    vector<vector<unique_ptr<spre::ExprAST>>> rules;
+    for (size_t i = 0; i < 1000; i++)
+    {
+        string src = "capture (any of (literally \"Jan\", literally \"Feb\", literally \"Mar\", literally \"Apr\", "
+                     "literally \"May\", literally \"Jun\", literally \"Jul\", literally \"Aug\", literally \"Sep\", "
+                     "literally \"Oct\", literally \"Nov\", literally \"Dec\")) as \"month\", literally \" \", "
+                     "capture (digit between 1 and 2 times) as \"day\", literally \" rule" + std::to_string(i) + " \", "
+                     "capture (digit once or more) as \"port\"";
+        spre::Lexer lexer(src);
+        spre::Parser parser(lexer);
+        rules.push_back(parser.parse());
+    }
+    bench.run("compile/shared/uncached", 0, rules.size(), [&]() {
+        for (auto const &asts : rules)
+        {
+            spre::Compiler compiler;
+            compiler.compile(asts);
+        }
+    });
+    bench.run("compile/shared/cached", 0, rules.size(), [&]() {
+        spre::FragmentCache fragments;
+        for (auto const &asts : rules)
+        {
+            spre::Compiler compiler(true, &fragments);
+            compiler.compile(asts);
+        }
+    });
+}
+
+static bool check(const string &name, size_t count, size_t expected)
+{
+    if (count != expected)
+    {
+        fprintf(stderr, "%s matched %zu inputs, the Pike VM %zu\n", name.c_str(), count, expected);
+        return false;
+    }
+    return true;
+}
+
+static bool bench_match(Bench &bench, bool &jit_native)
+{
+    const Corpus corpora[] = {
+        {"log", "any of (literally \"ERROR\", literally \"WARN\"), anything never or more, "
+                "literally \"took \", digit once or more", make_log_lines},
+        {"log_icase", "any of (literally \"error\", literally \"warn\"), anything never or more, "
+                      "literally \"TOOK \", digit once or more, case insensitive", make_log_lines},
+        {"log_lazy", "any of (literally \"ERROR\", literally \"WARN\"), anything never or more, "
+                     "literally \"took \", digit once or more, all lazy", make_log_lines},
+        {"log_look", "literally \"took \", digit once or more, if not followed by (digit), "
+                     "if followed by (literally \"ms\")", make_log_lines},
+        {"url", "begin with literally \"http\", literally \"s\" optional, literally \"://\", "
+                "any of (letter, digit, one of \".-\") once or more, "
+                "any of (literally \"/\", letter, digit) never or more, must end", make_urls},
+        {"email", "begin with letter once or more, literally \"@\", letter once or more, literally \".\", "
+                  "letter between 2 and 4 times, must end", make_emails},
+    };
+
+    std::mt19937 rng(2017);
+    for (auto const &corpus : corpora)
+    {
+        vector<string> inputs = corpus.make_inputs(rng);
+        size_t bytes = count_bytes(inputs);
+        spre::SRL srl(corpus.src);
+        if (!srl.is_compiled())
+        {
+            fprintf(stderr, "%s could not be compiled\n", corpus.name);
+            return false;
+        }
+        string name = string("match/") + corpus.name;
+
+        spre::Matcher matcher(srl.get_program());
+        size_t expected = 0;
+        for (auto const &input : inputs)
+        {
+            expected += matcher.search(input) ? 1 : 0;
+        }
+        size_t count = 0;
+        bench.run(name + "/nfa", bytes, inputs.size(), [&]() {
+            for (auto const &input : inputs)
+            {
+                matcher.search(input);
+            }
+        }, static_cast<long>(expected));
+
+        spre::Dfa dfa(srl.get_program());
+        vector<uint64_t> bitmap;
+        dfa.match_batch(inputs, bitmap);
+        count = count_bits(bitmap);
+        if (!check(name + "/dfa", count, expected))
+        {
+            return false;
+        }
+        bench.run(name + "/dfa", bytes, inputs.size(), [&]() { dfa.match_batch(inputs, bitmap); },
+                  static_cast<long>(count));
+
+        spre::Jit jit(srl.get_program());
+        jit_native = jit.is_native();
+        jit.match_batch(inputs, bitmap);
+        count = count_bits(bitmap);
+        if (!check(name + "/jit", count, expected))
+        {
+            return false;
+        }
+        bench.run(name + "/jit", bytes, inputs.size(), [&]() { jit.match_batch(inputs, bitmap); },
+                  static_cast<long>(count));
+
+        // std::regex is far slower, it only gets the first inputs. It is
+        // constructed for every input, as a plain get_pattern() has to be,
+        // and then the one kept by SRL::as_std_regex() is reused
+        vector<string> few(inputs.begin(), inputs.begin() + std::min(inputs.size(), static_cast<size_t>(2000)));
+        string pattern;
+        spre::PatternOptions options;
+        if (!srl.get_pattern(spre::Dialect::ECMASCRIPT, pattern, &options) || srl.as_std_regex() == nullptr)
+        {
+            fprintf(stderr, "%s could not be written for std::regex\n", corpus.name);
+            return false;
+        }
+        std::regex::flag_type flags = std::regex::ECMAScript;
+        if (options.case_insensitive)
+        {
+            flags |= std::regex::icase;
+        }
+        expected = 0;
+        count = 0;
+        for (auto const &input : few)
+        {
+            expected += matcher.search(input) ? 1 : 0;
+            count += std::regex_search(input, *srl.as_std_regex()) ? 1 : 0;
+        }
+        if (!check(name + "/std_regex", count, expected))
+        {
+            return false;
+        }
+        bench.run(name + "/std_regex_per_call", count_bytes(few), few.size(), [&]() {
+            for (auto const &input : few)
+            {
+                std::regex regex(pattern, flags);
+                std::regex_search(input, regex);
+            }
+        }, static_cast<long>(count));
+        bench.run(name + "/std_regex_cached", count_bytes(few), few.size(), [&]() {
+            for (auto const &input : few)
+            {
+                std::regex_search(input, *srl.as_std_regex());
+            }
+        }, static_cast<long>(count));
+    }
+    return true;
+}
+
+static bool bench_index(Bench &bench)
+{
+    // searching an archive of log lines, every line a document, by
+    // matching all of them and by matching the candidates of the index
+    const char *queries[][2] = {
+        {"error_timeout", "literally \"ERROR \", anything never or more, literally \"timeout retry\""},
+        {"cache_miss", "any of (literally \"cache miss\", literally \"miss cache\"), literally \" took\""},
+        {"slow", "literally \"WARN took \", digit exactly 3 times, literally \"ms\""},
+    };
+    if (!bench.is_enabled("index/"))
+    {
+        return true;
+    }
+
+    std::mt19937 rng(2017);
+    vector<string> documents = make_log_lines(rng);
+    size_t bytes = count_bytes(documents);
+    spre::TrigramIndex index;
+    bench.run("index/build", bytes, documents.size(), [&]() {
+        spre::TrigramIndex built;
+        for (auto const &document : documents)
+        {
+            built.add(document);
+        }
+    });
+    for (auto const &document : documents)
+    {
+        index.add(document);
+    }
+
+    for (auto const &query : queries)
+    {
+        spre::SRL srl(query[1]);
+        spre::NGramQuery ngrams = srl.get_ngram_query();
+        string name = string("index/") + query[0];
+        size_t expected = 0;
+        for (auto const &document : documents)
+        {
+            expected += srl.match(document) ? 1 : 0;
+        }
+        size_t count = 0;
+        for (size_t id : index.search(ngrams))
+        {
+            count += srl.match(documents[id]) ? 1 : 0;
+        }
+        if (!check(name + "/search", count, expected))
+        {
+            return false;
+        }
+        bench.run(name + "/scan", bytes, documents.size(), [&]() {
+            for (auto const &document : documents)
+            {
+                srl.match(document);
+            }
+        }, static_cast<long>(expected));
+        bench.run(name + "/search", bytes, documents.size(), [&]() {
+            for (size_t id : index.search(ngrams))
+            {
+                srl.match(documents[id]);
+            }
+        }, static_cast<long>(count));
+    }
+    return true;
+}
+
+static bool bench_utf8(Bench &bench)
+{
+    // validating mostly ASCII text, with the fast path and byte by byte,
+    // then the log query of bench_match() with the unicode flag
+    if (!bench.is_enabled("utf8/"))
+    {
+        return true;
+    }
+    std::mt19937 rng(2017);
+    vector<string> inputs = make_utf8_lines(rng);
+    size_t bytes = count_bytes(inputs);
+    size_t valid = 0;
+    size_t decoded = 0;
+    bench.run("utf8/validate", bytes, inputs.size(), [&]() {
+        valid = 0;
+        for (auto const &input : inputs)
+        {
+            valid += spre::is_valid_utf8(input) ? 1 : 0;
+        }
+    });
+    bench.run("utf8/validate_decode", bytes, inputs.size(), [&]() {
+        decoded = 0;
+        for (auto const &input : inputs)
+        {
+            size_t length = 1;
+            for (size_t pos = 0; pos < input.length() && length != 0; pos += length)
+            {
+                uint32_t code_point = 0;
+                length = spre::decode_utf8(input.data() + pos, input.length() - pos, code_point);
+            }
+            decoded += length != 0 ? 1 : 0;
+        }
+    });
+    if (valid != inputs.size() || decoded != inputs.size())
+    {
+        fprintf(stderr, "utf8/validate refused some valid UTF-8\n");
+        return false;
+    }
+
+    spre::SRL srl("any of (literally \"ERROR\", literally \"WARN\"), letter never or more, anything never or more, "
+                  "literally \"took \", digit once or more, unicode");
+    if (!srl.is_compiled())
+    {
+        fprintf(stderr, "utf8 could not be compiled\n");
+        return false;
+    }
+    spre::Matcher matcher(srl.get_program());
+    size_t expected = 0;
+    for (auto const &input : inputs)
+    {
+        expected += matcher.search(input) ? 1 : 0;
+    }
+    bench.run("utf8/match/nfa", bytes, inputs.size(), [&]() {
+        for (auto const &input : inputs)
+        {
+            matcher.search(input);
+        }
+    }, static_cast<long>(expected));
+    spre::Dfa dfa(srl.get_program());
+    vector<uint64_t> bitmap;
+    dfa.match_batch(inputs, bitmap);
+    size_t count = count_bits(bitmap);
+    if (!check("utf8/match/dfa", count, expected))
+    {
+        return false;
+    }
+    bench.run("utf8/match/dfa", bytes, inputs.size(), [&]() { dfa.match_batch(inputs, bitmap); },
+              static_cast<long>(count));
+    return true;
+}
+
+static bool bench_extract(Bench &bench)
+{
+    // the fields of the log lines, into the columns of an Extractor and,
+    // as a baseline, into a map of strings per line
+    if (!bench.is_enabled("extract/"))
+    {
+        return true;
+    }
+    std::mt19937 rng(2017);
+    vector<string> inputs = make_log_lines(rng);
+    string text;
+    for (auto const &input : inputs)
+    {
+        text += input + "\n";
+    }
+    spre::SRL srl("literally \"2017-05-\", capture (digit once or more) as \"day\", literally \" \", "
+                  "capture (any of (literally \"ERROR\", literally \"WARN\")) as \"level\", "
+                  "anything never or more, literally \" \", capture (digit once or more) as \"took\", "
+                  "literally \"ms\", must end");
+    if (!srl.is_compiled())
+    {
+        fprintf(stderr, "extract could not be compiled\n");
+        return false;
+    }
+    const spre::Program &program = srl.get_program();
+
+    spre::Matcher matcher(program);
+    size_t expected = 0;
+    for (auto const &input : inputs)
+    {
+        expected += matcher.search(input) ? 1 : 0;
+    }
+    bench.run("extract/map", text.length(), inputs.size(), [&]() {
+        for (auto const &input : inputs)
+        {
+            spre::Match match;
+            if (matcher.search(input, &match))
+            {
+                std::map<string, string> fields;
+                for (size_t i = 1; i < program.get_capture_count(); i++)
+                {
+                    fields[program.get_capture_name(i)] = match.get_group(input, i);
+                }
+            }
+        }
+    }, static_cast<long>(expected));
+
+    spre::Extractor extractor(program);
+    spre::ExtractBatch batch;
+    extractor.feed(text.data(), text.length());
+    size_t rows = extractor.get_row_count();
+    extractor.take(batch);
+    if (!check("extract/columns", rows, expected))
+    {
+        return false;
+    }
+    bench.run("extract/columns", text.length(), inputs.size(), [&]() {
+        extractor.feed(text.data(), text.length());
+        extractor.take(batch);
+    }, static_cast<long>(rows));
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Bench bench(argc > 1 ? argv[1] : nullptr);
+    bool jit_native = false;
+    bench_compile(bench);
+    if (!bench_match(bench, jit_native) || !bench_index(bench) || !bench_utf8(bench) || !bench_extract(bench))
+    {
+        return 1;
+    }
+    bench.print(jit_native);
+    return 0;
+}
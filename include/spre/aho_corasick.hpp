@@ -0,0 +1,343 @@
+/*
+ * find which of many literals appear in a text, in one pass
+ *
+ * a plain Aho-Corasick automaton, but with every failure link already
+ * followed while building, so that scanning is one table lookup per
+ * byte. The table is dense: one row per state, one column per class of
+ * bytes, where all the bytes which do not appear in any literal share a
+ * single class. That keeps the rows short (and the table in the cache)
+ * even for long lists of keywords. The entries of the table are already
+ * multiplied by the row length, and the top bit of an entry tells that
+ * the state has something to report, so the scanning loop is only a
+ * load, an add and a test.
+ *
+ * every literal carries an id, several literals could share one id,
+ * find() reports the ids of all the literals which appear. An automaton
+ * built to fold case gives an ASCII upper case letter the class of its
+ * lower case one, so the scanning loop finds "GET" and "get" alike with
+ * no extra work per byte.
+ *
+ * once built, an automaton is only a few flat arrays, which a rule set
+ * writes into its image (see image.hpp) and later uses from there.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_AHO_CORASICK_H_
+#define SIMPLEREGEXLANGUAGE_AHO_CORASICK_H_
+
+#include "spre/buffer.hpp"
+#include "spre/image.hpp"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+class AhoCorasick
+{
+  public:
+    explicit AhoCorasick(bool fold = false);
+    ~AhoCorasick();
+    void add(const string &literal, size_t id);
+    void build();
+    bool empty() const;
+    size_t get_id_count() const;
+    void find(const char *text, size_t len, vector<bool> &found) const;
+    void write(ImageWriter &writer, size_t first_section) const;
+    bool read(const ImageReader &reader, size_t first_section, size_t id_count);
+
+    // the number of sections write() needs
+    static const size_t SECTION_COUNT = 5;
+
+  private:
+    bool fold_;
+    vector<string> literals_;
+    vector<size_t> ids_;
+    Buffer<uint16_t> classes_;  // byte -> column of the table
+    size_t class_count_;
+    Buffer<uint32_t> table_;    // row of state + class -> row of the next state
+    Buffer<uint32_t> out_ends_; // where the ids ending right at each state end
+    Buffer<uint64_t> out_ids_;
+    Buffer<uint32_t> out_link_; // the next state on the failure chain with outputs
+
+    static const uint32_t OUTPUT_FLAG = 0x80000000u;
+
+    uint32_t get_out_begin(uint32_t state) const;
+};
+
+AhoCorasick::AhoCorasick(bool fold) : fold_(fold), class_count_(1)
+{
+    classes_.assign(256, 0);
+}
+
+AhoCorasick::~AhoCorasick()
+{
+}
+
+inline void AhoCorasick::add(const string &literal, size_t id)
+{
+    literals_.push_back(literal);
+    ids_.push_back(id);
+    if (fold_)
+    {
+        for (auto &c : literals_.back())
+        {
+            if (c >= 'A' && c <= 'Z')
+            {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+        }
+    }
+}
+
+inline bool AhoCorasick::empty() const
+{
+    return literals_.empty() && out_ids_.empty();
+}
+
+inline size_t AhoCorasick::get_id_count() const
+{
+    // how many ids a built automaton reports, counting repeated ones
+    return out_ids_.size();
+}
+
+inline void AhoCorasick::build()
+{
+    const uint32_t none = static_cast<uint32_t>(-1);
+
+    // the bytes used by the literals get their own classes, the others share 0
+    class_count_ = 1;
+    classes_.assign(256, 0);
+    for (auto const &literal : literals_)
+    {
+        for (auto const &c : literal)
+        {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (classes_[byte] == 0)
+            {
+                classes_[byte] = static_cast<uint16_t>(class_count_++);
+            }
+        }
+    }
+    if (fold_)
+    {
+        // the literals are in lower case, so are their classes
+        for (unsigned char c = 'A'; c <= 'Z'; c++)
+        {
+            classes_[c] = classes_[c - 'A' + 'a'];
+        }
+    }
+
+    // the trie, with none for the missing edges
+    vector<uint32_t> table(class_count_, none);
+    vector<vector<size_t>> outs(1);
+    for (size_t i = 0; i < literals_.size(); i++)
+    {
+        uint32_t state = 0;
+        for (auto const &c : literals_[i])
+        {
+            size_t edge = state * class_count_ + classes_[static_cast<unsigned char>(c)];
+            if (table[edge] == none)
+            {
+                table[edge] = static_cast<uint32_t>(outs.size());
+                table.resize(table.size() + class_count_, none);
+                outs.push_back(vector<size_t>());
+            }
+            state = table[edge];
+        }
+        outs[state].push_back(ids_[i]);
+    }
+
+    // breadth first, fill every missing edge with the one of the failure state
+    vector<uint32_t> fail(outs.size(), 0);
+    out_link_.assign(outs.size(), none);
+    std::deque<uint32_t> queue;
+    for (size_t k = 0; k < class_count_; k++)
+    {
+        if (table[k] == none)
+        {
+            table[k] = 0;
+        }
+        else
+        {
+            queue.push_back(table[k]);
+        }
+    }
+    while (!queue.empty())
+    {
+        uint32_t state = queue.front();
+        queue.pop_front();
+        uint32_t link = fail[state];
+        out_link_[state] = outs[link].empty() ? out_link_[link] : link;
+        for (size_t k = 0; k < class_count_; k++)
+        {
+            uint32_t &next = table[state * class_count_ + k];
+            uint32_t fallback = table[link * class_count_ + k];
+            if (next == none)
+            {
+                next = fallback;
+            }
+            else
+            {
+                fail[next] = fallback;
+                queue.push_back(next);
+            }
+        }
+    }
+
+    table_.assign(table.size(), 0);
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        uint32_t next = table[i];
+        bool output = !outs[next].empty() || out_link_[next] != none;
+        table_[i] = static_cast<uint32_t>(next * class_count_) | (output ? OUTPUT_FLAG : 0);
+    }
+
+    out_ends_.clear();
+    out_ids_.clear();
+    for (auto const &iter : outs)
+    {
+        for (auto const &id : iter)
+        {
+            out_ids_.push_back(id);
+        }
+        out_ends_.push_back(static_cast<uint32_t>(out_ids_.size()));
+    }
+}
+
+inline void AhoCorasick::find(const char *text, size_t len, vector<bool> &found) const
+{
+    if (table_.empty())
+    {
+        return;
+    }
+
+    const uint32_t none = static_cast<uint32_t>(-1);
+    vector<bool> reported(out_link_.size(), false);
+    auto report = [&](uint32_t state) {
+        // each state on the chain only needs to be reported once
+        while (state != none && !reported[state])
+        {
+            reported[state] = true;
+            for (uint32_t i = get_out_begin(state); i < out_ends_[state]; i++)
+            {
+                found[static_cast<size_t>(out_ids_[i])] = true;
+            }
+            state = out_link_[state];
+        }
+    };
+
+    // an empty literal is found everywhere
+    report(out_ends_[0] == 0 ? none : 0);
+
+    uint32_t row = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        row = table_[(row & ~OUTPUT_FLAG) + classes_[static_cast<unsigned char>(text[i])]];
+        if (row & OUTPUT_FLAG)
+        {
+            report(static_cast<uint32_t>((row & ~OUTPUT_FLAG) / class_count_));
+        }
+    }
+}
+
+inline void AhoCorasick::write(ImageWriter &writer, size_t first_section) const
+{
+    // only a built automaton is written
+    writer.write(first_section, classes_.data(), classes_.size());
+    writer.write(first_section + 1, table_.data(), table_.size());
+    writer.write(first_section + 2, out_ends_.data(), out_ends_.size());
+    writer.write(first_section + 3, out_ids_.data(), out_ids_.size());
+    writer.write(first_section + 4, out_link_.data(), out_link_.size());
+}
+
+inline bool AhoCorasick::read(const ImageReader &reader, size_t first_section, size_t id_count)
+{
+    // the ids have to be below id_count, and every state inside the table
+    const uint16_t *classes = nullptr;
+    const uint32_t *table = nullptr;
+    const uint32_t *out_ends = nullptr;
+    const uint64_t *out_ids = nullptr;
+    const uint32_t *out_link = nullptr;
+    size_t classes_count = 0;
+    size_t table_count = 0;
+    size_t ends_count = 0;
+    size_t ids_count = 0;
+    size_t states = 0;
+    if (!reader.read(first_section, classes, classes_count) || !reader.read(first_section + 1, table, table_count)
+        || !reader.read(first_section + 2, out_ends, ends_count) || !reader.read(first_section + 3, out_ids, ids_count)
+        || !reader.read(first_section + 4, out_link, states))
+    {
+        return false;
+    }
+
+    literals_.clear();
+    ids_.clear();
+    classes_.clear();
+    table_.clear();
+    out_ends_.clear();
+    out_ids_.clear();
+    out_link_.clear();
+    class_count_ = 1;
+    if (states == 0)
+    {
+        // nothing was ever built
+        return table_count == 0 && ends_count == 0 && ids_count == 0;
+    }
+
+    const uint32_t none = static_cast<uint32_t>(-1);
+    size_t class_count = table_count / states;
+    if (classes_count != 256 || ends_count != states || class_count == 0 || table_count % states != 0
+        || table_count >= OUTPUT_FLAG)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < 256; i++)
+    {
+        if (classes[i] >= class_count)
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < table_count; i++)
+    {
+        if ((table[i] & ~OUTPUT_FLAG) >= table_count || (table[i] & ~OUTPUT_FLAG) % class_count != 0)
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < states; i++)
+    {
+        if (out_ends[i] > ids_count || (i > 0 && out_ends[i] < out_ends[i - 1])
+            || (out_link[i] != none && out_link[i] >= states))
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < ids_count; i++)
+    {
+        if (out_ids[i] >= id_count)
+        {
+            return false;
+        }
+    }
+
+    classes_.view(classes, classes_count);
+    table_.view(table, table_count);
+    out_ends_.view(out_ends, ends_count);
+    out_ids_.view(out_ids, ids_count);
+    out_link_.view(out_link, states);
+    class_count_ = class_count;
+    return true;
+}
+
+inline uint32_t AhoCorasick::get_out_begin(uint32_t state) const
+{
+    return state == 0 ? 0 : out_ends_[state - 1];
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_AHO_CORASICK_H_
@@ -7,6 +7,8 @@
 #ifndef SIMPLEREGEXLANGUAGE_AST_H_
 #define SIMPLEREGEXLANGUAGE_AST_H_
 
+#include "spre/charset.hpp"
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -17,24 +19,114 @@ using std::unique_ptr;
 
 namespace spre
 {
+// the upper bound of "once or more", "never or more" and "at least x times"
+const size_t QUANTIFIER_INFINITY = static_cast<size_t>(-1);
+
+enum class ExprType
+{
+    CHARACTER,
+    QUANTIFIER,
+    GROUP,
+    LOOKAROUND,
+    ALTERNATION,
+    FLAG,
+    ANCHOR,
+    FRAGMENT,
+    END_OF_FILE
+};
+
 class ExprAST
 {
   public:
+    ExprAST();
     virtual string get_val() const = 0;
+    virtual ExprType get_type() const = 0;
     virtual ~ExprAST() = default;
+    void set_span(size_t begin, size_t end);
+    size_t get_begin() const;
+    size_t get_end() const;
+
+  private:
+    size_t begin_; // the source it is parsed from, [begin_, end_)
+    size_t end_;
 };
 
+ExprAST::ExprAST() : begin_(0), end_(0)
+{
+}
+
+inline void ExprAST::set_span(size_t begin, size_t end)
+{
+    begin_ = begin;
+    end_ = end;
+}
+
+inline size_t ExprAST::get_begin() const
+{
+    return begin_;
+}
+
+inline size_t ExprAST::get_end() const
+{
+    return end_;
+}
+
 class CharacterExprAST : public ExprAST
 {
   public:
+    enum class Kind
+    {
+        LITERAL, // literally "...", matches the exact bytes
+        SET,     // one byte out of a set, e.g. letter, one of "..."
+        RAW      // raw "...", only meaningful as regex text
+    };
+
+    // where a set comes from, which tells what it means with the unicode
+    // flag, when it is about code points rather than bytes (see unicode.hpp)
+    enum class Class
+    {
+        NONE,             // the bytes of the set either way, e.g. digit
+        ONE_OF,           // one of "...", the characters are get_literal()
+        LETTER,           // a lowercase letter
+        UPPERCASE_LETTER,
+        WORD,             // any character
+        NOT_WORD,         // no character
+        WHITESPACE,
+        NOT_WHITESPACE,
+        ANYTHING          // anything but a new line
+    };
+
     CharacterExprAST(const string &val = "");
+    CharacterExprAST(const string &val, const string &literal);
+    CharacterExprAST(const string &val, const CharSet &set, Class set_class = Class::NONE,
+                     const string &chars = "");
     string get_val() const override;
+    ExprType get_type() const override;
+    Kind get_kind() const;
+    string get_literal() const;
+    const CharSet &get_set() const;
+    Class get_class() const;
 
   private:
     const string val_;
+    const Kind kind_;
+    const string literal_;
+    const CharSet set_;
+    const Class class_;
 };
 
-CharacterExprAST::CharacterExprAST(const string &val) : val_(val)
+CharacterExprAST::CharacterExprAST(const string &val)
+    : val_(val), kind_(Kind::RAW), class_(Class::NONE)
+{
+}
+
+CharacterExprAST::CharacterExprAST(const string &val, const string &literal)
+    : val_(val), kind_(Kind::LITERAL), literal_(literal), class_(Class::NONE)
+{
+}
+
+CharacterExprAST::CharacterExprAST(const string &val, const CharSet &set, Class set_class, const string &chars)
+    : val_(val), kind_(Kind::SET), literal_(chars), set_(set), class_(set_class)
 {
 }
 
@@ -43,23 +135,89 @@ inline string CharacterExprAST::get_val() const
     return val_;
 }
 
+inline ExprType CharacterExprAST::get_type() const
+{
+    return ExprType::CHARACTER;
+}
+
+inline CharacterExprAST::Kind CharacterExprAST::get_kind() const
+{
+    return kind_;
+}
+
+inline string CharacterExprAST::get_literal() const
+{
+    // the bytes of literally, or the characters of one of
+    return literal_;
+}
+
+inline const CharSet &CharacterExprAST::get_set() const
+{
+    return set_;
+}
+
+inline CharacterExprAST::Class CharacterExprAST::get_class() const
+{
+    return class_;
+}
+
 class QuantifierExprAST : public ExprAST
 {
   public:
-    QuantifierExprAST(const string &val);
+    // max == QUANTIFIER_INFINITY means there is no upper bound
+    QuantifierExprAST(size_t min, size_t max);
     string get_val() const override;
+    ExprType get_type() const override;
+    size_t get_min() const;
+    size_t get_max() const;
 
   private:
-    const string val_;
+    const size_t min_;
+    const size_t max_;
 };
 
-QuantifierExprAST::QuantifierExprAST(const string &val) : val_(val)
+QuantifierExprAST::QuantifierExprAST(size_t min, size_t max) : min_(min), max_(max)
 {
 }
 
 inline string QuantifierExprAST::get_val() const
 {
-    return val_;
+    if (max_ == QUANTIFIER_INFINITY)
+    {
+        if (min_ == 0)
+        {
+            return "*";
+        }
+        if (min_ == 1)
+        {
+            return "+";
+        }
+        return "{" + std::to_string(min_) + ",}";
+    }
+    if (min_ == 0 && max_ == 1)
+    {
+        return "?";
+    }
+    if (min_ == max_)
+    {
+        return "{" + std::to_string(min_) + "}";
+    }
+    return "{" + std::to_string(min_) + "," + std::to_string(max_) + "}";
+}
+
+inline ExprType QuantifierExprAST::get_type() const
+{
+    return ExprType::QUANTIFIER;
+}
+
+inline size_t QuantifierExprAST::get_min() const
+{
+    return min_;
+}
+
+inline size_t QuantifierExprAST::get_max() const
+{
+    return max_;
 }
 
 class GroupExprAST : public ExprAST
@@ -71,6 +229,10 @@ class GroupExprAST : public ExprAST
     void set_name(const string &name);
     void set_until_cond(vector<unique_ptr<ExprAST>> until_cond);
     string get_val() const override;
+    ExprType get_type() const override;
+    string get_name() const;
+    const vector<unique_ptr<ExprAST>> &get_cond() const;
+    vector<unique_ptr<ExprAST>> &get_cond();
 
   private:
     vector<unique_ptr<ExprAST>> cond_;
@@ -124,12 +286,36 @@ inline string GroupExprAST::get_val() const
     return "";
 }
 
+inline ExprType GroupExprAST::get_type() const
+{
+    return ExprType::GROUP;
+}
+
+inline string GroupExprAST::get_name() const
+{
+    return name_;
+}
+
+inline const vector<unique_ptr<ExprAST>> &GroupExprAST::get_cond() const
+{
+    return cond_;
+}
+
+inline vector<unique_ptr<ExprAST>> &GroupExprAST::get_cond()
+{
+    return cond_;
+}
+
 class LookAroundExprAST : public ExprAST
 {
   public:
     LookAroundExprAST(const vector<string> vals,
                       vector<unique_ptr<ExprAST>> cond = vector<unique_ptr<ExprAST>>());
     string get_val() const override;
+    ExprType get_type() const override;
+    string get_symbol() const;
+    const vector<unique_ptr<ExprAST>> &get_cond() const;
+    vector<unique_ptr<ExprAST>> &get_cond();
 
   private:
     const vector<string> vals_;
@@ -159,11 +345,85 @@ inline string LookAroundExprAST::get_val() const
     return "";
 }
 
+inline ExprType LookAroundExprAST::get_type() const
+{
+    return ExprType::LOOKAROUND;
+}
+
+inline string LookAroundExprAST::get_symbol() const
+{
+    // which lookaround it is, "(?=", "(?!", "(?<=" or "(?<!"
+    return vals_.empty() ? "" : vals_[0];
+}
+
+inline const vector<unique_ptr<ExprAST>> &LookAroundExprAST::get_cond() const
+{
+    return cond_;
+}
+
+inline vector<unique_ptr<ExprAST>> &LookAroundExprAST::get_cond()
+{
+    return cond_;
+}
+
+class AlternationExprAST : public ExprAST
+{
+  public:
+    // every branch is one ast, maybe followed by its quantifier
+    AlternationExprAST(vector<vector<unique_ptr<ExprAST>>> branches);
+    string get_val() const override;
+    ExprType get_type() const override;
+    const vector<vector<unique_ptr<ExprAST>>> &get_branches() const;
+    vector<vector<unique_ptr<ExprAST>>> &get_branches();
+
+  private:
+    vector<vector<unique_ptr<ExprAST>>> branches_;
+};
+
+AlternationExprAST::AlternationExprAST(vector<vector<unique_ptr<ExprAST>>> branches)
+    : branches_(std::move(branches))
+{
+}
+
+inline string AlternationExprAST::get_val() const
+{
+    string res = "(?:";
+    for (size_t i = 0; i < branches_.size(); i++)
+    {
+        if (i != 0)
+        {
+            res.append("|");
+        }
+        for (auto const &iter : branches_[i])
+        {
+            res.append(iter == nullptr ? "nullptr" : iter->get_val());
+        }
+    }
+    res.append(")");
+    return res;
+}
+
+inline ExprType AlternationExprAST::get_type() const
+{
+    return ExprType::ALTERNATION;
+}
+
+inline const vector<vector<unique_ptr<ExprAST>>> &AlternationExprAST::get_branches() const
+{
+    return branches_;
+}
+
+inline vector<vector<unique_ptr<ExprAST>>> &AlternationExprAST::get_branches()
+{
+    return branches_;
+}
+
 class FlagExprAST : public ExprAST
 {
   public:
     FlagExprAST(const string &val);
     string get_val() const override;
+    ExprType get_type() const override;
 
   private:
     const string val_;
@@ -178,11 +438,67 @@ inline string FlagExprAST::get_val() const
     return val_;
 }
 
+inline ExprType FlagExprAST::get_type() const
+{
+    return ExprType::FLAG;
+}
+
+class FragmentExprAST : public ExprAST
+{
+    // fragment "name", the asts of the fragment are shared by all the
+    // queries referring to it (see fragment_library.hpp)
+  public:
+    FragmentExprAST(const string &name, std::shared_ptr<const vector<unique_ptr<ExprAST>>> asts);
+    string get_val() const override;
+    ExprType get_type() const override;
+    string get_name() const;
+    const vector<unique_ptr<ExprAST>> &get_asts() const;
+
+  private:
+    string name_;
+    std::shared_ptr<const vector<unique_ptr<ExprAST>>> asts_;
+};
+
+// the fragments a parser could refer to, by their names
+using FragmentMap = std::map<string, std::shared_ptr<const vector<unique_ptr<ExprAST>>>>;
+
+FragmentExprAST::FragmentExprAST(const string &name, std::shared_ptr<const vector<unique_ptr<ExprAST>>> asts)
+    : name_(name), asts_(std::move(asts))
+{
+}
+
+inline string FragmentExprAST::get_val() const
+{
+    string res = "(?:";
+    for (auto const &iter : *asts_)
+    {
+        res.append(iter->get_val());
+    }
+    res.append(")");
+    return res;
+}
+
+inline ExprType FragmentExprAST::get_type() const
+{
+    return ExprType::FRAGMENT;
+}
+
+inline string FragmentExprAST::get_name() const
+{
+    return name_;
+}
+
+inline const vector<unique_ptr<ExprAST>> &FragmentExprAST::get_asts() const
+{
+    return *asts_;
+}
+
 class AnchorExprAST : public ExprAST
 {
   public:
     AnchorExprAST(const string &val);
     string get_val() const override;
+    ExprType get_type() const override;
 
   private:
     const string val_;
@@ -197,12 +513,18 @@ inline string AnchorExprAST::get_val() const
     return val_;
 }
 
+inline ExprType AnchorExprAST::get_type() const
+{
+    return ExprType::ANCHOR;
+}
+
 
 class EOFExprAST : public ExprAST
 {
 public:
     EOFExprAST();
     string get_val() const override;
+    ExprType get_type() const override;
 
 private:
 };
@@ -216,6 +538,11 @@ inline string EOFExprAST::get_val() const
     return "";
 }
 
+inline ExprType EOFExprAST::get_type() const
+{
+    return ExprType::END_OF_FILE;
+}
+
 }
 
 
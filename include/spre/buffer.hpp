@@ -0,0 +1,192 @@
+/*
+ * an array which either owns its elements or only looks at them
+ *
+ * the tables of a compiled program are built into a buffer of its own,
+ * but a program loaded from an image (see image.hpp) uses the bytes of
+ * the image right where they are, e.g. inside a mmap-ed file. Either
+ * way they are read through the same pointer, so the matcher does not
+ * care where a program comes from.
+ *
+ * a buffer which only looks at some memory is read only, and the memory
+ * has to outlive it.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_BUFFER_H_
+#define SIMPLEREGEXLANGUAGE_BUFFER_H_
+
+#include <utility>
+#include <vector>
+
+using std::vector;
+
+namespace spre
+{
+template <typename T>
+class Buffer
+{
+  public:
+    Buffer();
+    Buffer(const Buffer &other);
+    Buffer(Buffer &&other);
+    Buffer &operator=(const Buffer &other);
+    Buffer &operator=(Buffer &&other);
+    ~Buffer();
+    void push_back(const T &value);
+    void append(const T *values, size_t count);
+    void assign(size_t count, const T &value);
+    void view(const T *values, size_t count);
+    void clear();
+    bool is_view() const;
+    size_t size() const;
+    bool empty() const;
+    const T *data() const;
+    const T &operator[](size_t index) const;
+    T &operator[](size_t index);
+
+  private:
+    vector<T> owned_;
+    const T *data_; // owned_.data(), or the memory looked at
+    size_t size_;
+    bool view_;
+
+    void refresh();
+};
+
+template <typename T>
+Buffer<T>::Buffer() : data_(nullptr), size_(0), view_(false)
+{
+}
+
+template <typename T>
+Buffer<T>::Buffer(const Buffer &other) : owned_(other.owned_), data_(other.data_), size_(other.size_),
+                                         view_(other.view_)
+{
+    refresh();
+}
+
+template <typename T>
+Buffer<T>::Buffer(Buffer &&other) : owned_(std::move(other.owned_)), data_(other.data_), size_(other.size_),
+                                    view_(other.view_)
+{
+    refresh();
+    other.clear();
+}
+
+template <typename T>
+Buffer<T>::~Buffer()
+{
+}
+
+template <typename T>
+inline Buffer<T> &Buffer<T>::operator=(const Buffer &other)
+{
+    owned_ = other.owned_;
+    data_ = other.data_;
+    size_ = other.size_;
+    view_ = other.view_;
+    refresh();
+    return *this;
+}
+
+template <typename T>
+inline Buffer<T> &Buffer<T>::operator=(Buffer &&other)
+{
+    owned_ = std::move(other.owned_);
+    data_ = other.data_;
+    size_ = other.size_;
+    view_ = other.view_;
+    refresh();
+    other.clear();
+    return *this;
+}
+
+template <typename T>
+inline void Buffer<T>::push_back(const T &value)
+{
+    owned_.push_back(value);
+    refresh();
+}
+
+template <typename T>
+inline void Buffer<T>::append(const T *values, size_t count)
+{
+    owned_.insert(owned_.end(), values, values + count);
+    refresh();
+}
+
+template <typename T>
+inline void Buffer<T>::assign(size_t count, const T &value)
+{
+    view_ = false;
+    owned_.assign(count, value);
+    refresh();
+}
+
+template <typename T>
+inline void Buffer<T>::view(const T *values, size_t count)
+{
+    owned_.clear();
+    owned_.shrink_to_fit();
+    view_ = true;
+    data_ = values;
+    size_ = count;
+}
+
+template <typename T>
+inline void Buffer<T>::clear()
+{
+    owned_.clear();
+    view_ = false;
+    refresh();
+}
+
+template <typename T>
+inline bool Buffer<T>::is_view() const
+{
+    return view_;
+}
+
+template <typename T>
+inline size_t Buffer<T>::size() const
+{
+    return size_;
+}
+
+template <typename T>
+inline bool Buffer<T>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename T>
+inline const T *Buffer<T>::data() const
+{
+    return data_;
+}
+
+template <typename T>
+inline const T &Buffer<T>::operator[](size_t index) const
+{
+    return data_[index];
+}
+
+template <typename T>
+inline T &Buffer<T>::operator[](size_t index)
+{
+    // only while building, a view is never written
+    return owned_[index];
+}
+
+template <typename T>
+inline void Buffer<T>::refresh()
+{
+    // the elements of a vector move whenever it grows
+    if (!view_)
+    {
+        data_ = owned_.data();
+        size_ = owned_.size();
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_BUFFER_H_
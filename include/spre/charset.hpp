@@ -0,0 +1,124 @@
+/*
+ * a set of bytes, used by the native engine to describe character classes
+ *
+ * it is kept as a plain bitmap (no pointers inside) so that it can be
+ * copied around freely and stored inside a compiled program as it is.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_CHARSET_H_
+#define SIMPLEREGEXLANGUAGE_CHARSET_H_
+
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+namespace spre
+{
+class CharSet
+{
+  public:
+    CharSet();
+    void add(unsigned char c);
+    void add_range(unsigned char lo, unsigned char hi);
+    void add_set(const CharSet &other);
+    void add_string(const string &chars);
+    void negate();
+    void fold_case();
+    bool has(unsigned char c) const;
+    size_t count() const;
+    bool operator==(const CharSet &other) const;
+    bool operator!=(const CharSet &other) const;
+
+  private:
+    uint64_t bits_[4];
+};
+
+CharSet::CharSet() : bits_{0, 0, 0, 0}
+{
+}
+
+inline void CharSet::add(unsigned char c)
+{
+    bits_[c >> 6] |= uint64_t(1) << (c & 63);
+}
+
+inline void CharSet::add_range(unsigned char lo, unsigned char hi)
+{
+    for (unsigned c = lo; c <= hi; c++)
+    {
+        add(static_cast<unsigned char>(c));
+    }
+}
+
+inline void CharSet::add_set(const CharSet &other)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        bits_[i] |= other.bits_[i];
+    }
+}
+
+inline void CharSet::add_string(const string &chars)
+{
+    for (auto const &c : chars)
+    {
+        add(static_cast<unsigned char>(c));
+    }
+}
+
+inline void CharSet::negate()
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        bits_[i] = ~bits_[i];
+    }
+}
+
+inline void CharSet::fold_case()
+{
+    // adds the other case of every ASCII letter inside
+    for (unsigned char c = 'a'; c <= 'z'; c++)
+    {
+        unsigned char upper = static_cast<unsigned char>(c - 'a' + 'A');
+        if (has(c) || has(upper))
+        {
+            add(c);
+            add(upper);
+        }
+    }
+}
+
+inline bool CharSet::has(unsigned char c) const
+{
+    return (bits_[c >> 6] >> (c & 63)) & 1;
+}
+
+inline size_t CharSet::count() const
+{
+    size_t res = 0;
+    for (size_t i = 0; i < 4; i++)
+    {
+        uint64_t b = bits_[i];
+        while (b != 0)
+        {
+            b &= b - 1;
+            res++;
+        }
+    }
+    return res;
+}
+
+inline bool CharSet::operator==(const CharSet &other) const
+{
+    return bits_[0] == other.bits_[0] && bits_[1] == other.bits_[1] &&
+           bits_[2] == other.bits_[2] && bits_[3] == other.bits_[3];
+}
+
+inline bool CharSet::operator!=(const CharSet &other) const
+{
+    return !(*this == other);
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_CHARSET_H_
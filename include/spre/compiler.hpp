@@ -0,0 +1,1113 @@
+/*
+ * turn the asts from the parser into a program for the native engine
+ *
+ * the asts are a flat list where a quantifier applies to the ast right
+ * before it, exactly like how the generated regex string reads. Every
+ * group is a capturing group, numbered in the same order as the "(" in
+ * the generated regex string, so that the group numbers of the native
+ * engine and of a regex library agree with each other.
+ *
+ * the branches of "any of" are tried in the order they are written. The
+ * literal ones next to each other are merged into a trie first (see
+ * literal_trie.hpp), any other branch is compiled on its own.
+ *
+ * the compiler also measures the asts (see Program::set_length() and
+ * Program::set_anchors()), the lengths are only about the bytes that a
+ * match consumes, so anchors, flags and lookarounds count as 0.
+ *
+ * for a query anchored by "must end" only, the same asts are compiled
+ * once more in reverse_ mode: sequences and literals are emitted back to
+ * front and groups do not capture. The anchors stay as they are, since
+ * they test absolute positions of the input.
+ *
+ * every instruction remembers the source of the innermost item of a
+ * sequence (an ast with its quantifier) it is compiled from, e.g. the
+ * loop of "anything never or more" and the set inside it both point at
+ * the whole of it. The profiler (see profiler.hpp) uses these spans.
+ *
+ * with a FragmentCache (see fragment_cache.hpp), a group or an any of
+ * which was compiled before, in this query or in another one compiled
+ * with the same cache, is pasted from the cache instead. The pasted
+ * instructions only get the span of the item around them, so do the
+ * instructions of a fragment "name" (see fragment_library.hpp).
+ *
+ * with the unicode flag, the classes of code points (letter, whitespace,
+ * anything and so on, see unicode.hpp) are compiled into the bytes of
+ * their UTF-8 (see utf8_automaton.hpp), and so is one of with non-ASCII
+ * characters in it. Their lengths are the lengths of those bytes.
+ *
+ * case insensitive queries are folded while compiling, there is nothing
+ * to fold at match time: a letter of a literal becomes a set of all the
+ * letters it folds together with (a SET of bytes, or with the unicode
+ * flag the bytes of those code points, see get_case_orbit(), so that
+ * e.g. k also matches U+212A KELVIN SIGN), a set gets the other case of
+ * its letters, and the tries of any of are built from the lowercase
+ * literals and take both cases at every fork. So the program of a case
+ * insensitive query is as fast as any other.
+ *
+ * "all lazy" only turns the priorities of the repetitions around: the
+ * SPLITs prefer to leave the loop, and the COUNTER_TESTs are not greedy
+ * (see set_split()). The Pike VM keeps the threads in priority order, so
+ * this gives the same leftmost-first matches as a lazy regex.
+ *
+ * a lookaround becomes an ASSERT_LOOK followed by its body (see
+ * program.hpp), a lookahead compiled in reverse_ mode and a lookbehind
+ * as it is. The groups inside a body keep their numbers, so that they
+ * agree with the generated regex, but do not capture. The reversed copy
+ * of a "must end" query refers to the looks of the forward one. A
+ * subtree with a lookaround inside is not kept in the FragmentCache,
+ * its looks are numbered for this program only.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_COMPILER_H_
+#define SIMPLEREGEXLANGUAGE_COMPILER_H_
+
+#include "spre/ast.hpp"
+#include "spre/fragment_cache.hpp"
+#include "spre/literal_trie.hpp"
+#include "spre/program.hpp"
+#include "spre/unicode.hpp"
+#include "spre/utf8_automaton.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+class Compiler
+{
+  public:
+    explicit Compiler(bool show_error = true, FragmentCache *cache = nullptr);
+    ~Compiler();
+    bool has_error() const;
+    void report_error() const;
+    Program compile(const vector<unique_ptr<ExprAST>> &asts);
+    const vector<std::pair<size_t, size_t>> &get_spans() const;
+
+  private:
+    Program program_;
+    bool error_flag_;
+    string error_msg_;
+    const bool show_error_;
+    bool multi_line_;
+    bool reverse_;
+    bool utf8_;
+    bool case_insensitive_;
+    bool lazy_; // all lazy, every repetition prefers fewer times
+    size_t fragment_depth_; // how many fragments the compiler is inside
+    size_t look_depth_;     // how many lookarounds the compiler is inside
+    size_t look_asserts_;   // the ASSERT_LOOKs emitted so far
+    std::unordered_map<const ExprAST *, uint32_t> looks_; // the look of every lookaround compiled
+    vector<std::pair<size_t, size_t>> spans_; // of every instruction, string::npos for none
+    FragmentCache *cache_;                    // nullptr to compile everything
+    std::unordered_map<const ExprAST *, size_t> ids_; // of the subtrees in the cache
+
+    void scan_flags(const vector<unique_ptr<ExprAST>> &asts);
+    void compile_sequence(const vector<unique_ptr<ExprAST>> &asts);
+    void compile_expr(const ExprAST &ast);
+    void compile_character(const CharacterExprAST &ast);
+    void compile_literal(const string &literal);
+    void compile_code_points(const CodePointRanges &ranges, const string &val);
+    bool get_code_points(const CharacterExprAST &ast, CodePointRanges &ranges) const;
+    void compile_group(const GroupExprAST &ast);
+    void compile_alternation(const AlternationExprAST &ast);
+    void compile_anchor(const AnchorExprAST &ast);
+    void compile_lookaround(const LookAroundExprAST &ast);
+    void add_captures(const vector<unique_ptr<ExprAST>> &asts);
+    void compile_repeat(const ExprAST &ast, const QuantifierExprAST &quantifier);
+    void set_split(uint32_t pc, uint32_t more, uint32_t fewer);
+    uint32_t get_mode() const;
+    Fragment cut(uint32_t first, size_t first_capture, size_t first_counter) const;
+    void paste(const Fragment &fragment);
+    void measure_sequence(const vector<unique_ptr<ExprAST>> &asts, size_t &min, size_t &max) const;
+    void measure_expr(const ExprAST &ast, size_t &min, size_t &max) const;
+    void scan_anchors(const vector<unique_ptr<ExprAST>> &asts);
+    uint32_t emit(OpCode op, uint32_t arg = 0, uint32_t x = 0, uint32_t y = 0);
+    uint32_t next_pc() const;
+    void set_spans(uint32_t first, size_t begin, size_t end);
+    void set_error(const string &msg);
+};
+
+Compiler::Compiler(bool show_error, FragmentCache *cache)
+    : error_flag_(false), show_error_(show_error), multi_line_(false), reverse_(false),
+      utf8_(false), case_insensitive_(false), lazy_(false), fragment_depth_(0), look_depth_(0), look_asserts_(0),
+      cache_(cache)
+{
+}
+
+Compiler::~Compiler()
+{
+}
+
+inline bool Compiler::has_error() const
+{
+    return error_flag_;
+}
+
+inline void Compiler::report_error() const
+{
+    if (!has_error())
+    {
+        return;
+    }
+    fprintf(stderr, "compiler error: ");
+    fprintf(stderr, "%s", error_msg_.c_str());
+    fprintf(stderr, "\n");
+}
+
+inline Program Compiler::compile(const vector<unique_ptr<ExprAST>> &asts)
+{
+    program_ = Program();
+    spans_.clear();
+    error_flag_ = false;
+    error_msg_.clear();
+    multi_line_ = false;
+    utf8_ = false;
+    case_insensitive_ = false;
+    lazy_ = false;
+    look_asserts_ = 0;
+    looks_.clear();
+    ids_.clear();
+
+    scan_flags(asts);
+    if (cache_ != nullptr)
+    {
+        cache_->intern(asts, ids_);
+    }
+
+    emit(OpCode::SAVE, 0);
+    compile_sequence(asts);
+    emit(OpCode::SAVE, 1);
+    emit(OpCode::MATCH);
+
+    if (!error_flag_)
+    {
+        size_t min = 0;
+        size_t max = 0;
+        measure_sequence(asts, min, max);
+        program_.set_length(min, max);
+        program_.set_utf8(utf8_);
+        scan_anchors(asts);
+    }
+
+    if (!error_flag_ && program_.is_anchored_end() && !program_.is_anchored_begin())
+    {
+        reverse_ = true;
+        program_.set_reverse_start(next_pc());
+        compile_sequence(asts);
+        emit(OpCode::MATCH);
+        reverse_ = false;
+    }
+
+    if (show_error_)
+    {
+        report_error();
+    }
+
+    if (error_flag_)
+    {
+        // what was emitted before the error would match whatever its
+        // prefix does, the empty program never runs (see Program::is_sound())
+        program_ = Program();
+    }
+    set_spans(0, string::npos, string::npos);
+    return std::move(program_);
+}
+
+inline const vector<std::pair<size_t, size_t>> &Compiler::get_spans() const
+{
+    // indexed by the pc, the instructions around the whole query have none
+    return spans_;
+}
+
+inline void Compiler::scan_flags(const vector<unique_ptr<ExprAST>> &asts)
+{
+    // flags apply to the whole query wherever they are written
+    for (auto const &iter : asts)
+    {
+        if (iter == nullptr)
+        {
+            continue;
+        }
+        if (iter->get_type() == ExprType::GROUP)
+        {
+            scan_flags(static_cast<const GroupExprAST &>(*iter).get_cond());
+        }
+        if (iter->get_type() == ExprType::ALTERNATION)
+        {
+            for (auto const &branch : static_cast<const AlternationExprAST &>(*iter).get_branches())
+            {
+                scan_flags(branch);
+            }
+        }
+        if (iter->get_type() == ExprType::LOOKAROUND)
+        {
+            scan_flags(static_cast<const LookAroundExprAST &>(*iter).get_cond());
+        }
+        if (iter->get_type() != ExprType::FLAG)
+        {
+            continue;
+        }
+
+        string flag = iter->get_val();
+        if (flag == "m")
+        {
+            multi_line_ = true;
+        }
+        else if (flag == "u")
+        {
+            utf8_ = true;
+        }
+        else if (flag == "i")
+        {
+            case_insensitive_ = true;
+        }
+        else if (flag == "U")
+        {
+            lazy_ = true;
+        }
+    }
+}
+
+inline void Compiler::compile_sequence(const vector<unique_ptr<ExprAST>> &asts)
+{
+    // pair every ast with its quantifier first, so that the pairs could be
+    // emitted in either order
+    vector<std::pair<const ExprAST *, const QuantifierExprAST *>> items;
+    for (size_t i = 0; i < asts.size(); i++)
+    {
+        if (asts[i] == nullptr)
+        {
+            set_error("so invalid ast met, some errors happened");
+            return;
+        }
+        if (asts[i]->get_type() == ExprType::QUANTIFIER)
+        {
+            set_error("there is nothing before \"" + asts[i]->get_val() + "\" to repeat");
+            return;
+        }
+
+        const ExprAST *ast = asts[i].get();
+        const QuantifierExprAST *quantifier = nullptr;
+        if (i + 1 < asts.size() && asts[i + 1] != nullptr && asts[i + 1]->get_type() == ExprType::QUANTIFIER)
+        {
+            quantifier = static_cast<const QuantifierExprAST *>(asts[i + 1].get());
+            i++; // the quantifier is consumed as well
+        }
+        items.push_back(std::make_pair(ast, quantifier));
+    }
+
+    if (reverse_)
+    {
+        std::reverse(items.begin(), items.end());
+    }
+
+    for (auto const &iter : items)
+    {
+        if (error_flag_)
+        {
+            return;
+        }
+        uint32_t first = next_pc();
+        if (iter.second != nullptr)
+        {
+            compile_repeat(*iter.first, *iter.second);
+            set_spans(first, iter.first->get_begin(), iter.second->get_end());
+        }
+        else
+        {
+            compile_expr(*iter.first);
+            set_spans(first, iter.first->get_begin(), iter.first->get_end());
+        }
+    }
+}
+
+inline void Compiler::compile_expr(const ExprAST &ast)
+{
+    auto id = ids_.find(&ast);
+    if (id != ids_.end())
+    {
+        const Fragment *fragment = cache_->find(id->second, get_mode());
+        if (fragment != nullptr)
+        {
+            paste(*fragment);
+            return;
+        }
+    }
+    uint32_t first = next_pc();
+    size_t first_capture = program_.get_capture_count();
+    size_t first_counter = program_.get_counter_count();
+    size_t first_assert = look_asserts_;
+
+    switch (ast.get_type())
+    {
+    case ExprType::CHARACTER:
+        compile_character(static_cast<const CharacterExprAST &>(ast));
+        break;
+    case ExprType::GROUP:
+        compile_group(static_cast<const GroupExprAST &>(ast));
+        break;
+    case ExprType::ALTERNATION:
+        compile_alternation(static_cast<const AlternationExprAST &>(ast));
+        break;
+    case ExprType::ANCHOR:
+        compile_anchor(static_cast<const AnchorExprAST &>(ast));
+        break;
+    case ExprType::FRAGMENT:
+        // the spans inside are those of the source of the fragment
+        fragment_depth_++;
+        compile_sequence(static_cast<const FragmentExprAST &>(ast).get_asts());
+        fragment_depth_--;
+        break;
+    case ExprType::LOOKAROUND:
+        compile_lookaround(static_cast<const LookAroundExprAST &>(ast));
+        break;
+    case ExprType::FLAG:
+    case ExprType::END_OF_FILE:
+        // flags are already handled by scan_flags()
+        break;
+    default:
+        set_error("unknown ast met");
+        break;
+    }
+
+    if (id != ids_.end() && !error_flag_ && look_asserts_ == first_assert)
+    {
+        cache_->add(id->second, get_mode(), cut(first, first_capture, first_counter));
+    }
+}
+
+inline void Compiler::compile_character(const CharacterExprAST &ast)
+{
+    switch (ast.get_kind())
+    {
+    case CharacterExprAST::Kind::LITERAL:
+        compile_literal(ast.get_literal());
+        break;
+    case CharacterExprAST::Kind::SET:
+    {
+        CodePointRanges ranges;
+        if (utf8_ && ast.get_class() == CharacterExprAST::Class::ONE_OF && !is_valid_utf8(ast.get_literal()))
+        {
+            set_error("\"" + ast.get_val() + "\" is not valid UTF-8");
+            break;
+        }
+        if (get_code_points(ast, ranges))
+        {
+            compile_code_points(ranges, ast.get_val());
+            break;
+        }
+        CharSet set = ast.get_set();
+        if (case_insensitive_)
+        {
+            set.fold_case();
+        }
+        emit(OpCode::SET, program_.add_set(set));
+        break;
+    }
+    case CharacterExprAST::Kind::RAW:
+        set_error("raw \"" + ast.get_val() + "\" is not supported by the native engine");
+        break;
+    }
+}
+
+inline void Compiler::compile_literal(const string &literal)
+{
+    if (!case_insensitive_)
+    {
+        string bytes = literal;
+        if (reverse_)
+        {
+            std::reverse(bytes.begin(), bytes.end());
+        }
+        for (auto const &c : bytes)
+        {
+            emit(OpCode::BYTE, static_cast<unsigned char>(c));
+        }
+        return;
+    }
+
+    // folded one character at a time, a byte without the unicode flag
+    vector<std::pair<uint32_t, string>> chars;
+    for (size_t pos = 0, length = 1; pos < literal.length(); pos += length)
+    {
+        uint32_t code_point = static_cast<unsigned char>(literal[pos]);
+        length = utf8_ ? decode_utf8(literal.data() + pos, literal.length() - pos, code_point) : 1;
+        if (length == 0)
+        {
+            // not UTF-8, the byte is taken as it is
+            code_point = static_cast<unsigned char>(literal[pos]);
+            length = 1;
+        }
+        chars.push_back(std::make_pair(code_point, literal.substr(pos, length)));
+    }
+    if (reverse_)
+    {
+        std::reverse(chars.begin(), chars.end());
+    }
+    for (auto const &iter : chars)
+    {
+        // a byte outside of ASCII is not a character of its own, and
+        // without the unicode flag an ASCII letter only folds to ASCII
+        vector<uint32_t> orbit(1, iter.first);
+        if (utf8_ || iter.first < 0x80)
+        {
+            orbit = get_case_orbit(iter.first);
+        }
+        if (!utf8_)
+        {
+            orbit.erase(std::remove_if(orbit.begin(), orbit.end(), [](uint32_t c) { return c >= 0x80; }),
+                        orbit.end());
+        }
+        if (orbit.size() > 1 && orbit.back() < 0x80)
+        {
+            CharSet set;
+            for (auto const &c : orbit)
+            {
+                set.add(static_cast<unsigned char>(c));
+            }
+            emit(OpCode::SET, program_.add_set(set));
+        }
+        else if (orbit.size() > 1)
+        {
+            CodePointRanges ranges;
+            for (auto const &c : orbit)
+            {
+                ranges.push_back(std::make_pair(c, c));
+            }
+            compile_code_points(ranges, iter.second);
+        }
+        else
+        {
+            string bytes = iter.second;
+            if (reverse_)
+            {
+                std::reverse(bytes.begin(), bytes.end());
+            }
+            for (auto const &c : bytes)
+            {
+                emit(OpCode::BYTE, static_cast<unsigned char>(c));
+            }
+        }
+    }
+}
+
+inline void Compiler::compile_code_points(const CodePointRanges &ranges, const string &val)
+{
+    Utf8Automaton automaton(ranges, reverse_);
+    if (automaton.empty())
+    {
+        set_error("\"" + val + "\" has no character to match");
+        return;
+    }
+    vector<uint32_t> exits;
+    automaton.compile(program_, exits);
+    for (auto const &iter : exits)
+    {
+        program_.at(iter).x = next_pc();
+    }
+}
+
+inline bool Compiler::get_code_points(const CharacterExprAST &ast, CodePointRanges &ranges) const
+{
+    // false for a set which is only about bytes, e.g. digit, or any set
+    // without the unicode flag
+    if (!utf8_ || ast.get_kind() != CharacterExprAST::Kind::SET)
+    {
+        return false;
+    }
+    if (ast.get_class() == CharacterExprAST::Class::ONE_OF)
+    {
+        const string &chars = ast.get_literal();
+        if (find_non_ascii(chars.data(), chars.length()) == chars.length()
+            && (!case_insensitive_ || has_ascii_orbits(chars)))
+        {
+            return false;
+        }
+        if (!get_char_ranges(chars, ranges))
+        {
+            return false;
+        }
+        if (case_insensitive_)
+        {
+            add_case_orbits(ranges);
+        }
+        return true;
+    }
+    ranges = get_class_ranges(ast.get_class());
+    return !ranges.empty();
+}
+
+inline void Compiler::compile_group(const GroupExprAST &ast)
+{
+    if (ast.get_cond().size() == 0)
+    {
+        // the generator emits nothing for it either
+        return;
+    }
+    if (reverse_ || look_depth_ != 0)
+    {
+        compile_sequence(ast.get_cond());
+        return;
+    }
+    uint32_t index = program_.add_capture(ast.get_name());
+    emit(OpCode::SAVE, 2 * index);
+    compile_sequence(ast.get_cond());
+    emit(OpCode::SAVE, 2 * index + 1);
+}
+
+inline void Compiler::compile_alternation(const AlternationExprAST &ast)
+{
+    // cut the branches into parts: a trie of literals, or a single branch
+    const vector<vector<unique_ptr<ExprAST>>> &branches = ast.get_branches();
+    vector<std::pair<unique_ptr<LiteralTrie>, size_t>> parts;
+    for (size_t i = 0; i < branches.size(); i++)
+    {
+        const vector<unique_ptr<ExprAST>> &branch = branches[i];
+        bool literal = branch.size() == 1 && branch[0] != nullptr && branch[0]->get_type() == ExprType::CHARACTER
+                       && static_cast<const CharacterExprAST &>(*branch[0]).get_kind() == CharacterExprAST::Kind::LITERAL;
+        string text = literal ? static_cast<const CharacterExprAST &>(*branch[0]).get_literal() : "";
+        if (literal && case_insensitive_ && utf8_ && !has_ascii_orbits(text))
+        {
+            // the trie only folds ASCII letters to ASCII letters
+            literal = false;
+        }
+        if (!literal)
+        {
+            parts.push_back(std::make_pair(unique_ptr<LiteralTrie>(), i));
+            continue;
+        }
+
+        if (reverse_)
+        {
+            std::reverse(text.begin(), text.end());
+        }
+        if (parts.empty() || parts.back().first == nullptr || !parts.back().first->add(text, i))
+        {
+            parts.push_back(std::make_pair(std::make_unique<LiteralTrie>(case_insensitive_), i));
+            parts.back().first->add(text, i);
+        }
+    }
+
+    // then try the parts one after the other
+    vector<uint32_t> exits;
+    for (size_t i = 0; i < parts.size() && !error_flag_; i++)
+    {
+        uint32_t split = 0;
+        if (i + 1 < parts.size())
+        {
+            split = emit(OpCode::SPLIT);
+            program_.at(split).x = next_pc();
+        }
+        if (parts[i].first != nullptr)
+        {
+            parts[i].first->compile(program_, exits);
+        }
+        else
+        {
+            compile_sequence(branches[parts[i].second]);
+        }
+        if (i + 1 < parts.size())
+        {
+            exits.push_back(emit(OpCode::JUMP));
+            program_.at(split).y = next_pc();
+        }
+    }
+    for (auto const &iter : exits)
+    {
+        program_.at(iter).x = next_pc();
+    }
+}
+
+inline void Compiler::compile_anchor(const AnchorExprAST &ast)
+{
+    if (ast.get_val() == "^")
+    {
+        emit(OpCode::ASSERT_BEGIN, multi_line_ ? 1 : 0);
+    }
+    else
+    {
+        emit(OpCode::ASSERT_END, multi_line_ ? 1 : 0);
+    }
+}
+
+inline void Compiler::compile_lookaround(const LookAroundExprAST &ast)
+{
+    uint32_t pc = emit(OpCode::ASSERT_LOOK);
+    look_asserts_++;
+    auto found = looks_.find(&ast);
+    if (found != looks_.end())
+    {
+        // the reversed copy, the body is already there
+        program_.at(pc).arg = found->second;
+        program_.at(pc).x = pc + 1;
+        return;
+    }
+
+    string symbol = ast.get_symbol();
+    Look look;
+    look.start = next_pc();
+    look.ahead = symbol == "(?=" || symbol == "(?!";
+    look.negate = symbol == "(?!" || symbol == "(?<!";
+    if (look_depth_ == 0)
+    {
+        add_captures(ast.get_cond());
+    }
+    bool reverse = reverse_;
+    reverse_ = look.ahead;
+    look_depth_++;
+    compile_sequence(ast.get_cond());
+    emit(OpCode::MATCH);
+    look_depth_--;
+    reverse_ = reverse;
+
+    uint32_t index = program_.add_look(look);
+    looks_[&ast] = index;
+    program_.at(pc).arg = index;
+    program_.at(pc).x = next_pc();
+}
+
+inline void Compiler::add_captures(const vector<unique_ptr<ExprAST>> &asts)
+{
+    // the groups compile_group() would have numbered, in the same order
+    for (auto const &iter : asts)
+    {
+        if (iter == nullptr)
+        {
+            continue;
+        }
+        switch (iter->get_type())
+        {
+        case ExprType::GROUP:
+        {
+            const GroupExprAST &group = static_cast<const GroupExprAST &>(*iter);
+            if (group.get_cond().size() != 0)
+            {
+                program_.add_capture(group.get_name());
+                add_captures(group.get_cond());
+            }
+            break;
+        }
+        case ExprType::ALTERNATION:
+            for (auto const &branch : static_cast<const AlternationExprAST &>(*iter).get_branches())
+            {
+                add_captures(branch);
+            }
+            break;
+        case ExprType::LOOKAROUND:
+            add_captures(static_cast<const LookAroundExprAST &>(*iter).get_cond());
+            break;
+        case ExprType::FRAGMENT:
+            add_captures(static_cast<const FragmentExprAST &>(*iter).get_asts());
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+inline void Compiler::compile_repeat(const ExprAST &ast, const QuantifierExprAST &quantifier)
+{
+    if (ast.get_type() != ExprType::CHARACTER && ast.get_type() != ExprType::GROUP
+        && ast.get_type() != ExprType::ALTERNATION && ast.get_type() != ExprType::FRAGMENT)
+    {
+        set_error("only characters, groups, any of and fragments could be repeated");
+        return;
+    }
+
+    size_t min = quantifier.get_min();
+    size_t max = quantifier.get_max();
+    if (min >= PROGRAM_INFINITY || (max != QUANTIFIER_INFINITY && max >= PROGRAM_INFINITY))
+    {
+        set_error("the bound of \"" + quantifier.get_val() + "\" is too large");
+        return;
+    }
+
+    // a body which could match nothing loops on a counter even without
+    // bounds: the matcher tells an iteration which consumed nothing by
+    // the counter, and leaves the loop after it (see matcher.hpp)
+    size_t body_min = 0;
+    size_t body_max = 0;
+    measure_expr(ast, body_min, body_max);
+    bool nullable = body_min == 0;
+
+    if (max == 0)
+    {
+        // still compiled, so that the groups inside keep their numbers
+        uint32_t jump = emit(OpCode::JUMP);
+        compile_expr(ast);
+        program_.at(jump).x = next_pc();
+    }
+    else if (min == 0 && max == 1)
+    {
+        uint32_t split = emit(OpCode::SPLIT);
+        compile_expr(ast);
+        set_split(split, split + 1, next_pc());
+    }
+    else if (min == 0 && max == QUANTIFIER_INFINITY && !nullable)
+    {
+        uint32_t split = emit(OpCode::SPLIT);
+        compile_expr(ast);
+        emit(OpCode::JUMP, 0, split);
+        set_split(split, split + 1, next_pc());
+    }
+    else if (min == 1 && max == 1)
+    {
+        compile_expr(ast);
+    }
+    else if (min == 1 && max == QUANTIFIER_INFINITY && !nullable)
+    {
+        uint32_t body = next_pc();
+        compile_expr(ast);
+        uint32_t split = emit(OpCode::SPLIT);
+        set_split(split, body, split + 1);
+    }
+    else
+    {
+        uint32_t counter = program_.add_counter();
+        uint32_t bound = max == QUANTIFIER_INFINITY ? PROGRAM_INFINITY : static_cast<uint32_t>(max);
+        emit(OpCode::COUNTER_INIT, counter);
+        uint32_t test = emit(OpCode::COUNTER_TEST, counter, next_pc() + 1);
+        compile_expr(ast);
+        uint32_t incr = emit(OpCode::COUNTER_INCR, counter, test);
+        program_.at(test).y = program_.at(incr).y = next_pc();
+        program_.at(test).greedy = !lazy_;
+        program_.at(test).min = program_.at(incr).min = static_cast<uint32_t>(min);
+        program_.at(test).max = program_.at(incr).max = bound;
+    }
+}
+
+inline void Compiler::set_split(uint32_t pc, uint32_t more, uint32_t fewer)
+{
+    // a greedy SPLIT prefers one more time round, a lazy one to leave
+    program_.at(pc).x = lazy_ ? fewer : more;
+    program_.at(pc).y = lazy_ ? more : fewer;
+}
+
+inline uint32_t Compiler::get_mode() const
+{
+    // whatever changes the instructions of the same asts
+    return (reverse_ ? 1 : 0) | (multi_line_ ? 2 : 0) | (utf8_ ? 4 : 0) | (case_insensitive_ ? 8 : 0)
+           | (look_depth_ != 0 ? 16 : 0) | (lazy_ ? 32 : 0);
+}
+
+inline Fragment Compiler::cut(uint32_t first, size_t first_capture, size_t first_counter) const
+{
+    // the instructions from first on, renumbered as if they started at 0.
+    // The tables added meanwhile are one after the other, though not in
+    // the order of the SWITCH using them
+    Fragment fragment;
+    uint32_t first_table = PROGRAM_INFINITY;
+    for (size_t pc = first; pc < program_.size(); pc++)
+    {
+        if (program_.at(pc).op == OpCode::SWITCH)
+        {
+            first_table = std::min(first_table, program_.at(pc).arg);
+        }
+    }
+    for (size_t pc = first; pc < program_.size(); pc++)
+    {
+        Instruction inst = program_.at(pc);
+        switch (inst.op)
+        {
+        case OpCode::SET:
+            fragment.sets.push_back(program_.get_set(inst.arg));
+            inst.arg = static_cast<uint32_t>(fragment.sets.size() - 1);
+            break;
+        case OpCode::SWITCH:
+        {
+            const uint32_t *table = program_.get_table(inst.arg);
+            inst.arg -= first_table;
+            fragment.tables.resize(std::max<size_t>(fragment.tables.size(), inst.arg + 1));
+            fragment.tables[inst.arg].assign(table, table + 256);
+            for (auto &entry : fragment.tables[inst.arg])
+            {
+                entry = entry == PROGRAM_INFINITY ? entry : entry - first;
+            }
+            break;
+        }
+        case OpCode::SPLIT:
+            inst.x -= first;
+            inst.y -= first;
+            break;
+        case OpCode::JUMP:
+            inst.x -= first;
+            break;
+        case OpCode::SAVE:
+            inst.arg -= static_cast<uint32_t>(2 * first_capture);
+            break;
+        case OpCode::COUNTER_INIT:
+            inst.arg -= static_cast<uint32_t>(first_counter);
+            break;
+        case OpCode::COUNTER_TEST:
+            inst.arg -= static_cast<uint32_t>(first_counter);
+            inst.x -= first;
+            inst.y -= first;
+            break;
+        case OpCode::COUNTER_INCR:
+            inst.arg -= static_cast<uint32_t>(first_counter);
+            inst.x -= first;
+            inst.y -= first;
+            break;
+        default:
+            break;
+        }
+        fragment.insts.push_back(inst);
+    }
+    for (size_t i = first_capture; i < program_.get_capture_count(); i++)
+    {
+        fragment.captures.push_back(program_.get_capture_name(i));
+    }
+    fragment.counter_count = program_.get_counter_count() - first_counter;
+    return fragment;
+}
+
+inline void Compiler::paste(const Fragment &fragment)
+{
+    // the other way round of cut(), at the end of the program
+    uint32_t first = next_pc();
+    uint32_t first_capture = static_cast<uint32_t>(program_.get_capture_count());
+    uint32_t first_counter = static_cast<uint32_t>(program_.get_counter_count());
+    for (auto const &name : fragment.captures)
+    {
+        program_.add_capture(name);
+    }
+    for (size_t i = 0; i < fragment.counter_count; i++)
+    {
+        program_.add_counter();
+    }
+    uint32_t first_table = 0;
+    for (size_t i = 0; i < fragment.tables.size(); i++)
+    {
+        vector<uint32_t> table = fragment.tables[i];
+        for (auto &entry : table)
+        {
+            entry = entry == PROGRAM_INFINITY ? entry : entry + first;
+        }
+        uint32_t index = program_.add_table(table);
+        first_table = i == 0 ? index : first_table;
+    }
+
+    for (auto inst : fragment.insts)
+    {
+        switch (inst.op)
+        {
+        case OpCode::SET:
+            inst.arg = program_.add_set(fragment.sets[inst.arg]);
+            break;
+        case OpCode::SWITCH:
+            inst.arg += first_table;
+            break;
+        case OpCode::SPLIT:
+            inst.x += first;
+            inst.y += first;
+            break;
+        case OpCode::JUMP:
+            inst.x += first;
+            break;
+        case OpCode::SAVE:
+            inst.arg += 2 * first_capture;
+            break;
+        case OpCode::COUNTER_INIT:
+            inst.arg += first_counter;
+            break;
+        case OpCode::COUNTER_TEST:
+            inst.arg += first_counter;
+            inst.x += first;
+            inst.y += first;
+            break;
+        case OpCode::COUNTER_INCR:
+            inst.arg += first_counter;
+            inst.x += first;
+            inst.y += first;
+            break;
+        default:
+            break;
+        }
+        program_.emit(inst);
+    }
+}
+
+inline size_t saturating_add(size_t a, size_t b)
+{
+    return a > LENGTH_INFINITY - b ? LENGTH_INFINITY : a + b;
+}
+
+inline size_t saturating_mul(size_t a, size_t b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+    return a > LENGTH_INFINITY / b ? LENGTH_INFINITY : a * b;
+}
+
+inline void Compiler::measure_sequence(const vector<unique_ptr<ExprAST>> &asts, size_t &min, size_t &max) const
+{
+    // only called after a successful compilation, so there is no nullptr
+    // and every quantifier follows something to repeat
+    min = 0;
+    max = 0;
+    for (size_t i = 0; i < asts.size(); i++)
+    {
+        size_t sub_min = 0;
+        size_t sub_max = 0;
+        measure_expr(*asts[i], sub_min, sub_max);
+        if (i + 1 < asts.size() && asts[i + 1]->get_type() == ExprType::QUANTIFIER)
+        {
+            const QuantifierExprAST &quantifier = static_cast<const QuantifierExprAST &>(*asts[i + 1]);
+            sub_min = saturating_mul(sub_min, quantifier.get_min());
+            sub_max = quantifier.get_max() == QUANTIFIER_INFINITY && sub_max != 0
+                          ? LENGTH_INFINITY
+                          : saturating_mul(sub_max, quantifier.get_max());
+            i++;
+        }
+        min = saturating_add(min, sub_min);
+        max = saturating_add(max, sub_max);
+    }
+}
+
+inline void Compiler::measure_expr(const ExprAST &ast, size_t &min, size_t &max) const
+{
+    min = 0;
+    max = 0;
+    switch (ast.get_type())
+    {
+    case ExprType::CHARACTER:
+    {
+        const CharacterExprAST &character = static_cast<const CharacterExprAST &>(ast);
+        min = max = character.get_kind() == CharacterExprAST::Kind::LITERAL ? character.get_literal().length() : 1;
+        CodePointRanges ranges;
+        if (character.get_kind() == CharacterExprAST::Kind::LITERAL && case_insensitive_ && utf8_)
+        {
+            // a letter matches its whole orbit, whose UTF-8 need not be
+            // as long as its own, e.g. k and U+212A KELVIN SIGN
+            const string &literal = character.get_literal();
+            min = max = 0;
+            for (size_t pos = 0, length = 1; pos < literal.length(); pos += length)
+            {
+                uint32_t code_point = 0;
+                length = decode_utf8(literal.data() + pos, literal.length() - pos, code_point);
+                if (length == 0)
+                {
+                    min += 1;
+                    max += 1;
+                    length = 1;
+                    continue;
+                }
+                vector<uint32_t> orbit = get_case_orbit(code_point);
+                min += get_utf8_length(orbit.front());
+                max += get_utf8_length(orbit.back());
+            }
+        }
+        else if (get_code_points(character, ranges))
+        {
+            // the ranges are in order, and so are the lengths of their UTF-8
+            min = get_utf8_length(ranges.front().first);
+            max = get_utf8_length(ranges.back().second);
+        }
+        break;
+    }
+    case ExprType::GROUP:
+        measure_sequence(static_cast<const GroupExprAST &>(ast).get_cond(), min, max);
+        break;
+    case ExprType::FRAGMENT:
+        measure_sequence(static_cast<const FragmentExprAST &>(ast).get_asts(), min, max);
+        break;
+    case ExprType::ALTERNATION:
+    {
+        // as short as the shortest branch, as long as the longest one
+        min = LENGTH_INFINITY;
+        for (auto const &branch : static_cast<const AlternationExprAST &>(ast).get_branches())
+        {
+            size_t branch_min = 0;
+            size_t branch_max = 0;
+            measure_sequence(branch, branch_min, branch_max);
+            min = std::min(min, branch_min);
+            max = std::max(max, branch_max);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+inline void Compiler::scan_anchors(const vector<unique_ptr<ExprAST>> &asts)
+{
+    // only the anchors on the top level (and not in multi line mode)
+    // pin the whole match to the beginning or the end of the input
+    bool anchored_begin = false;
+    bool anchored_end = false;
+    if (!multi_line_)
+    {
+        for (auto const &iter : asts)
+        {
+            if (iter->get_type() == ExprType::FLAG || iter->get_type() == ExprType::END_OF_FILE)
+            {
+                continue;
+            }
+            anchored_begin = iter->get_type() == ExprType::ANCHOR && iter->get_val() == "^";
+            break;
+        }
+        for (auto iter = asts.rbegin(); iter != asts.rend(); iter++)
+        {
+            if ((*iter)->get_type() == ExprType::FLAG || (*iter)->get_type() == ExprType::END_OF_FILE)
+            {
+                continue;
+            }
+            anchored_end = (*iter)->get_type() == ExprType::ANCHOR && (*iter)->get_val() == "$";
+            break;
+        }
+    }
+    program_.set_anchors(anchored_begin, anchored_end);
+}
+
+inline uint32_t Compiler::emit(OpCode op, uint32_t arg, uint32_t x, uint32_t y)
+{
+    return program_.emit(Instruction(op, arg, x, y));
+}
+
+inline uint32_t Compiler::next_pc() const
+{
+    return static_cast<uint32_t>(program_.size());
+}
+
+inline void Compiler::set_spans(uint32_t first, size_t begin, size_t end)
+{
+    // the instructions from first on which no nested item has claimed yet
+    spans_.resize(program_.size(), std::make_pair(string::npos, string::npos));
+    if (fragment_depth_ != 0)
+    {
+        return;
+    }
+    for (size_t pc = first; pc < spans_.size(); pc++)
+    {
+        if (spans_[pc].first == string::npos)
+        {
+            spans_[pc] = std::make_pair(begin, end);
+        }
+    }
+}
+
+inline void Compiler::set_error(const string &msg)
+{
+    if (error_flag_)
+    {
+        // keep the first error, which is usually the real one
+        return;
+    }
+    error_flag_ = true;
+    error_msg_ = msg;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_COMPILER_H_
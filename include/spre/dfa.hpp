@@ -0,0 +1,616 @@
+/*
+ * a lazily built DFA, which only tells whether a program matches
+ *
+ * validating lots of short inputs (ids, dates, codes) against a single
+ * query does not need the captures or where the match is, only a yes or
+ * a no. A DFA answers that with one table lookup per byte. Its states
+ * are built from the program on the fly, the first time they are
+ * reached, and are kept for all the inputs which come after.
+ *
+ * a state is the set of the threads of the Pike VM (see matcher.hpp) at
+ * the instructions which consume a byte, with their counters, plus what
+ * the assertions need to know about the position (whether it is the
+ * beginning, whether a '\n' was just read). A thread waiting for "must
+ * end" stays in the set until the next byte (or the end of the input)
+ * decides it. A state where any thread reaches MATCH ends the input
+ * with a yes. An empty set ends it with a no, but only for "begin with"
+ * queries, any other one could still start a match later on.
+ *
+ * the columns of the table are classes of bytes: two bytes which every
+ * instruction treats the same are in the same class, so e.g. digit
+ * exactly 4 times has only two columns.
+ *
+ * match_batch() walks several inputs at once, one byte of each in turn,
+ * so that the table lookups of different inputs overlap rather than all
+ * waiting for each other, and it writes the answers into a bitmap.
+ *
+ * an input which is not valid UTF-8 never matches a program compiled
+ * with the unicode flag, it is checked before its lane starts.
+ *
+ * the number of states is limited. When an input needs one more state
+ * than that, it is matched by the Pike VM instead. So is every input of
+ * a program with lookarounds, which the Pike VM decides at every
+ * position beforehand, something a state could not remember. build()
+ * makes all the states at once, e.g. before the DFA is turned into
+ * machine code (see jit.hpp). A Dfa is changed by matching, so it
+ * belongs to a single thread.
+ *
+ * a program which is not sound (see Program::is_sound()), e.g. the
+ * empty one of a query which could not be compiled, gets no states at
+ * all and never matches.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_DFA_H_
+#define SIMPLEREGEXLANGUAGE_DFA_H_
+
+#include "spre/matcher.hpp"
+#include "spre/program.hpp"
+#include "spre/utf8.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+class Dfa
+{
+  public:
+    explicit Dfa(const Program &program, size_t max_states = 4096);
+    ~Dfa();
+    bool match(const string &text);
+    bool match(const char *text, size_t len);
+    void match_batch(const vector<string> &texts, vector<uint64_t> &bitmap);
+    void match_batch(const char *const *texts, const size_t *lens, size_t count, uint64_t *bitmap);
+    bool build();
+    size_t get_state_count() const;
+
+  private:
+    friend class Jit;
+
+    struct Lane
+    {
+        const char *begin;
+        const char *pos;
+        const char *end;
+        uint32_t row;
+        size_t index;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const vector<uint32_t> &key) const
+        {
+            size_t res = 14695981039346656037ULL;
+            for (auto const &iter : key)
+            {
+                res = (res ^ iter) * 1099511628211ULL;
+            }
+            return res;
+        }
+    };
+
+    const Program &program_;
+    bool sound_;        // an unsound program (see Program::is_sound()) never matches
+    Matcher matcher_;   // for the inputs which need too many states
+    size_t max_states_;
+    size_t width_;      // of a thread in a key: the pc, then the counters
+    vector<uint16_t> classes_; // byte -> column of the table
+    vector<unsigned char> representatives_; // column -> one of its bytes
+    size_t class_count_;
+    vector<uint32_t> table_;   // row of state + class -> row of the next state
+    vector<vector<uint32_t>> keys_; // the flags, then the sorted threads
+    vector<int8_t> end_accepts_;    // -1 until it is known
+    std::unordered_map<vector<uint32_t>, uint32_t, KeyHash> states_;
+    uint32_t start_;
+
+    // the rows past the real ones
+    static const uint32_t DEAD_ROW = 0xFFFFFFFCu;
+    static const uint32_t MATCHED_ROW = 0xFFFFFFFDu;
+    static const uint32_t GIVE_UP_ROW = 0xFFFFFFFEu;
+    static const uint32_t UNKNOWN_ROW = 0xFFFFFFFFu;
+
+    // what a state knows about its position
+    static const uint32_t AT_BEGIN = 1;
+    static const uint32_t AFTER_NEWLINE = 2;
+
+    void find_classes();
+    uint32_t get_start();
+    uint32_t step(uint32_t row, unsigned char byte);
+    bool accepts_end(uint32_t row);
+    bool finish(const Lane &lane, uint32_t row);
+    bool start_lane(Lane &lane, const char *const *texts, const size_t *lens, size_t count, size_t &next,
+                    uint64_t *bitmap);
+    bool closure(vector<vector<uint32_t>> &stack, uint32_t flags, bool end_known, bool at_end,
+                 bool before_newline, vector<vector<uint32_t>> &out) const;
+    uint32_t add_state(uint32_t flags, vector<vector<uint32_t>> &threads, bool matched);
+};
+
+Dfa::Dfa(const Program &program, size_t max_states)
+    : program_(program), sound_(program.is_sound()), matcher_(program), max_states_(max_states),
+      width_(1 + program.get_counter_count()), class_count_(1), start_(UNKNOWN_ROW)
+{
+    if (sound_)
+    {
+        find_classes();
+    }
+}
+
+Dfa::~Dfa()
+{
+}
+
+inline bool Dfa::match(const string &text)
+{
+    return match(text.data(), text.length());
+}
+
+inline bool Dfa::match(const char *text, size_t len)
+{
+    uint64_t bit = 0;
+    match_batch(&text, &len, 1, &bit);
+    return bit != 0;
+}
+
+inline void Dfa::match_batch(const vector<string> &texts, vector<uint64_t> &bitmap)
+{
+    // bit i % 64 of bitmap[i / 64] tells whether texts[i] matches
+    vector<const char *> ptrs(texts.size());
+    vector<size_t> lens(texts.size());
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        ptrs[i] = texts[i].data();
+        lens[i] = texts[i].length();
+    }
+    bitmap.assign((texts.size() + 63) / 64, 0);
+    match_batch(ptrs.data(), lens.data(), texts.size(), bitmap.data());
+}
+
+inline void Dfa::match_batch(const char *const *texts, const size_t *lens, size_t count, uint64_t *bitmap)
+{
+    // bitmap has to hold (count + 63) / 64 words, only the bits of the
+    // inputs which match are set, the others are cleared
+    const size_t lane_count = 8;
+    Lane lanes[lane_count];
+    size_t active = 0;
+    size_t next = 0;
+
+    for (size_t i = 0; i < (count + 63) / 64; i++)
+    {
+        bitmap[i] = 0;
+    }
+    if (!sound_)
+    {
+        return;
+    }
+    while (active < lane_count && start_lane(lanes[active], texts, lens, count, next, bitmap))
+    {
+        active++;
+    }
+
+    while (active > 0)
+    {
+        for (size_t i = 0; i < active;)
+        {
+            Lane &lane = lanes[i];
+            uint32_t row = DEAD_ROW;
+            if (lane.pos != lane.end)
+            {
+                unsigned char byte = static_cast<unsigned char>(*lane.pos++);
+                row = table_[lane.row + classes_[byte]];
+                if (row >= DEAD_ROW)
+                {
+                    row = step(lane.row, byte);
+                }
+                if (row < DEAD_ROW)
+                {
+                    lane.row = row;
+                    i++;
+                    continue;
+                }
+            }
+            else
+            {
+                row = accepts_end(lane.row) ? MATCHED_ROW : DEAD_ROW;
+            }
+
+            // this input is done, the lane takes the next one
+            if (finish(lane, row))
+            {
+                bitmap[lane.index / 64] |= uint64_t(1) << (lane.index % 64);
+            }
+            if (!start_lane(lane, texts, lens, count, next, bitmap))
+            {
+                lanes[i] = lanes[--active];
+            }
+        }
+    }
+}
+
+inline bool Dfa::build()
+{
+    // builds every state ahead of time, false if there are too many
+    if (!sound_ || get_start() == GIVE_UP_ROW)
+    {
+        return false;
+    }
+    for (size_t index = 0; index < keys_.size(); index++)
+    {
+        uint32_t row = static_cast<uint32_t>(index * class_count_);
+        for (size_t i = 0; i < class_count_; i++)
+        {
+            if (table_[row + i] == UNKNOWN_ROW && step(row, representatives_[i]) == GIVE_UP_ROW)
+            {
+                return false;
+            }
+        }
+        accepts_end(row);
+    }
+    return true;
+}
+
+inline size_t Dfa::get_state_count() const
+{
+    return keys_.size();
+}
+
+inline void Dfa::find_classes()
+{
+    // split the bytes apart wherever some instruction tells them apart
+    classes_.assign(256, 0);
+    size_t end = program_.has_reverse() ? program_.get_reverse_start() : program_.size();
+    for (size_t pc = 0; pc < end; pc++)
+    {
+        const Instruction &inst = program_.at(pc);
+        if (inst.op != OpCode::BYTE && inst.op != OpCode::SET && inst.op != OpCode::SWITCH
+            && !((inst.op == OpCode::ASSERT_BEGIN || inst.op == OpCode::ASSERT_END) && inst.arg != 0))
+        {
+            continue;
+        }
+
+        std::map<std::pair<uint16_t, uint32_t>, uint16_t> split;
+        for (size_t byte = 0; byte < 256; byte++)
+        {
+            uint32_t value = 0;
+            switch (inst.op)
+            {
+            case OpCode::BYTE:
+                value = byte == inst.arg ? 1 : 0;
+                break;
+            case OpCode::SET:
+                value = program_.get_set(inst.arg).has(static_cast<unsigned char>(byte)) ? 1 : 0;
+                break;
+            case OpCode::SWITCH:
+                value = program_.get_table(inst.arg)[byte];
+                break;
+            default:
+                value = byte == '\n' ? 1 : 0;
+                break;
+            }
+            auto found = split.insert(std::make_pair(std::make_pair(classes_[byte], value),
+                                                     static_cast<uint16_t>(split.size())));
+            classes_[byte] = found.first->second;
+        }
+    }
+
+    class_count_ = 0;
+    representatives_.clear();
+    for (size_t byte = 0; byte < 256; byte++)
+    {
+        if (classes_[byte] == representatives_.size())
+        {
+            representatives_.push_back(static_cast<unsigned char>(byte));
+        }
+    }
+    class_count_ = representatives_.size();
+}
+
+inline uint32_t Dfa::get_start()
+{
+    if (start_ == UNKNOWN_ROW && program_.get_look_count() != 0)
+    {
+        start_ = GIVE_UP_ROW;
+    }
+    if (start_ == UNKNOWN_ROW)
+    {
+        vector<vector<uint32_t>> stack(1, vector<uint32_t>(width_, 0));
+        vector<vector<uint32_t>> threads;
+        bool matched = closure(stack, AT_BEGIN, false, false, false, threads);
+        start_ = add_state(AT_BEGIN, threads, matched);
+    }
+    return start_;
+}
+
+inline uint32_t Dfa::step(uint32_t row, unsigned char byte)
+{
+    // the slow path of a lookup, which builds the next state when needed
+    uint32_t &entry = table_[row + classes_[byte]];
+    if (entry != UNKNOWN_ROW)
+    {
+        return entry;
+    }
+
+    const vector<uint32_t> &key = keys_[row / class_count_];
+    uint32_t flags = key[0];
+    vector<vector<uint32_t>> consumers;
+    vector<vector<uint32_t>> pending;
+    for (size_t i = 1; i < key.size(); i += width_)
+    {
+        vector<uint32_t> thread(key.begin() + i, key.begin() + i + width_);
+        if (program_.at(thread[0]).op == OpCode::ASSERT_END)
+        {
+            pending.push_back(std::move(thread));
+        }
+        else
+        {
+            consumers.push_back(std::move(thread));
+        }
+    }
+
+    // a '\n' decides the "must end" of multi line queries before it is read
+    if (byte == '\n' && !pending.empty()
+        && closure(pending, flags, true, false, true, consumers))
+    {
+        entry = MATCHED_ROW;
+        return entry;
+    }
+
+    vector<vector<uint32_t>> stack;
+    for (auto &thread : consumers)
+    {
+        const Instruction &inst = program_.at(thread[0]);
+        bool accepted = false;
+        switch (inst.op)
+        {
+        case OpCode::BYTE:
+            accepted = byte == inst.arg;
+            thread[0] += 1;
+            break;
+        case OpCode::SET:
+            accepted = program_.get_set(inst.arg).has(byte);
+            thread[0] += 1;
+            break;
+        case OpCode::SWITCH:
+            thread[0] = program_.get_table(inst.arg)[byte];
+            accepted = thread[0] != PROGRAM_INFINITY;
+            break;
+        default:
+            break;
+        }
+        if (accepted)
+        {
+            stack.push_back(std::move(thread));
+        }
+    }
+    if (!program_.is_anchored_begin())
+    {
+        // a match could also start right after this byte
+        stack.push_back(vector<uint32_t>(width_, 0));
+    }
+
+    uint32_t next_flags = byte == '\n' ? AFTER_NEWLINE : 0;
+    vector<vector<uint32_t>> threads;
+    bool matched = closure(stack, next_flags, false, false, false, threads);
+    uint32_t next = add_state(next_flags, threads, matched);
+    if (next != GIVE_UP_ROW)
+    {
+        // the table could have grown, so entry is not used here
+        table_[row + classes_[byte]] = next;
+    }
+    return next;
+}
+
+inline bool Dfa::accepts_end(uint32_t row)
+{
+    size_t index = row / class_count_;
+    if (end_accepts_[index] < 0)
+    {
+        const vector<uint32_t> &key = keys_[index];
+        vector<vector<uint32_t>> pending;
+        for (size_t i = 1; i < key.size(); i += width_)
+        {
+            if (program_.at(key[i]).op == OpCode::ASSERT_END)
+            {
+                pending.push_back(vector<uint32_t>(key.begin() + i, key.begin() + i + width_));
+            }
+        }
+        vector<vector<uint32_t>> threads;
+        end_accepts_[index] = !pending.empty() && closure(pending, key[0], true, true, false, threads) ? 1 : 0;
+    }
+    return end_accepts_[index] != 0;
+}
+
+inline bool Dfa::finish(const Lane &lane, uint32_t row)
+{
+    // an input which needs too many states starts over on the Pike VM
+    if (row == GIVE_UP_ROW)
+    {
+        return matcher_.search(lane.begin, static_cast<size_t>(lane.end - lane.begin));
+    }
+    return row == MATCHED_ROW;
+}
+
+inline bool Dfa::start_lane(Lane &lane, const char *const *texts, const size_t *lens, size_t count, size_t &next,
+                            uint64_t *bitmap)
+{
+    // false when there is no input left
+    while (next < count)
+    {
+        size_t index = next++;
+        if (lens[index] < program_.get_min_length()
+            || (program_.is_utf8() && !is_valid_utf8(texts[index], lens[index])))
+        {
+            continue;
+        }
+        uint32_t row = get_start();
+        if (row < DEAD_ROW)
+        {
+            lane.begin = texts[index];
+            lane.pos = texts[index];
+            lane.end = texts[index] + lens[index];
+            lane.row = row;
+            lane.index = index;
+            return true;
+        }
+        if (row == MATCHED_ROW || (row == GIVE_UP_ROW && matcher_.search(texts[index], lens[index])))
+        {
+            bitmap[index / 64] |= uint64_t(1) << (index % 64);
+        }
+    }
+    return false;
+}
+
+inline bool Dfa::closure(vector<vector<uint32_t>> &stack, uint32_t flags, bool end_known, bool at_end,
+                         bool before_newline, vector<vector<uint32_t>> &out) const
+{
+    // follow all the instructions which do not consume input, the threads
+    // waiting for a byte go into out, and true is returned if any of them
+    // reaches MATCH. Unless end_known, "must end" waits for the next byte
+    std::set<vector<uint32_t>> seen;
+    bool matched = false;
+    while (!stack.empty())
+    {
+        vector<uint32_t> curr = std::move(stack.back());
+        stack.pop_back();
+        if (!seen.insert(curr).second)
+        {
+            continue;
+        }
+
+        const Instruction &inst = program_.at(curr[0]);
+        switch (inst.op)
+        {
+        case OpCode::JUMP:
+            curr[0] = inst.x;
+            stack.push_back(std::move(curr));
+            break;
+        case OpCode::SPLIT:
+        {
+            vector<uint32_t> other = curr;
+            other[0] = inst.y;
+            stack.push_back(std::move(other));
+            curr[0] = inst.x;
+            stack.push_back(std::move(curr));
+            break;
+        }
+        case OpCode::SAVE:
+            curr[0] += 1;
+            stack.push_back(std::move(curr));
+            break;
+        case OpCode::ASSERT_BEGIN:
+            if ((flags & AT_BEGIN) != 0 || (inst.arg != 0 && (flags & AFTER_NEWLINE) != 0))
+            {
+                curr[0] += 1;
+                stack.push_back(std::move(curr));
+            }
+            break;
+        case OpCode::ASSERT_END:
+            if (!end_known)
+            {
+                out.push_back(std::move(curr));
+            }
+            else if (at_end || (inst.arg != 0 && before_newline))
+            {
+                curr[0] += 1;
+                stack.push_back(std::move(curr));
+            }
+            break;
+        case OpCode::COUNTER_INIT:
+            curr[1 + inst.arg] = 0;
+            curr[0] += 1;
+            stack.push_back(std::move(curr));
+            break;
+        case OpCode::COUNTER_TEST:
+        {
+            uint32_t count = curr[1 + inst.arg];
+            vector<uint32_t> exit = curr;
+            exit[1 + inst.arg] = 0;
+            exit[0] = inst.y;
+            curr[0] = inst.x;
+            if (count >= inst.min)
+            {
+                stack.push_back(std::move(exit));
+            }
+            if (inst.max == PROGRAM_INFINITY || count < inst.max)
+            {
+                stack.push_back(std::move(curr));
+            }
+            break;
+        }
+        case OpCode::COUNTER_INCR:
+        {
+            // the iteration flags of the Pike VM are left out. Where an
+            // empty iteration past min exits there, here it goes on to
+            // the COUNTER_TEST, which has the same exit, and may also
+            // start another iteration at the same position. That only
+            // matches what dropping the empty iteration would: the same
+            // bytes with one count less, still at least min. So whether
+            // there is a match is the same, with fewer states
+            uint32_t count = curr[1 + inst.arg] + 1;
+            if (inst.max == PROGRAM_INFINITY)
+            {
+                count = std::min(count, inst.min);
+            }
+            curr[1 + inst.arg] = count;
+            curr[0] = inst.x;
+            stack.push_back(std::move(curr));
+            break;
+        }
+        case OpCode::MATCH:
+            matched = true;
+            break;
+        default:
+            out.push_back(std::move(curr));
+            break;
+        }
+    }
+    return matched;
+}
+
+inline uint32_t Dfa::add_state(uint32_t flags, vector<vector<uint32_t>> &threads, bool matched)
+{
+    // the order of the threads does not matter for a yes or a no
+    if (matched)
+    {
+        return MATCHED_ROW;
+    }
+    if (threads.empty() && program_.is_anchored_begin())
+    {
+        // otherwise a match could still start later, e.g. after a '\n'
+        return DEAD_ROW;
+    }
+    std::sort(threads.begin(), threads.end());
+    threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+    vector<uint32_t> key(1, flags);
+    for (auto const &thread : threads)
+    {
+        key.insert(key.end(), thread.begin(), thread.end());
+    }
+    auto found = states_.find(key);
+    if (found != states_.end())
+    {
+        return found->second;
+    }
+    if (keys_.size() >= max_states_ || (keys_.size() + 1) * class_count_ >= DEAD_ROW)
+    {
+        return GIVE_UP_ROW;
+    }
+
+    uint32_t row = static_cast<uint32_t>(keys_.size() * class_count_);
+    keys_.push_back(key);
+    end_accepts_.push_back(-1);
+    table_.resize(table_.size() + class_count_, static_cast<uint32_t>(UNKNOWN_ROW));
+    states_.insert(std::make_pair(std::move(key), row));
+    return row;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_DFA_H_
@@ -68,6 +68,8 @@ Dictionary::Dictionary() : dictionary_{
                                 make_tuple(TokenType::CHARACTER, TokenValue::TAB)},
                                {"raw",
                                 make_tuple(TokenType::CHARACTER, TokenValue::RAW)},
+                               {"fragment",
+                                make_tuple(TokenType::CHARACTER, TokenValue::FRAGMENT)},
                                {"from",
                                 make_tuple(TokenType::CHARACTER, TokenValue::FROM)},
                                {"to",
@@ -122,6 +124,8 @@ Dictionary::Dictionary() : dictionary_{
                                 make_tuple(TokenType::FLAG, TokenValue::MULTI_LINE)},
                                {"all lazy",
                                 make_tuple(TokenType::FLAG, TokenValue::ALL_LAZY)},
+                               {"unicode",
+                                make_tuple(TokenType::FLAG, TokenValue::UNICODE)},
 
                                {"begin with",
                                 make_tuple(TokenType::ANCHOR, TokenValue::BEGIN_WITH)},
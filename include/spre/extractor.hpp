@@ -0,0 +1,346 @@
+/*
+ * the captures of a rule over a stream of lines, written into columns
+ *
+ * for parsing logs into fields, e.g. with capture (digit once or more) as
+ * "port". Every group of the rule is a column, and every line the rule
+ * matches is a row: the value of a column in a row is the text its group
+ * captured. The values are not strings of their own, a column keeps the
+ * offset and the length of each of them in two arrays, and their bytes
+ * one after the other in a single arena, so a row costs no allocation
+ * once the buffers have grown, and a whole batch could be handed on (to
+ * a columnar format, a database) as a few contiguous arrays:
+ *
+ *     SRL srl("capture (letter once or more) as \"level\", literally \" \", "
+ *             "capture (digit once or more) as \"code\"");
+ *     Extractor extractor(srl.get_program());
+ *     ExtractBatch batch;
+ *     while (... a chunk of the input ...)
+ *     {
+ *         extractor.feed(chunk, len);
+ *         if (extractor.is_full())
+ *         {
+ *             extractor.take(batch);
+ *             ... batch.columns[0].bytes ...
+ *         }
+ *     }
+ *     extractor.finish();
+ *     while (extractor.get_row_count() > 0)
+ *     {
+ *         extractor.take(batch);
+ *         ...
+ *     }
+ *
+ * feed() cuts the chunks into lines at '\n', a line cut in two by the end
+ * of a chunk waits for the rest of it. take() swaps the buffers of the
+ * batch it is given with its own, so the two sets of buffers are reused
+ * in turn rather than allocated for every batch.
+ *
+ * the offsets are 32 bits, so a column holds at most 4 GiB of values. A
+ * row which would go past that (only when is_full() is ignored for long)
+ * is kept, with the rows after it, for the next batch: is_full() stays
+ * true, and take() starts the next batch with them. A single value too
+ * long for any batch is an error, and its line is not a row. So is a
+ * program which is not sound (see Program::is_sound()), the Extractor
+ * has the error from the start and never adds a row.
+ *
+ * most lines of a log usually do not match the rule: those are rejected
+ * by the DFA (see dfa.hpp), only the others run on the Pike VM for their
+ * captures.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_EXTRACTOR_H_
+#define SIMPLEREGEXLANGUAGE_EXTRACTOR_H_
+
+#include "spre/dfa.hpp"
+#include "spre/matcher.hpp"
+#include "spre/program.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+struct ExtractColumn
+{
+    string name;              // of the group, empty if it has none
+    vector<uint32_t> offsets; // where the value of each row starts in bytes
+    vector<uint32_t> lengths;
+    vector<uint64_t> present; // bit row % 64 of present[row / 64], whether the group took part
+    string bytes;             // the values of all the rows, one after the other
+};
+
+struct ExtractBatch
+{
+    vector<uint64_t> lines;        // the number of the line of each row, from 0
+    vector<ExtractColumn> columns; // one per group of the rule, in order
+};
+
+class Extractor
+{
+  public:
+    static const size_t DEFAULT_BATCH_ROWS = 4096;
+    static const size_t DEFAULT_BATCH_BYTES = 1 << 20;
+
+    static const size_t MAX_COLUMN_BYTES = UINT32_MAX;
+
+    explicit Extractor(const Program &program, size_t batch_rows = DEFAULT_BATCH_ROWS,
+                       size_t batch_bytes = DEFAULT_BATCH_BYTES, bool show_error = true);
+    Extractor(const Extractor &) = delete;
+    Extractor &operator=(const Extractor &) = delete;
+    ~Extractor();
+    bool has_error() const;
+    void report_error() const;
+    bool add(const string &line);
+    bool add(const char *line, size_t len);
+    void feed(const char *data, size_t len);
+    void finish();
+    bool is_full() const;
+    size_t get_row_count() const;
+    uint64_t get_line_count() const;
+    void take(ExtractBatch &batch);
+
+  private:
+    const Program &program_; // has to outlive the extractor
+    Dfa dfa_;
+    Matcher matcher_;
+    Match match_;
+    ExtractBatch batch_;
+    size_t batch_rows_;
+    size_t batch_bytes_;
+    size_t bytes_; // in all the arenas of batch_
+    uint64_t line_count_;
+    string pending_;                          // the start of a line cut by the end of a chunk
+    vector<std::pair<uint64_t, string>> next_; // the rows which wait for the next batch, by line
+    bool error_flag_;
+    string error_msg_;
+    const bool show_error_;
+
+    bool fits() const;
+    void append_row(uint64_t number, const char *line);
+    void reset(ExtractBatch &batch) const;
+};
+
+Extractor::Extractor(const Program &program, size_t batch_rows, size_t batch_bytes, bool show_error)
+    : program_(program), dfa_(program), matcher_(program), batch_rows_(batch_rows), batch_bytes_(batch_bytes),
+      bytes_(0), line_count_(0), error_flag_(false), show_error_(show_error)
+{
+    reset(batch_);
+    if (!program.is_sound())
+    {
+        // e.g. the empty program of a query which could not be compiled,
+        // no line ever matches it
+        error_flag_ = true;
+        error_msg_ = "the program could not be run, no line will match";
+        if (show_error_)
+        {
+            report_error();
+        }
+    }
+}
+
+Extractor::~Extractor()
+{
+}
+
+inline bool Extractor::has_error() const
+{
+    return error_flag_;
+}
+
+inline void Extractor::report_error() const
+{
+    if (!has_error())
+    {
+        return;
+    }
+    fprintf(stderr, "extractor error: ");
+    fprintf(stderr, "%s", error_msg_.c_str());
+    fprintf(stderr, "\n");
+}
+
+inline bool Extractor::add(const string &line)
+{
+    return add(line.data(), line.length());
+}
+
+inline bool Extractor::add(const char *line, size_t len)
+{
+    // whether the line matched and became a row, of this batch or of the
+    // next one. A batch takes rows past is_full() as well
+    uint64_t number = line_count_++;
+    // the DFA would give the lookarounds to the Pike VM anyway
+    if (program_.get_look_count() == 0 && !dfa_.match(line, len))
+    {
+        return false;
+    }
+    if (!matcher_.search(line, len, &match_))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < batch_.columns.size(); i++)
+    {
+        if (match_.has_group(i + 1) && match_.get_group_end(i + 1) - match_.get_group_begin(i + 1) > MAX_COLUMN_BYTES)
+        {
+            error_flag_ = true;
+            error_msg_ = "the value of line " + std::to_string(number) + " is longer than a column could hold";
+            if (show_error_)
+            {
+                report_error();
+            }
+            return false;
+        }
+    }
+    if (!next_.empty() || !fits())
+    {
+        // in order, after those already waiting
+        next_.emplace_back(number, string(line, len));
+        return true;
+    }
+    append_row(number, line);
+    return true;
+}
+
+inline void Extractor::feed(const char *data, size_t len)
+{
+    // the '\r' of a "\r\n" line ending stays at the end of the line
+    const char *end = data + len;
+    while (data != end)
+    {
+        const char *newline = static_cast<const char *>(memchr(data, '\n', end - data));
+        if (newline == nullptr)
+        {
+            pending_.append(data, end - data);
+            return;
+        }
+        if (pending_.empty())
+        {
+            add(data, newline - data);
+        }
+        else
+        {
+            pending_.append(data, newline - data);
+            add(pending_);
+            pending_.clear();
+        }
+        data = newline + 1;
+    }
+}
+
+inline void Extractor::finish()
+{
+    // the last line, if the stream did not end with '\n'
+    if (!pending_.empty())
+    {
+        add(pending_);
+        pending_.clear();
+    }
+}
+
+inline bool Extractor::is_full() const
+{
+    return batch_.lines.size() >= batch_rows_ || bytes_ >= batch_bytes_ || !next_.empty();
+}
+
+inline size_t Extractor::get_row_count() const
+{
+    // the rows of the batch not taken yet, those waiting for the next
+    // batch are not counted until take() moves them in
+    return batch_.lines.size();
+}
+
+inline uint64_t Extractor::get_line_count() const
+{
+    // all the lines added so far, matched or not
+    return line_count_;
+}
+
+inline void Extractor::take(ExtractBatch &batch)
+{
+    // batch gets the rows added since the last take(), and its old
+    // buffers are kept for the next ones
+    std::swap(batch, batch_);
+    reset(batch_);
+    bytes_ = 0;
+
+    // then the rows which did not fit start the next batch, they matched
+    // already so the Pike VM only runs again for their captures
+    size_t moved = 0;
+    while (moved < next_.size())
+    {
+        const string &line = next_[moved].second;
+        matcher_.search(line, &match_);
+        if (!fits())
+        {
+            break;
+        }
+        append_row(next_[moved].first, line.data());
+        moved++;
+    }
+    next_.erase(next_.begin(), next_.begin() + moved);
+}
+
+inline bool Extractor::fits() const
+{
+    // whether the captures of match_ could be added without any offset
+    // going past 32 bits
+    for (size_t i = 0; i < batch_.columns.size(); i++)
+    {
+        size_t length = match_.has_group(i + 1) ? match_.get_group_end(i + 1) - match_.get_group_begin(i + 1) : 0;
+        if (batch_.columns[i].bytes.size() + length > MAX_COLUMN_BYTES)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline void Extractor::append_row(uint64_t number, const char *line)
+{
+    // the captures of match_, over line
+    size_t row = batch_.lines.size();
+    batch_.lines.push_back(number);
+    for (size_t i = 0; i < batch_.columns.size(); i++)
+    {
+        ExtractColumn &column = batch_.columns[i];
+        size_t begin = match_.has_group(i + 1) ? match_.get_group_begin(i + 1) : 0;
+        size_t end = match_.has_group(i + 1) ? match_.get_group_end(i + 1) : 0;
+        column.offsets.push_back(static_cast<uint32_t>(column.bytes.size()));
+        column.lengths.push_back(static_cast<uint32_t>(end - begin));
+        if (row % 64 == 0)
+        {
+            column.present.push_back(0);
+        }
+        if (match_.has_group(i + 1))
+        {
+            column.present.back() |= uint64_t(1) << (row % 64);
+        }
+        column.bytes.append(line + begin, end - begin);
+        bytes_ += end - begin;
+    }
+}
+
+inline void Extractor::reset(ExtractBatch &batch) const
+{
+    batch.lines.clear();
+    // the 0th capture is the whole match, it gets no column
+    batch.columns.resize(program_.get_capture_count() > 0 ? program_.get_capture_count() - 1 : 0);
+    for (size_t i = 0; i < batch.columns.size(); i++)
+    {
+        ExtractColumn &column = batch.columns[i];
+        column.name = program_.get_capture_name(i + 1);
+        column.offsets.clear();
+        column.lengths.clear();
+        column.present.clear();
+        column.bytes.clear();
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_EXTRACTOR_H_
@@ -0,0 +1,243 @@
+/*
+ * compile the parts queries have in common only once
+ *
+ * the rules of a set often repeat the same fragments, e.g. capture (digit
+ * once or more) as "port". The cache interns the groups, the any of, the
+ * lookarounds and the fragment "name" of the asts by their structure
+ * (hash-consing): two
+ * subtrees written the same, whitespace and position aside, get the same
+ * id, and the subtrees nested in them are stored as nothing but their
+ * ids. This gives a DAG with one node per distinct subtree, however many
+ * times it comes up in the queries compiled with the same cache.
+ *
+ * the compiler (see Compiler) keeps the instructions of an interned
+ * subtree the first time it compiles it, and pastes them wherever the
+ * same id comes up again, with the jump targets, the captures, the
+ * counters, the sets and the tables renumbered, rather than walking the
+ * asts and building the tries of any of once more. The Pike VM has no
+ * calls, so every program still gets its own copy of the instructions,
+ * what is shared is the work of compiling them.
+ *
+ * the instructions depend on how the compiler is set up (compiled
+ * backwards, multi line, unicode, case insensitive, all lazy), so
+ * fragments are kept per mode.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_FRAGMENT_CACHE_H_
+#define SIMPLEREGEXLANGUAGE_FRAGMENT_CACHE_H_
+
+#include "spre/ast.hpp"
+#include "spre/charset.hpp"
+#include "spre/program.hpp"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+struct Fragment
+{
+    // the instructions of a subtree, numbered as if it started at pc 0 of a
+    // program without any set, table, capture or counter
+    vector<Instruction> insts;
+    vector<CharSet> sets;
+    vector<vector<uint32_t>> tables;
+    vector<string> captures; // the names of the groups inside, in order
+    size_t counter_count;
+};
+
+class FragmentCache
+{
+  public:
+    FragmentCache();
+    FragmentCache(const FragmentCache &) = delete;
+    FragmentCache &operator=(const FragmentCache &) = delete;
+    ~FragmentCache();
+    void intern(const vector<unique_ptr<ExprAST>> &asts, std::unordered_map<const ExprAST *, size_t> &ids);
+    const Fragment *find(size_t id, uint32_t mode);
+    void add(size_t id, uint32_t mode, Fragment fragment);
+    size_t get_node_count() const;
+    size_t get_fragment_count() const;
+    size_t get_hit_count() const;
+    void clear();
+
+  private:
+    std::unordered_map<string, size_t> nodes_; // the signature of every distinct subtree
+    std::map<std::pair<size_t, uint32_t>, Fragment> fragments_;
+    size_t hit_count_;
+
+    void encode(const vector<unique_ptr<ExprAST>> &asts, string &signature,
+                std::unordered_map<const ExprAST *, size_t> &ids);
+    size_t intern_node(const ExprAST &ast, std::unordered_map<const ExprAST *, size_t> &ids);
+    static void append_number(string &signature, size_t number);
+};
+
+FragmentCache::FragmentCache() : hit_count_(0)
+{
+}
+
+FragmentCache::~FragmentCache()
+{
+}
+
+inline void FragmentCache::intern(const vector<unique_ptr<ExprAST>> &asts,
+                                  std::unordered_map<const ExprAST *, size_t> &ids)
+{
+    // ids gets the id of every group, any of and lookaround in the asts
+    string signature;
+    encode(asts, signature, ids);
+}
+
+inline const Fragment *FragmentCache::find(size_t id, uint32_t mode)
+{
+    auto iter = fragments_.find(std::make_pair(id, mode));
+    if (iter == fragments_.end())
+    {
+        return nullptr;
+    }
+    hit_count_++;
+    return &iter->second;
+}
+
+inline void FragmentCache::add(size_t id, uint32_t mode, Fragment fragment)
+{
+    fragments_.insert(std::make_pair(std::make_pair(id, mode), std::move(fragment)));
+}
+
+inline size_t FragmentCache::get_node_count() const
+{
+    // the distinct subtrees interned so far
+    return nodes_.size();
+}
+
+inline size_t FragmentCache::get_fragment_count() const
+{
+    return fragments_.size();
+}
+
+inline size_t FragmentCache::get_hit_count() const
+{
+    // how many times a fragment was pasted rather than compiled
+    return hit_count_;
+}
+
+inline void FragmentCache::clear()
+{
+    nodes_.clear();
+    fragments_.clear();
+    hit_count_ = 0;
+}
+
+inline void FragmentCache::encode(const vector<unique_ptr<ExprAST>> &asts, string &signature,
+                                  std::unordered_map<const ExprAST *, size_t> &ids)
+{
+    // a nested subtree is written as its id, anything else as its text
+    append_number(signature, asts.size());
+    for (auto const &ast : asts)
+    {
+        if (ast == nullptr)
+        {
+            signature.push_back('N');
+            continue;
+        }
+        switch (ast->get_type())
+        {
+        case ExprType::GROUP:
+        case ExprType::ALTERNATION:
+        case ExprType::LOOKAROUND:
+        case ExprType::FRAGMENT:
+            signature.push_back('S');
+            append_number(signature, intern_node(*ast, ids));
+            break;
+        case ExprType::CHARACTER:
+        {
+            // raw "[a]" and one of "a" have the same text, so do letter and
+            // letter from a to z, which differ with the unicode flag
+            const CharacterExprAST &character = static_cast<const CharacterExprAST &>(*ast);
+            signature.push_back('C');
+            signature.push_back(static_cast<char>(character.get_kind()));
+            signature.push_back(static_cast<char>(character.get_class()));
+            string val = ast->get_val();
+            append_number(signature, val.length());
+            signature.append(val);
+            break;
+        }
+        default:
+        {
+            signature.push_back(static_cast<char>('a' + static_cast<int>(ast->get_type())));
+            string val = ast->get_val();
+            append_number(signature, val.length());
+            signature.append(val);
+            break;
+        }
+        }
+    }
+}
+
+inline size_t FragmentCache::intern_node(const ExprAST &ast, std::unordered_map<const ExprAST *, size_t> &ids)
+{
+    string signature;
+    switch (ast.get_type())
+    {
+    case ExprType::GROUP:
+    {
+        const GroupExprAST &group = static_cast<const GroupExprAST &>(ast);
+        signature.push_back('G');
+        append_number(signature, group.get_name().length());
+        signature.append(group.get_name());
+        encode(group.get_cond(), signature, ids);
+        break;
+    }
+    case ExprType::LOOKAROUND:
+    {
+        const LookAroundExprAST &lookaround = static_cast<const LookAroundExprAST &>(ast);
+        signature.push_back('L');
+        append_number(signature, lookaround.get_symbol().length());
+        signature.append(lookaround.get_symbol());
+        encode(lookaround.get_cond(), signature, ids);
+        break;
+    }
+    case ExprType::FRAGMENT:
+        // by what it is made of, a fragment could be defined again
+        signature.push_back('F');
+        encode(static_cast<const FragmentExprAST &>(ast).get_asts(), signature, ids);
+        break;
+    case ExprType::ALTERNATION:
+    {
+        const AlternationExprAST &alternation = static_cast<const AlternationExprAST &>(ast);
+        signature.push_back('A');
+        append_number(signature, alternation.get_branches().size());
+        for (auto const &branch : alternation.get_branches())
+        {
+            encode(branch, signature, ids);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    size_t id = nodes_.insert(std::make_pair(std::move(signature), nodes_.size())).first->second;
+    ids[&ast] = id;
+    return id;
+}
+
+inline void FragmentCache::append_number(string &signature, size_t number)
+{
+    // fixed width, so that no two signatures could be read the same
+    for (size_t i = 0; i < sizeof(number); i++)
+    {
+        signature.push_back(static_cast<char>((number >> (8 * i)) & 0xff));
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_FRAGMENT_CACHE_H_
@@ -0,0 +1,190 @@
+/*
+ * the pieces rules are built from, defined once by their names
+ *
+ * a set of rules usually spells the same pieces over and over, e.g. an
+ * IPv4 address or a timestamp. A FragmentLibrary keeps such pieces by
+ * name, and a query refers to one with fragment "name":
+ *
+ *     FragmentLibrary library;
+ *     library.define("octet", "digit between 1 and 3 times");
+ *     library.define("ipv4", "fragment \"octet\", literally \".\", ...");
+ *     SRL srl("literally \"from \", fragment \"ipv4\"", library);
+ *
+ * a fragment is lexed and parsed once, when it is defined, and its asts
+ * are shared by every query which refers to it rather than parsed again
+ * for each of them. It could refer to the fragments defined before it,
+ * so a fragment never refers to itself. It works as a group which does
+ * not capture, and it could be repeated like one.
+ *
+ * flags apply to the whole query, so they are not allowed in a fragment.
+ * The groups it captures are numbered as if its text was written where
+ * it is referred to.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_FRAGMENT_LIBRARY_H_
+#define SIMPLEREGEXLANGUAGE_FRAGMENT_LIBRARY_H_
+
+#include "spre/ast.hpp"
+#include "spre/lexer.hpp"
+#include "spre/parser.hpp"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+class FragmentLibrary
+{
+  public:
+    explicit FragmentLibrary(bool show_error = true);
+    FragmentLibrary(const FragmentLibrary &) = delete;
+    FragmentLibrary &operator=(const FragmentLibrary &) = delete;
+    ~FragmentLibrary();
+    bool has_error() const;
+    void report_error() const;
+    bool define(const string &name, const string &src);
+    bool has(const string &name) const;
+    size_t size() const;
+    const FragmentMap &get_fragments() const;
+
+  private:
+    FragmentMap fragments_;
+    bool error_flag_;
+    string error_msg_;
+    const bool show_error_;
+
+    bool has_flag(const vector<unique_ptr<ExprAST>> &asts) const;
+    void set_error(const string &msg);
+};
+
+FragmentLibrary::FragmentLibrary(bool show_error) : error_flag_(false), show_error_(show_error)
+{
+}
+
+FragmentLibrary::~FragmentLibrary()
+{
+}
+
+inline bool FragmentLibrary::has_error() const
+{
+    return error_flag_;
+}
+
+inline void FragmentLibrary::report_error() const
+{
+    if (!has_error())
+    {
+        return;
+    }
+    fprintf(stderr, "fragment library error: ");
+    fprintf(stderr, "%s", error_msg_.c_str());
+    fprintf(stderr, "\n");
+}
+
+inline bool FragmentLibrary::define(const string &name, const string &src)
+{
+    // false (and nothing is defined) if the name is taken or the source
+    // is not a valid fragment
+    if (has(name))
+    {
+        set_error("the fragment \"" + name + "\" is already defined");
+        return false;
+    }
+
+    Lexer lexer(src, show_error_);
+    Parser parser(lexer, show_error_);
+    parser.set_fragments(&fragments_);
+    vector<unique_ptr<ExprAST>> asts = parser.parse();
+    if (lexer.has_error() || parser.has_error())
+    {
+        set_error("the fragment \"" + name + "\" could not be parsed");
+        return false;
+    }
+    if (has_flag(asts))
+    {
+        set_error("the fragment \"" + name + "\" has a flag, which only a query could have");
+        return false;
+    }
+
+    if (!asts.empty() && asts.back() != nullptr && asts.back()->get_type() == ExprType::END_OF_FILE)
+    {
+        asts.pop_back();
+    }
+    fragments_[name] = std::make_shared<const vector<unique_ptr<ExprAST>>>(std::move(asts));
+    return true;
+}
+
+inline bool FragmentLibrary::has(const string &name) const
+{
+    return fragments_.find(name) != fragments_.end();
+}
+
+inline size_t FragmentLibrary::size() const
+{
+    return fragments_.size();
+}
+
+inline const FragmentMap &FragmentLibrary::get_fragments() const
+{
+    // for Parser::set_fragments
+    return fragments_;
+}
+
+inline bool FragmentLibrary::has_flag(const vector<unique_ptr<ExprAST>> &asts) const
+{
+    for (auto const &iter : asts)
+    {
+        if (iter == nullptr)
+        {
+            continue;
+        }
+        switch (iter->get_type())
+        {
+        case ExprType::FLAG:
+            return true;
+        case ExprType::GROUP:
+            if (has_flag(static_cast<const GroupExprAST &>(*iter).get_cond()))
+            {
+                return true;
+            }
+            break;
+        case ExprType::LOOKAROUND:
+            if (has_flag(static_cast<const LookAroundExprAST &>(*iter).get_cond()))
+            {
+                return true;
+            }
+            break;
+        case ExprType::ALTERNATION:
+            for (auto const &branch : static_cast<const AlternationExprAST &>(*iter).get_branches())
+            {
+                if (has_flag(branch))
+                {
+                    return true;
+                }
+            }
+            break;
+        default:
+            // the fragments referred to were checked when they were defined
+            break;
+        }
+    }
+    return false;
+}
+
+inline void FragmentLibrary::set_error(const string &msg)
+{
+    error_flag_ = true;
+    error_msg_ = msg;
+    if (show_error_)
+    {
+        report_error();
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_FRAGMENT_LIBRARY_H_
@@ -1,10 +1,45 @@
+/*
+ * turns the asts back into a regex, for the regex library of your choice
+ *
+ * Dialect::DEFAULT is the text the asts carry themselves (see get_val()),
+ * with the flags appended as they are. Every other dialect writes the
+ * regex for that library from the meaning of the asts instead:
+ *
+ *     - literals are escaped, and only grouped when they are repeated
+ *     - sets use the shortest form the library understands, e.g. \d,
+ *       or [^...] when most bytes are inside
+ *     - an any of whose branches are all single characters is one set
+ *     - the flags are not written into the regex, get_options() tells
+ *       which options to give the library, except where the library has
+ *       no such option: RE2 gets (?m), and "all lazy" makes every
+ *       quantifier lazy for std::regex and RE2
+ *
+ * what a library could not run is an error right away, rather than a
+ * regex which fails (or runs slowly) later: lookarounds on RE2 and POSIX
+ * ERE, lookbehinds on std::regex, "all lazy" on POSIX ERE, and counts
+ * above the limits of RE2 (1000) and POSIX ERE (255). Bytes outside of
+ * ASCII are written as \xHH, which RE2 only reads as bytes with its
+ * Latin-1 encoding.
+ *
+ * with the unicode flag, PCRE2 and RE2 run in their UTF-8 modes (see
+ * PatternOptions::utf8), the bytes outside of ASCII are written as they
+ * are, and the classes of code points (see unicode.hpp) as Unicode
+ * properties, e.g. letter is \p{Ll}. std::regex and POSIX ERE only know
+ * bytes, the flag is an error there. POSIX ERE has no groups which do not capture, so
+ * there a repeated literal or an any of is a capturing group as well.
+ */
+
 #ifndef SIMPLEREGEXLANGUAGE_GENERATOR_H_
 #define SIMPLEREGEXLANGUAGE_GENERATOR_H_
 
 #include "spre/ast.hpp"
+#include "spre/charset.hpp"
 #include "spre/parser.hpp"
+#include "spre/utf8.hpp"
+#include <cstdio>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 using std::string;
@@ -13,23 +48,70 @@ using std::unique_ptr;
 
 namespace spre
 {
+enum class Dialect
+{
+    DEFAULT,    // the text of the asts, the flags appended
+    ECMASCRIPT, // std::regex with std::regex::ECMAScript
+    PCRE2,
+    RE2,
+    POSIX_ERE   // regcomp() with REG_EXTENDED
+};
+
+struct PatternOptions
+{
+    PatternOptions();
+
+    bool case_insensitive; // std::regex::icase, PCRE2_CASELESS, RE2 case_sensitive(false), REG_ICASE
+    bool multi_line;       // std::regex::multiline (C++17), PCRE2_MULTILINE, REG_NEWLINE
+    bool ungreedy;         // PCRE2_UNGREEDY
+    bool utf8;             // PCRE2_UTF | PCRE2_UCP, RE2 with its (default) UTF-8 encoding
+};
+
+PatternOptions::PatternOptions() : case_insensitive(false), multi_line(false), ungreedy(false), utf8(false)
+{
+}
+
 class Generator
 {
   public:
-    explicit Generator(Parser &parser, bool show_error = true);
+    explicit Generator(Parser &parser, bool show_error = true, Dialect dialect = Dialect::DEFAULT);
     ~Generator();
     bool has_error() const;
     void report_error() const;
     string generate();
+    string generate(const vector<unique_ptr<ExprAST>> &asts);
+    Dialect get_dialect() const;
+    const PatternOptions &get_options() const;
 
   private:
     Parser parser_;
+    Dialect dialect_;
+    PatternOptions options_;
+    bool lazy_; // every quantifier has to be written lazy
     bool error_flag_;
     string error_msg_;
     const bool show_error_;
+
+    void scan_flags(const vector<unique_ptr<ExprAST>> &asts);
+    void emit_sequence(const vector<unique_ptr<ExprAST>> &asts, string &res);
+    void emit_expr(const ExprAST &ast, bool repeated, string &res);
+    void emit_group(const GroupExprAST &ast, bool repeated, string &res);
+    void emit_alternation(const AlternationExprAST &ast, string &res);
+    void emit_lookaround(const LookAroundExprAST &ast, string &res);
+    void emit_quantifier(const QuantifierExprAST &ast, string &res);
+    void emit_char(unsigned char c, bool in_set, string &res);
+    void emit_set(const CharSet &set, string &res);
+    void emit_code_points(const CharacterExprAST &ast, string &res);
+    bool is_code_points(const CharacterExprAST &ast) const;
+    void emit_posix_set(const CharSet &set, bool negated, string &res);
+    bool get_single(const vector<unique_ptr<ExprAST>> &branch, CharSet &set) const;
+    string get_dialect_name() const;
+    string get_open_group() const;
+    void set_error(const string &msg);
 };
 
-Generator::Generator(Parser &parser, bool show_error) : parser_(parser), show_error_(show_error)
+Generator::Generator(Parser &parser, bool show_error, Dialect dialect)
+    : parser_(parser), dialect_(dialect), lazy_(false), error_flag_(false), show_error_(show_error)
 {
 }
 
@@ -54,17 +136,686 @@ inline void Generator::report_error() const
 }
 
 inline string Generator::generate()
+{
+    return generate(parser_.parse());
+}
+
+inline string Generator::generate(const vector<unique_ptr<ExprAST>> &asts)
 {
     string res;
-    vector<unique_ptr<ExprAST>> h = parser_.parse();
-    std::cout << "asts length: " << h.size() << "\n";
-    for (const auto &iter : h)
+    if (dialect_ == Dialect::DEFAULT)
+    {
+        for (const auto &iter : asts)
+        {
+            string k = iter == nullptr ? "nullptr" : iter->get_val();
+            res.append(k);
+        }
+        return res;
+    }
+
+    // an empty string on errors
+    options_ = PatternOptions();
+    lazy_ = false;
+    error_flag_ = false;
+    error_msg_.clear();
+    scan_flags(asts);
+    if (dialect_ == Dialect::RE2 && options_.multi_line)
+    {
+        res.append("(?m)");
+        options_.multi_line = false;
+    }
+    emit_sequence(asts, res);
+
+    if (show_error_)
+    {
+        report_error();
+    }
+    return error_flag_ ? "" : res;
+}
+
+inline Dialect Generator::get_dialect() const
+{
+    return dialect_;
+}
+
+inline const PatternOptions &Generator::get_options() const
+{
+    // only meaningful after generate()
+    return options_;
+}
+
+inline void Generator::scan_flags(const vector<unique_ptr<ExprAST>> &asts)
+{
+    // flags apply to the whole query wherever they are written
+    for (auto const &iter : asts)
+    {
+        if (iter == nullptr)
+        {
+            continue;
+        }
+        switch (iter->get_type())
+        {
+        case ExprType::GROUP:
+            scan_flags(static_cast<const GroupExprAST &>(*iter).get_cond());
+            break;
+        case ExprType::LOOKAROUND:
+            scan_flags(static_cast<const LookAroundExprAST &>(*iter).get_cond());
+            break;
+        case ExprType::ALTERNATION:
+            for (auto const &branch : static_cast<const AlternationExprAST &>(*iter).get_branches())
+            {
+                scan_flags(branch);
+            }
+            break;
+        case ExprType::FLAG:
+        {
+            string flag = iter->get_val();
+            if (flag == "i")
+            {
+                options_.case_insensitive = true;
+            }
+            else if (flag == "m")
+            {
+                options_.multi_line = true;
+            }
+            else if (flag == "u")
+            {
+                options_.utf8 = true;
+                if (dialect_ == Dialect::ECMASCRIPT || dialect_ == Dialect::POSIX_ERE)
+                {
+                    set_error("\"unicode\" could not be written in " + get_dialect_name());
+                }
+            }
+            else if (dialect_ == Dialect::PCRE2)
+            {
+                options_.ungreedy = true;
+            }
+            else if (dialect_ == Dialect::POSIX_ERE)
+            {
+                set_error("\"all lazy\" could not be written in " + get_dialect_name());
+            }
+            else
+            {
+                lazy_ = true;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+inline void Generator::emit_sequence(const vector<unique_ptr<ExprAST>> &asts, string &res)
+{
+    for (size_t i = 0; i < asts.size() && !error_flag_; i++)
+    {
+        if (asts[i] == nullptr)
+        {
+            set_error("so invalid ast met, some errors happened");
+            return;
+        }
+        if (asts[i]->get_type() == ExprType::QUANTIFIER)
+        {
+            set_error("there is nothing before \"" + asts[i]->get_val() + "\" to repeat");
+            return;
+        }
+
+        const QuantifierExprAST *quantifier = nullptr;
+        if (i + 1 < asts.size() && asts[i + 1] != nullptr && asts[i + 1]->get_type() == ExprType::QUANTIFIER)
+        {
+            quantifier = static_cast<const QuantifierExprAST *>(asts[i + 1].get());
+        }
+        emit_expr(*asts[i], quantifier != nullptr, res);
+        if (quantifier != nullptr)
+        {
+            emit_quantifier(*quantifier, res);
+            i++; // the quantifier is consumed as well
+        }
+    }
+}
+
+inline void Generator::emit_expr(const ExprAST &ast, bool repeated, string &res)
+{
+    // a repeated ast has to come out as a single unit
+    switch (ast.get_type())
+    {
+    case ExprType::CHARACTER:
+    {
+        const CharacterExprAST &character = static_cast<const CharacterExprAST &>(ast);
+        if (is_code_points(character))
+        {
+            emit_code_points(character, res);
+            break;
+        }
+        if (character.get_kind() == CharacterExprAST::Kind::SET)
+        {
+            emit_set(character.get_set(), res);
+            break;
+        }
+        if (character.get_kind() == CharacterExprAST::Kind::RAW)
+        {
+            // written by hand for some library, passed on as it is
+            res.append(character.get_val());
+            break;
+        }
+        string literal = character.get_literal();
+        bool grouped = repeated && literal.length() != 1;
+        if (grouped)
+        {
+            res.append(get_open_group());
+        }
+        for (auto const &c : literal)
+        {
+            emit_char(static_cast<unsigned char>(c), false, res);
+        }
+        if (grouped)
+        {
+            res.append(")");
+        }
+        break;
+    }
+    case ExprType::GROUP:
+        emit_group(static_cast<const GroupExprAST &>(ast), repeated, res);
+        break;
+    case ExprType::ALTERNATION:
+        emit_alternation(static_cast<const AlternationExprAST &>(ast), res);
+        break;
+    case ExprType::LOOKAROUND:
+        emit_lookaround(static_cast<const LookAroundExprAST &>(ast), res);
+        break;
+    case ExprType::FRAGMENT:
+    {
+        // a sequence within a sequence needs no group of its own, nor
+        // does a fragment of a single ast
+        const vector<unique_ptr<ExprAST>> &asts = static_cast<const FragmentExprAST &>(ast).get_asts();
+        if (asts.size() == 1 && asts[0] != nullptr)
+        {
+            emit_expr(*asts[0], repeated, res);
+            break;
+        }
+        if (repeated)
+        {
+            res.append(get_open_group());
+        }
+        emit_sequence(asts, res);
+        if (repeated)
+        {
+            res.append(")");
+        }
+        break;
+    }
+    case ExprType::ANCHOR:
+    case ExprType::FLAG:
+    case ExprType::END_OF_FILE:
+        if (repeated)
+        {
+            set_error("only characters, groups, any of and lookarounds could be repeated");
+            break;
+        }
+        if (ast.get_type() == ExprType::ANCHOR)
+        {
+            res.append(ast.get_val());
+        }
+        break;
+    default:
+        set_error("unknown ast met");
+        break;
+    }
+}
+
+inline void Generator::emit_group(const GroupExprAST &ast, bool repeated, string &res)
+{
+    if (ast.get_cond().empty())
+    {
+        // not a capture for the native engine either
+        if (repeated)
+        {
+            res.append(get_open_group() + ")");
+        }
+        return;
+    }
+    res.append("(");
+    if (!ast.get_name().empty())
+    {
+        // std::regex and POSIX ERE only number their groups
+        if (dialect_ == Dialect::PCRE2)
+        {
+            res.append("?<" + ast.get_name() + ">");
+        }
+        else if (dialect_ == Dialect::RE2)
+        {
+            res.append("?P<" + ast.get_name() + ">");
+        }
+    }
+    emit_sequence(ast.get_cond(), res);
+    res.append(")");
+}
+
+inline void Generator::emit_alternation(const AlternationExprAST &ast, string &res)
+{
+    CharSet set;
+    bool single = true;
+    for (auto const &branch : ast.get_branches())
+    {
+        single = single && get_single(branch, set);
+    }
+    if (single)
+    {
+        emit_set(set, res);
+        return;
+    }
+
+    res.append(get_open_group());
+    for (size_t i = 0; i < ast.get_branches().size(); i++)
+    {
+        if (i != 0)
+        {
+            res.append("|");
+        }
+        emit_sequence(ast.get_branches()[i], res);
+    }
+    res.append(")");
+}
+
+inline void Generator::emit_lookaround(const LookAroundExprAST &ast, string &res)
+{
+    string symbol = ast.get_symbol();
+    if (dialect_ == Dialect::RE2 || dialect_ == Dialect::POSIX_ERE)
+    {
+        set_error("lookarounds could not be written in " + get_dialect_name());
+        return;
+    }
+    if (dialect_ == Dialect::ECMASCRIPT && symbol.compare(0, 3, "(?<") == 0)
+    {
+        set_error("lookbehinds could not be written in " + get_dialect_name());
+        return;
+    }
+    res.append(symbol);
+    emit_sequence(ast.get_cond(), res);
+    res.append(")");
+}
+
+inline void Generator::emit_quantifier(const QuantifierExprAST &ast, string &res)
+{
+    size_t limit = dialect_ == Dialect::RE2 ? 1000 : dialect_ == Dialect::POSIX_ERE ? 255 : QUANTIFIER_INFINITY;
+    bool counted = ast.get_min() > 1 || (ast.get_max() != QUANTIFIER_INFINITY && ast.get_max() > 1);
+    if (counted && (ast.get_min() > limit || (ast.get_max() != QUANTIFIER_INFINITY && ast.get_max() > limit)))
+    {
+        set_error("the bound of \"" + ast.get_val() + "\" is too large for " + get_dialect_name());
+        return;
+    }
+    res.append(ast.get_val());
+    if (lazy_)
+    {
+        res.append("?");
+    }
+}
+
+inline void Generator::emit_char(unsigned char c, bool in_set, string &res)
+{
+    if (dialect_ == Dialect::POSIX_ERE)
+    {
+        // no escapes for control bytes, they are written as they are
+        if (c == '\0')
+        {
+            set_error("a NUL byte could not be written in " + get_dialect_name());
+        }
+        else if (string(".[\\()*+?{|^$").find(static_cast<char>(c)) != string::npos)
+        {
+            res.push_back('\\');
+            res.push_back(static_cast<char>(c));
+        }
+        else
+        {
+            res.push_back(static_cast<char>(c));
+        }
+        return;
+    }
+
+    const char *escaped = nullptr;
+    switch (c)
+    {
+    case '\n':
+        escaped = "\\n";
+        break;
+    case '\t':
+        escaped = "\\t";
+        break;
+    case '\r':
+        escaped = "\\r";
+        break;
+    case '\f':
+        escaped = "\\f";
+        break;
+    case '\v':
+        escaped = "\\v";
+        break;
+    default:
+        break;
+    }
+    if (escaped != nullptr)
+    {
+        res.append(escaped);
+    }
+    else if (c < 0x20 || (c >= 0x7f && !(options_.utf8 && c >= 0x80)))
+    {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\x%02X", static_cast<unsigned>(c));
+        res.append(buf);
+    }
+    else if (string(in_set ? "\\]^-[" : "\\^$.|?*+()[]{}").find(static_cast<char>(c)) != string::npos)
+    {
+        res.push_back('\\');
+        res.push_back(static_cast<char>(c));
+    }
+    else
+    {
+        res.push_back(static_cast<char>(c));
+    }
+}
+
+inline void Generator::emit_set(const CharSet &set, string &res)
+{
+    size_t count = set.count();
+    if (count == 1)
+    {
+        for (size_t c = 0; c < 256; c++)
+        {
+            if (set.has(static_cast<unsigned char>(c)))
+            {
+                emit_char(static_cast<unsigned char>(c), false, res);
+            }
+        }
+        return;
+    }
+
+    if (dialect_ != Dialect::POSIX_ERE)
+    {
+        // the shorthands which mean exactly the same bytes
+        CharSet digit;
+        digit.add_range('0', '9');
+        CharSet word = digit;
+        word.add_range('a', 'z');
+        word.add_range('A', 'Z');
+        word.add('_');
+        CharSet space;
+        space.add_string(" \t\n\v\f\r");
+        CharSet line;
+        line.add('\n');
+        vector<std::pair<CharSet, string>> shorthands = {{digit, "\\d"}, {word, "\\w"}};
+        if (dialect_ != Dialect::RE2)
+        {
+            // \s of RE2 does not have \v
+            shorthands.push_back(std::make_pair(space, "\\s"));
+        }
+        for (size_t i = 0, size = shorthands.size(); i < size; i++)
+        {
+            CharSet negated = shorthands[i].first;
+            negated.negate();
+            string upper = shorthands[i].second;
+            upper[1] = static_cast<char>(upper[1] - 'a' + 'A');
+            shorthands.push_back(std::make_pair(negated, upper));
+        }
+        if (dialect_ != Dialect::ECMASCRIPT)
+        {
+            // the . of ECMAScript does not match \r either
+            line.negate();
+            shorthands.push_back(std::make_pair(line, "."));
+        }
+        for (auto const &iter : shorthands)
+        {
+            if (iter.first == set)
+            {
+                res.append(iter.second);
+                return;
+            }
+        }
+    }
+
+    // the smaller side of the set is written
+    bool negated = count > 128;
+    CharSet body = set;
+    if (negated)
+    {
+        body.negate();
+    }
+    if (dialect_ == Dialect::POSIX_ERE)
+    {
+        if (negated && (body.count() == 0 || (body.count() == 1 && body.has('\0'))))
+        {
+            // [^] could not be written, but NUL does not count there
+            emit_posix_set(set, false, res);
+            return;
+        }
+        emit_posix_set(body, negated, res);
+        return;
+    }
+    if (body.count() == 0)
+    {
+        res.append(negated ? "[\\s\\S]" : "[^\\s\\S]");
+        return;
+    }
+
+    res.append(negated ? "[^" : "[");
+    for (size_t c = 0; c < 256; c++)
+    {
+        if (!body.has(static_cast<unsigned char>(c)))
+        {
+            continue;
+        }
+        // std::regex compares signed chars, so no range crosses 0x80
+        size_t last = c;
+        while (last + 1 < 256 && body.has(static_cast<unsigned char>(last + 1))
+               && (dialect_ != Dialect::ECMASCRIPT || last + 1 != 0x80))
+        {
+            last++;
+        }
+        emit_char(static_cast<unsigned char>(c), true, res);
+        if (last > c + 1)
+        {
+            res.push_back('-');
+        }
+        if (last > c)
+        {
+            emit_char(static_cast<unsigned char>(last), true, res);
+        }
+        c = last;
+    }
+    res.append("]");
+}
+
+inline void Generator::emit_code_points(const CharacterExprAST &ast, string &res)
+{
+    switch (ast.get_class())
+    {
+    case CharacterExprAST::Class::LETTER:
+        res.append("\\p{Ll}");
+        break;
+    case CharacterExprAST::Class::UPPERCASE_LETTER:
+        res.append("\\p{Lu}");
+        break;
+    case CharacterExprAST::Class::WORD:
+        res.append("[\\p{L}\\p{M}\\p{Nd}\\p{Pc}]");
+        break;
+    case CharacterExprAST::Class::NOT_WORD:
+        res.append("[^\\p{L}\\p{M}\\p{Nd}\\p{Pc}]");
+        break;
+    case CharacterExprAST::Class::WHITESPACE:
+        // White_Space is exactly these
+        res.append("[\\t-\\r\\x{85}\\p{Z}]");
+        break;
+    case CharacterExprAST::Class::NOT_WHITESPACE:
+        res.append("[^\\t-\\r\\x{85}\\p{Z}]");
+        break;
+    case CharacterExprAST::Class::ANYTHING:
+        res.append(".");
+        break;
+    default:
+    {
+        // one of, every character on its own
+        const string &chars = ast.get_literal();
+        if (!is_valid_utf8(chars))
+        {
+            set_error("\"" + ast.get_val() + "\" is not valid UTF-8");
+            return;
+        }
+        res.append("[");
+        for (auto const &c : chars)
+        {
+            emit_char(static_cast<unsigned char>(c), true, res);
+        }
+        res.append("]");
+        break;
+    }
+    }
+}
+
+inline bool Generator::is_code_points(const CharacterExprAST &ast) const
+{
+    // whether the set is about code points rather than bytes, see unicode.hpp
+    if (!options_.utf8 || ast.get_kind() != CharacterExprAST::Kind::SET
+        || ast.get_class() == CharacterExprAST::Class::NONE)
+    {
+        return false;
+    }
+    const string &chars = ast.get_literal();
+    return ast.get_class() != CharacterExprAST::Class::ONE_OF
+           || find_non_ascii(chars.data(), chars.length()) != chars.length();
+}
+
+inline void Generator::emit_posix_set(const CharSet &set, bool negated, string &res)
+{
+    // a bracket expression has no escapes at all: ] has to come first,
+    // - last, and ^ anywhere but first. NUL could never be in the text
+    // regexec() sees, so it is left out
+    const string specials = "]-^["; // written on their own
+    bool has_special[4];
+    for (size_t i = 0; i < specials.length(); i++)
     {
-        string k = iter == nullptr ? "nullptr" : iter->get_val();
-        res.append(k);
+        has_special[i] = set.has(static_cast<unsigned char>(specials[i]));
     }
 
-    return res;
+    string inner;
+    if (has_special[0])
+    {
+        inner.push_back(']');
+    }
+    for (size_t c = 1; c < 256; c++)
+    {
+        if (!set.has(static_cast<unsigned char>(c)) || specials.find(static_cast<char>(c)) != string::npos)
+        {
+            continue;
+        }
+        size_t last = c;
+        while (last + 1 < 256 && set.has(static_cast<unsigned char>(last + 1))
+               && specials.find(static_cast<char>(last + 1)) == string::npos)
+        {
+            last++;
+        }
+        inner.push_back(static_cast<char>(c));
+        if (last > c + 1)
+        {
+            inner.push_back('-');
+        }
+        if (last > c)
+        {
+            inner.push_back(static_cast<char>(last));
+        }
+        c = last;
+    }
+    if (has_special[3])
+    {
+        inner.push_back('[');
+    }
+    if (has_special[2] && inner.empty() && has_special[1])
+    {
+        inner.append("-^");
+    }
+    else
+    {
+        if (has_special[2])
+        {
+            inner.push_back('^');
+        }
+        if (has_special[1])
+        {
+            inner.push_back('-');
+        }
+    }
+
+    if (inner == "^" && !negated)
+    {
+        res.append("\\^");
+        return;
+    }
+    if (inner.empty())
+    {
+        set_error("the set could not be written in " + get_dialect_name());
+        return;
+    }
+    res.append(negated ? "[^" : "[");
+    res.append(inner);
+    res.append("]");
+}
+
+inline bool Generator::get_single(const vector<unique_ptr<ExprAST>> &branch, CharSet &set) const
+{
+    // whether the branch is one character, which is then added to set
+    if (branch.size() != 1 || branch[0] == nullptr || branch[0]->get_type() != ExprType::CHARACTER)
+    {
+        return false;
+    }
+    const CharacterExprAST &character = static_cast<const CharacterExprAST &>(*branch[0]);
+    if (is_code_points(character))
+    {
+        return false;
+    }
+    if (character.get_kind() == CharacterExprAST::Kind::SET)
+    {
+        set.add_set(character.get_set());
+        return true;
+    }
+    if (character.get_kind() == CharacterExprAST::Kind::LITERAL && character.get_literal().length() == 1)
+    {
+        set.add(static_cast<unsigned char>(character.get_literal()[0]));
+        return true;
+    }
+    return false;
+}
+
+inline string Generator::get_dialect_name() const
+{
+    switch (dialect_)
+    {
+    case Dialect::ECMASCRIPT:
+        return "std::regex (ECMAScript)";
+    case Dialect::PCRE2:
+        return "PCRE2";
+    case Dialect::RE2:
+        return "RE2";
+    case Dialect::POSIX_ERE:
+        return "POSIX ERE";
+    default:
+        return "the default dialect";
+    }
+}
+
+inline string Generator::get_open_group() const
+{
+    // POSIX ERE has no groups which do not capture
+    return dialect_ == Dialect::POSIX_ERE ? "(" : "(?:";
+}
+
+inline void Generator::set_error(const string &msg)
+{
+    if (error_flag_)
+    {
+        // keep the first error, which is usually the real one
+        return;
+    }
+    error_flag_ = true;
+    error_msg_ = msg;
 }
 }
 
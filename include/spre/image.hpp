@@ -0,0 +1,304 @@
+/*
+ * the binary image of a compiled program or rule set
+ *
+ * an image could be written to a file once and then used by any number
+ * of processes without compiling anything again. It is laid out so that
+ * it could be used in place: every table is a plain array inside the
+ * image, found by its offset from the beginning of the image, so the
+ * image works wherever it is (e.g. mmap-ed at any address) and loading
+ * it only points some Buffers (see buffer.hpp) at those arrays.
+ *
+ *     ImageHeader                    magic, version, kind, layout, size
+ *     ImageSection[section_count]    offset and count of every array
+ *     ...the arrays, 8 bytes aligned...
+ *
+ * the arrays are stored in the byte order and with the sizes of the
+ * machine which wrote them. The layout field records those, and an
+ * image written by a different kind of machine is refused, rather than
+ * converted. An image also carries a version, which is bumped whenever
+ * the layout of anything inside changes.
+ *
+ * MappedFile maps a whole file read only, so that processes which load
+ * the same image share a single copy of it in the page cache.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_IMAGE_H_
+#define SIMPLEREGEXLANGUAGE_IMAGE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SPRE_HAS_MMAP 1
+#endif
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+const uint32_t IMAGE_VERSION = 5;
+
+enum class ImageKind : uint32_t
+{
+    PROGRAM = 1,
+    RULE_SET = 2
+};
+
+struct ImageHeader
+{
+    char magic[8]; // "SPREIMG\0"
+    uint32_t version;
+    uint32_t kind;
+    uint32_t layout;
+    uint32_t section_count;
+    uint64_t size; // of the whole image, header included
+};
+
+struct ImageSection
+{
+    uint64_t offset; // from the beginning of the image
+    uint64_t count;  // of elements, not bytes
+};
+
+inline uint32_t image_layout()
+{
+    // the byte order and the sizes an image depends on
+    const uint32_t probe = 1;
+    unsigned char little = 0;
+    memcpy(&little, &probe, 1);
+    return static_cast<uint32_t>(little) | static_cast<uint32_t>(sizeof(size_t)) << 8
+           | static_cast<uint32_t>(sizeof(void *)) << 16;
+}
+
+class ImageWriter
+{
+  public:
+    ImageWriter(ImageKind kind, size_t section_count);
+    ~ImageWriter();
+    template <typename T>
+    void write(size_t section, const T *values, size_t count);
+    string finish();
+
+  private:
+    string data_;
+    vector<ImageSection> sections_;
+    ImageKind kind_;
+};
+
+ImageWriter::ImageWriter(ImageKind kind, size_t section_count)
+    : sections_(section_count, ImageSection{0, 0}), kind_(kind)
+{
+    // the header and the sections are only filled in by finish()
+    size_t head = sizeof(ImageHeader) + section_count * sizeof(ImageSection);
+    data_.assign((head + 7) / 8 * 8, '\0');
+}
+
+ImageWriter::~ImageWriter()
+{
+}
+
+template <typename T>
+inline void ImageWriter::write(size_t section, const T *values, size_t count)
+{
+    sections_[section].offset = data_.size();
+    sections_[section].count = count;
+    if (count != 0)
+    {
+        data_.append(reinterpret_cast<const char *>(values), count * sizeof(T));
+    }
+    data_.append((8 - data_.size() % 8) % 8, '\0');
+}
+
+inline string ImageWriter::finish()
+{
+    ImageHeader header;
+    memcpy(header.magic, "SPREIMG", 8);
+    header.version = IMAGE_VERSION;
+    header.kind = static_cast<uint32_t>(kind_);
+    header.layout = image_layout();
+    header.section_count = static_cast<uint32_t>(sections_.size());
+    header.size = data_.size();
+    memcpy(&data_[0], &header, sizeof(header));
+    if (!sections_.empty())
+    {
+        memcpy(&data_[sizeof(header)], sections_.data(), sections_.size() * sizeof(ImageSection));
+    }
+    return std::move(data_);
+}
+
+class ImageReader
+{
+  public:
+    ImageReader(const char *image, size_t len, ImageKind kind, size_t section_count);
+    ~ImageReader();
+    bool is_valid() const;
+    size_t get_size() const;
+    template <typename T>
+    bool read(size_t section, const T *&values, size_t &count) const;
+
+  private:
+    const char *image_;
+    size_t len_;
+    const ImageSection *sections_;
+    size_t section_count_;
+    bool valid_;
+};
+
+ImageReader::ImageReader(const char *image, size_t len, ImageKind kind, size_t section_count)
+    : image_(image), len_(len), sections_(nullptr), section_count_(section_count), valid_(false)
+{
+    // the arrays are used in place, so the image has to be aligned as well
+    size_t head = sizeof(ImageHeader) + section_count * sizeof(ImageSection);
+    if (image == nullptr || len < head || reinterpret_cast<uintptr_t>(image) % 8 != 0)
+    {
+        return;
+    }
+    const ImageHeader *header = reinterpret_cast<const ImageHeader *>(image);
+    if (memcmp(header->magic, "SPREIMG", 8) != 0 || header->version != IMAGE_VERSION
+        || header->kind != static_cast<uint32_t>(kind) || header->layout != image_layout()
+        || header->section_count != section_count || header->size > len || header->size < head)
+    {
+        return;
+    }
+    len_ = static_cast<size_t>(header->size);
+    sections_ = reinterpret_cast<const ImageSection *>(image + sizeof(ImageHeader));
+    valid_ = true;
+}
+
+ImageReader::~ImageReader()
+{
+}
+
+inline bool ImageReader::is_valid() const
+{
+    return valid_;
+}
+
+inline size_t ImageReader::get_size() const
+{
+    return len_;
+}
+
+template <typename T>
+inline bool ImageReader::read(size_t section, const T *&values, size_t &count) const
+{
+    // every array has to lie inside the image
+    if (!valid_ || section >= section_count_)
+    {
+        return false;
+    }
+    uint64_t offset = sections_[section].offset;
+    uint64_t elements = sections_[section].count;
+    if (offset % 8 != 0 || offset > len_ || elements > (len_ - offset) / sizeof(T))
+    {
+        return false;
+    }
+    values = reinterpret_cast<const T *>(image_ + offset);
+    count = static_cast<size_t>(elements);
+    return true;
+}
+
+class MappedFile
+{
+  public:
+    explicit MappedFile(const string &path);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+    bool is_open() const;
+    const char *data() const;
+    size_t size() const;
+
+  private:
+    const char *data_;
+    size_t size_;
+    vector<uint64_t> copy_; // without mmap, the file is read into memory
+};
+
+MappedFile::MappedFile(const string &path) : data_(nullptr), size_(0)
+{
+#ifdef SPRE_HAS_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            data_ = static_cast<const char *>(addr);
+            size_ = static_cast<size_t>(st.st_size);
+        }
+    }
+    close(fd);
+#else
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return;
+    }
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        long len = ftell(file);
+        if (len > 0 && fseek(file, 0, SEEK_SET) == 0)
+        {
+            copy_.assign((static_cast<size_t>(len) + 7) / 8, 0);
+            if (fread(copy_.data(), 1, static_cast<size_t>(len), file) == static_cast<size_t>(len))
+            {
+                data_ = reinterpret_cast<const char *>(copy_.data());
+                size_ = static_cast<size_t>(len);
+            }
+        }
+    }
+    fclose(file);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef SPRE_HAS_MMAP
+    if (data_ != nullptr)
+    {
+        munmap(const_cast<char *>(data_), size_);
+    }
+#endif
+}
+
+inline bool MappedFile::is_open() const
+{
+    return data_ != nullptr;
+}
+
+inline const char *MappedFile::data() const
+{
+    return data_;
+}
+
+inline size_t MappedFile::size() const
+{
+    return size_;
+}
+
+inline bool write_image_file(const string &path, const string &image)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+    return fclose(file) == 0 && ok;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_IMAGE_H_
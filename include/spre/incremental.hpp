@@ -0,0 +1,426 @@
+/*
+ * parse a query again after a small edit, without parsing all of it
+ *
+ * for editors and linters which need the asts after every keystroke. An
+ * edit replaces a range of the source, and only the smallest part of the
+ * asts around it is lexed and parsed again:
+ *
+ *     1. the innermost ast which strictly contains the edit, on its own,
+ *        e.g. "letter from a to f" when the "f" is changed. It has to
+ *        give back a single ast of the same type
+ *     2. otherwise the items of the sequence (of a group, a lookaround,
+ *        or the query) the edit touches, together with one untouched
+ *        item on each side, e.g. when ", digit" is typed in a group
+ *     3. otherwise the same one level up, up to the whole query
+ *
+ * the untouched items on both sides keep the lexer in the same state as
+ * it is when the whole query is lexed, so the result is the same as that
+ * of parsing everything again. The spans of the asts after the edit are
+ * moved, nothing else is touched.
+ *
+ * while the source has errors, e.g. in the middle of typing a keyword,
+ * the asts stay those of the last version without errors. The edits
+ * since then are merged into one range, which is parsed again once the
+ * source is valid.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_INCREMENTAL_H_
+#define SIMPLEREGEXLANGUAGE_INCREMENTAL_H_
+
+#include "spre/ast.hpp"
+#include "spre/generator.hpp"
+#include "spre/lexer.hpp"
+#include "spre/parser.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+class IncrementalParser
+{
+  public:
+    explicit IncrementalParser(const string &src = "", bool show_error = false);
+    IncrementalParser(const IncrementalParser &) = delete;
+    IncrementalParser &operator=(const IncrementalParser &) = delete;
+    ~IncrementalParser();
+    bool has_error() const;
+    void report_error() const;
+    bool edit(size_t offset, size_t removed, const string &inserted);
+    const string &get_source() const;
+    const vector<unique_ptr<ExprAST>> &get_asts() const;
+    string get_pattern(Dialect dialect = Dialect::DEFAULT) const;
+    size_t get_reparsed_length() const;
+
+  private:
+    struct Splice
+    {
+        vector<unique_ptr<ExprAST>> *items;
+        size_t first; // items[first, last) are replaced with asts
+        size_t last;
+        vector<unique_ptr<ExprAST>> asts;
+    };
+
+    string src_;
+    vector<unique_ptr<ExprAST>> asts_; // of the last source without errors
+    size_t valid_len_;                 // the length of that source
+    bool dirty_;                       // whether the source changed since
+    size_t dirty_begin_;               // the range which changed, in that source
+    size_t dirty_end_;
+    size_t dirty_new_end_;             // where that range ends in src_
+    size_t reparsed_length_;
+    bool error_flag_;
+    string error_msg_;
+    const bool show_error_;
+
+    bool touches(const ExprAST &ast) const;
+    bool contains(const ExprAST &ast) const;
+    size_t moved(size_t pos) const;
+    bool parse_range(size_t begin, size_t end, vector<unique_ptr<ExprAST>> &asts);
+    bool plan_node(vector<unique_ptr<ExprAST>> &items, size_t index, Splice &splice);
+    bool plan_sequence(vector<unique_ptr<ExprAST>> &items, bool top_level, Splice &splice);
+    static void get_sequences(ExprAST &ast, vector<vector<unique_ptr<ExprAST>> *> &res);
+    static void offset_spans(vector<unique_ptr<ExprAST>> &asts, size_t offset);
+    void move_spans(vector<unique_ptr<ExprAST>> &asts) const;
+};
+
+IncrementalParser::IncrementalParser(const string &src, bool show_error)
+    : valid_len_(0), dirty_(false), dirty_begin_(0), dirty_end_(0), dirty_new_end_(0), reparsed_length_(0),
+      error_flag_(false), show_error_(show_error)
+{
+    // start from the empty query, which src is one big edit of
+    asts_.push_back(std::make_unique<EOFExprAST>());
+    edit(0, 0, src);
+}
+
+IncrementalParser::~IncrementalParser()
+{
+}
+
+inline bool IncrementalParser::has_error() const
+{
+    return error_flag_;
+}
+
+inline void IncrementalParser::report_error() const
+{
+    if (!has_error())
+    {
+        return;
+    }
+    fprintf(stderr, "incremental parser error: ");
+    fprintf(stderr, "%s", error_msg_.c_str());
+    fprintf(stderr, "\n");
+}
+
+inline bool IncrementalParser::edit(size_t offset, size_t removed, const string &inserted)
+{
+    // replaces src[offset, offset + removed) with inserted, false if the
+    // source has errors now
+    offset = std::min(offset, src_.size());
+    removed = std::min(removed, src_.size() - offset);
+    src_.replace(offset, removed, inserted);
+
+    // merged with the edits since the last source without errors
+    if (!dirty_)
+    {
+        dirty_begin_ = offset;
+        dirty_end_ = offset + removed;
+        dirty_new_end_ = offset + inserted.size();
+        dirty_ = true;
+    }
+    else
+    {
+        size_t end = std::max(dirty_new_end_, offset + removed);
+        dirty_end_ = end - dirty_new_end_ + dirty_end_;
+        dirty_new_end_ = end - removed + inserted.size();
+        dirty_begin_ = std::min(dirty_begin_, offset);
+    }
+
+    reparsed_length_ = 0;
+    Splice splice;
+    if (!plan_sequence(asts_, true, splice))
+    {
+        error_flag_ = true;
+        error_msg_ = "the source could not be parsed, the asts are those of the last valid one";
+        if (show_error_)
+        {
+            report_error();
+        }
+        return false;
+    }
+
+    move_spans(asts_);
+    vector<unique_ptr<ExprAST>> &items = *splice.items;
+    items.erase(items.begin() + splice.first, items.begin() + splice.last);
+    items.insert(items.begin() + splice.first, std::make_move_iterator(splice.asts.begin()),
+                 std::make_move_iterator(splice.asts.end()));
+    valid_len_ = src_.size();
+    dirty_ = false;
+    error_flag_ = false;
+    error_msg_.clear();
+    return true;
+}
+
+inline const string &IncrementalParser::get_source() const
+{
+    return src_;
+}
+
+inline const vector<unique_ptr<ExprAST>> &IncrementalParser::get_asts() const
+{
+    return asts_;
+}
+
+inline string IncrementalParser::get_pattern(Dialect dialect) const
+{
+    // of the last source without errors
+    Lexer lexer("", false);
+    Parser parser(lexer, false);
+    Generator generator(parser, show_error_, dialect);
+    return generator.generate(asts_);
+}
+
+inline size_t IncrementalParser::get_reparsed_length() const
+{
+    // how much of the source the last edit lexed and parsed again
+    return reparsed_length_;
+}
+
+inline bool IncrementalParser::touches(const ExprAST &ast) const
+{
+    return ast.get_end() >= dirty_begin_ && ast.get_begin() <= dirty_end_;
+}
+
+inline bool IncrementalParser::contains(const ExprAST &ast) const
+{
+    if (ast.get_begin() < dirty_begin_ && dirty_end_ < ast.get_end())
+    {
+        return true;
+    }
+    // an edit at an end of it, which has to stay next to a whitespace, a
+    // comma or a bracket, where the lexer starts a new token anyway
+    auto is_separator = [](char c) { return std::isspace(static_cast<unsigned char>(c)) || c == ',' || c == '(' || c == ')'; };
+    size_t end = moved(ast.get_end());
+    return ast.get_begin() <= dirty_begin_ && dirty_end_ <= ast.get_end()
+           && (ast.get_begin() == 0 || is_separator(src_[ast.get_begin() - 1]))
+           && (end == src_.size() || is_separator(src_[end]));
+}
+
+inline size_t IncrementalParser::moved(size_t pos) const
+{
+    // a position at or after the edit, from the last valid source to src_
+    return pos - dirty_end_ + dirty_new_end_;
+}
+
+inline bool IncrementalParser::parse_range(size_t begin, size_t end, vector<unique_ptr<ExprAST>> &asts)
+{
+    // [begin, end) of the last valid source, containing the edit
+    size_t new_end = moved(end);
+    reparsed_length_ += new_end - begin;
+    Lexer lexer(src_.substr(begin, new_end - begin), false);
+    Parser parser(lexer, false);
+    asts = parser.parse();
+    if (lexer.has_error() || parser.has_error() || asts.empty()
+        || asts.back()->get_type() != ExprType::END_OF_FILE)
+    {
+        return false;
+    }
+    offset_spans(asts, begin);
+    return true;
+}
+
+inline bool IncrementalParser::plan_node(vector<unique_ptr<ExprAST>> &items, size_t index, Splice &splice)
+{
+    // items[index] contains the edit, try inside it first
+    ExprAST &ast = *items[index];
+    if (ast.get_type() == ExprType::ALTERNATION)
+    {
+        // a branch is not a sequence, a quantifier there belongs to the branch before
+        for (auto &branch : static_cast<AlternationExprAST &>(ast).get_branches())
+        {
+            for (size_t i = 0; i < branch.size(); i++)
+            {
+                if (branch[i] != nullptr && contains(*branch[i]) && plan_node(branch, i, splice))
+                {
+                    return true;
+                }
+            }
+        }
+    }
+    else
+    {
+        vector<vector<unique_ptr<ExprAST>> *> sequences;
+        get_sequences(ast, sequences);
+        for (auto const &sequence : sequences)
+        {
+            if (plan_sequence(*sequence, false, splice))
+            {
+                return true;
+            }
+        }
+    }
+
+    vector<unique_ptr<ExprAST>> asts;
+    if (!parse_range(ast.get_begin(), ast.get_end(), asts) || asts.size() != 2
+        || asts[0]->get_type() != ast.get_type())
+    {
+        return false;
+    }
+    asts.pop_back(); // the end of file
+    splice.items = &items;
+    splice.first = index;
+    splice.last = index + 1;
+    splice.asts = std::move(asts);
+    return true;
+}
+
+inline bool IncrementalParser::plan_sequence(vector<unique_ptr<ExprAST>> &items, bool top_level, Splice &splice)
+{
+    // items[first, last) are touched by the edit, or the gap it is in
+    size_t first = items.size();
+    size_t last = 0;
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        if (items[i] == nullptr)
+        {
+            return false;
+        }
+        if (touches(*items[i]))
+        {
+            first = std::min(first, i);
+            last = i + 1;
+        }
+    }
+    if (first == items.size())
+    {
+        first = last = 0;
+        while (last < items.size() && items[last]->get_end() < dirty_begin_)
+        {
+            last++;
+        }
+        first = last;
+    }
+
+    if (last == first + 1 && contains(*items[first]) && plan_node(items, first, splice))
+    {
+        return true;
+    }
+
+    // one untouched item on each side, or the ends of the query
+    size_t begin = 0;
+    if (first > 0)
+    {
+        begin = items[--first]->get_begin();
+    }
+    else if (!top_level)
+    {
+        return false;
+    }
+    size_t end = 0;
+    bool to_end = false;
+    if (last < items.size() && items[last]->get_type() != ExprType::END_OF_FILE)
+    {
+        end = items[last++]->get_end();
+    }
+    else if (top_level)
+    {
+        end = valid_len_;
+        last = items.size();
+        to_end = true;
+    }
+    else
+    {
+        return false;
+    }
+
+    vector<unique_ptr<ExprAST>> asts;
+    if (!parse_range(begin, end, asts))
+    {
+        return false;
+    }
+    if (!to_end)
+    {
+        asts.pop_back(); // the end of file
+    }
+    splice.items = &items;
+    splice.first = first;
+    splice.last = last;
+    splice.asts = std::move(asts);
+    return true;
+}
+
+inline void IncrementalParser::get_sequences(ExprAST &ast, vector<vector<unique_ptr<ExprAST>> *> &res)
+{
+    switch (ast.get_type())
+    {
+    case ExprType::GROUP:
+        res.push_back(&static_cast<GroupExprAST &>(ast).get_cond());
+        break;
+    case ExprType::LOOKAROUND:
+        res.push_back(&static_cast<LookAroundExprAST &>(ast).get_cond());
+        break;
+    case ExprType::ALTERNATION:
+        for (auto &branch : static_cast<AlternationExprAST &>(ast).get_branches())
+        {
+            res.push_back(&branch);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+inline void IncrementalParser::offset_spans(vector<unique_ptr<ExprAST>> &asts, size_t offset)
+{
+    for (auto const &ast : asts)
+    {
+        if (ast == nullptr)
+        {
+            continue;
+        }
+        ast->set_span(ast->get_begin() + offset, ast->get_end() + offset);
+        vector<vector<unique_ptr<ExprAST>> *> sequences;
+        get_sequences(*ast, sequences);
+        for (auto const &sequence : sequences)
+        {
+            offset_spans(*sequence, offset);
+        }
+    }
+}
+
+inline void IncrementalParser::move_spans(vector<unique_ptr<ExprAST>> &asts) const
+{
+    // the asts after the edit move, those around it grow or shrink
+    for (auto const &ast : asts)
+    {
+        if (ast == nullptr || ast->get_end() < dirty_end_)
+        {
+            continue;
+        }
+        if (ast->get_begin() >= dirty_end_)
+        {
+            ast->set_span(moved(ast->get_begin()), moved(ast->get_end()));
+        }
+        else
+        {
+            ast->set_span(ast->get_begin(), moved(ast->get_end()));
+        }
+        vector<vector<unique_ptr<ExprAST>> *> sequences;
+        get_sequences(*ast, sequences);
+        for (auto const &sequence : sequences)
+        {
+            move_spans(*sequence);
+        }
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_INCREMENTAL_H_
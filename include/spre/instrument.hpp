@@ -0,0 +1,420 @@
+/*
+ * where the time of compiling a query goes
+ *
+ * SRL and RuleSet take an optional instrumentation policy, a class with
+ *
+ *     static const bool enabled = true;
+ *     void report(const spre::CompileStats &stats);
+ *
+ * and report() is called once per query with how long every phase took,
+ * how many tokens, AST nodes and instructions it had, and how many
+ * allocations it made. With the default NoInstrumentation (enabled is
+ * false) the recorder below is an empty class whose calls all inline to
+ * nothing, so the plain constructors cost what they did before.
+ *
+ * the lexer runs inside the parser, one token at a time, so the query is
+ * lexed once more on its own to time the lexing, and the parsing time
+ * still includes the lexing it drives.
+ *
+ * there is no phase of its own for optimizing: the compiler (see
+ * compiler.hpp) has no pass over the asts or the program besides the one
+ * emitting the instructions. Literal branches of any of are merged into
+ * tries, and parts compiled before are pasted from the FragmentCache, as
+ * they are emitted, so that time is part of COMPILING.
+ *
+ * allocations are only counted when SPRE_COUNT_ALLOCATIONS is defined in
+ * exactly one source file before spre is included: it replaces the global
+ * operator new and delete with ones counting per thread. Without it the
+ * allocation counts stay 0. Memory freed on another thread than the one
+ * allocating it makes the bytes in use of both threads off.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_INSTRUMENT_H_
+#define SIMPLEREGEXLANGUAGE_INSTRUMENT_H_
+
+#include "spre/ast.hpp"
+#include "spre/lexer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+enum class CompilePhase
+{
+    LEXING,
+    PARSING,
+    GENERATING,         // the regex text
+    COMPILING,          // the program of the native engine, optimized as it is emitted
+    BUILDING_AUTOMATON, // the Aho-Corasick automaton of a rule set
+};
+
+const size_t COMPILE_PHASE_COUNT = 5;
+
+inline const char *get_phase_name(CompilePhase phase)
+{
+    static const char *names[COMPILE_PHASE_COUNT] = {"lexing", "parsing", "generating", "compiling",
+                                                     "building_automaton"};
+    return names[static_cast<size_t>(phase)];
+}
+
+struct CompileStats
+{
+    CompileStats();
+    double get_seconds(CompilePhase phase) const;
+    double get_total_seconds() const;
+
+    double seconds[COMPILE_PHASE_COUNT];
+    size_t token_count;
+    size_t node_count;
+    size_t instruction_count;
+    size_t allocation_count;
+    size_t peak_bytes; // the most bytes allocated at once on top of what was in use before
+};
+
+CompileStats::CompileStats() : token_count(0), node_count(0), instruction_count(0), allocation_count(0), peak_bytes(0)
+{
+    for (size_t i = 0; i < COMPILE_PHASE_COUNT; i++)
+    {
+        seconds[i] = 0;
+    }
+}
+
+inline double CompileStats::get_seconds(CompilePhase phase) const
+{
+    return seconds[static_cast<size_t>(phase)];
+}
+
+inline double CompileStats::get_total_seconds() const
+{
+    double total = 0;
+    for (size_t i = 0; i < COMPILE_PHASE_COUNT; i++)
+    {
+        total += seconds[i];
+    }
+    return total;
+}
+
+struct NoInstrumentation
+{
+    static const bool enabled = false;
+    void report(const CompileStats &)
+    {
+    }
+};
+
+class CompileStatsRecorder
+{
+  public:
+    // keeps the last report and the sum of all of them, e.g. for a whole rule set
+    CompileStatsRecorder();
+    ~CompileStatsRecorder();
+    static const bool enabled = true;
+    void report(const CompileStats &stats);
+    const CompileStats &get_last() const;
+    const CompileStats &get_total() const; // peak_bytes is the largest peak
+    size_t get_report_count() const;
+
+  private:
+    CompileStats last_;
+    CompileStats total_;
+    size_t report_count_;
+};
+
+CompileStatsRecorder::CompileStatsRecorder() : report_count_(0)
+{
+}
+
+CompileStatsRecorder::~CompileStatsRecorder()
+{
+}
+
+inline void CompileStatsRecorder::report(const CompileStats &stats)
+{
+    last_ = stats;
+    for (size_t i = 0; i < COMPILE_PHASE_COUNT; i++)
+    {
+        total_.seconds[i] += stats.seconds[i];
+    }
+    total_.token_count += stats.token_count;
+    total_.node_count += stats.node_count;
+    total_.instruction_count += stats.instruction_count;
+    total_.allocation_count += stats.allocation_count;
+    total_.peak_bytes = std::max(total_.peak_bytes, stats.peak_bytes);
+    report_count_++;
+}
+
+inline const CompileStats &CompileStatsRecorder::get_last() const
+{
+    return last_;
+}
+
+inline const CompileStats &CompileStatsRecorder::get_total() const
+{
+    return total_;
+}
+
+inline size_t CompileStatsRecorder::get_report_count() const
+{
+    return report_count_;
+}
+
+struct AllocationCounter
+{
+    // of the calling thread, only updated with SPRE_COUNT_ALLOCATIONS
+    uint64_t count;
+    int64_t bytes;
+    int64_t peak_bytes;
+
+    static AllocationCounter &get();
+};
+
+inline AllocationCounter &AllocationCounter::get()
+{
+    static thread_local AllocationCounter counter = {0, 0, 0};
+    return counter;
+}
+
+inline size_t count_nodes(const vector<unique_ptr<ExprAST>> &asts)
+{
+    size_t count = 0;
+    for (auto const &ast : asts)
+    {
+        if (ast == nullptr)
+        {
+            continue;
+        }
+        count++;
+        switch (ast->get_type())
+        {
+        case ExprType::GROUP:
+            count += count_nodes(static_cast<const GroupExprAST &>(*ast).get_cond());
+            break;
+        case ExprType::LOOKAROUND:
+            count += count_nodes(static_cast<const LookAroundExprAST &>(*ast).get_cond());
+            break;
+        case ExprType::ALTERNATION:
+            for (auto const &branch : static_cast<const AlternationExprAST &>(*ast).get_branches())
+            {
+                count += count_nodes(branch);
+            }
+            break;
+        case ExprType::FRAGMENT:
+            // counted wherever it is used, like the nodes of the query
+            count += count_nodes(static_cast<const FragmentExprAST &>(*ast).get_asts());
+            break;
+        default:
+            break;
+        }
+    }
+    return count;
+}
+
+template <typename Policy, bool = std::decay<Policy>::type::enabled>
+class PhaseRecorder
+{
+    // the disabled one, which does nothing at all
+  public:
+    explicit PhaseRecorder(Policy &)
+    {
+    }
+    void lex(const string &)
+    {
+    }
+    void end_phase(CompilePhase)
+    {
+    }
+    void set_nodes(const vector<unique_ptr<ExprAST>> &)
+    {
+    }
+    void set_instruction_count(size_t)
+    {
+    }
+    void finish()
+    {
+    }
+};
+
+template <typename Policy>
+class PhaseRecorder<Policy, true>
+{
+  public:
+    explicit PhaseRecorder(Policy &policy);
+    void lex(const string &src);
+    void end_phase(CompilePhase phase);
+    void set_nodes(const vector<unique_ptr<ExprAST>> &asts);
+    void set_instruction_count(size_t count);
+    void finish();
+
+  private:
+    Policy &policy_;
+    CompileStats stats_;
+    std::chrono::steady_clock::time_point last_;
+    uint64_t count_before_; // what the recorder allocates itself is left out
+    int64_t bytes_before_;
+};
+
+template <typename Policy>
+PhaseRecorder<Policy, true>::PhaseRecorder(Policy &policy)
+    : policy_(policy), last_(std::chrono::steady_clock::now())
+{
+    AllocationCounter &counter = AllocationCounter::get();
+    count_before_ = counter.count;
+    bytes_before_ = counter.bytes;
+    counter.peak_bytes = counter.bytes;
+}
+
+template <typename Policy>
+inline void PhaseRecorder<Policy, true>::lex(const string &src)
+{
+    Lexer lexer(src, false);
+    while (!lexer.has_error() && lexer.get_next_token().get_token_type() != TokenType::END_OF_FILE)
+    {
+        stats_.token_count++;
+    }
+    end_phase(CompilePhase::LEXING);
+    AllocationCounter &counter = AllocationCounter::get();
+    count_before_ = counter.count;
+    counter.peak_bytes = counter.bytes;
+}
+
+template <typename Policy>
+inline void PhaseRecorder<Policy, true>::end_phase(CompilePhase phase)
+{
+    auto now = std::chrono::steady_clock::now();
+    stats_.seconds[static_cast<size_t>(phase)] += std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+}
+
+template <typename Policy>
+inline void PhaseRecorder<Policy, true>::set_nodes(const vector<unique_ptr<ExprAST>> &asts)
+{
+    // not part of any phase
+    stats_.node_count = count_nodes(asts);
+    last_ = std::chrono::steady_clock::now();
+}
+
+template <typename Policy>
+inline void PhaseRecorder<Policy, true>::set_instruction_count(size_t count)
+{
+    stats_.instruction_count = count;
+}
+
+template <typename Policy>
+inline void PhaseRecorder<Policy, true>::finish()
+{
+    AllocationCounter &counter = AllocationCounter::get();
+    stats_.allocation_count = static_cast<size_t>(counter.count - count_before_);
+    stats_.peak_bytes = static_cast<size_t>(std::max<int64_t>(counter.peak_bytes - bytes_before_, 0));
+    policy_.report(stats_);
+}
+}
+
+#ifdef SPRE_COUNT_ALLOCATIONS
+// every block carries its size in front of it, so delete knows what is freed
+namespace spre
+{
+const size_t ALLOCATION_HEADER = 16; // keeps the alignment of malloc
+
+inline void *counted_alloc(size_t size)
+{
+    char *block = static_cast<char *>(std::malloc(size + ALLOCATION_HEADER));
+    if (block == nullptr)
+    {
+        return nullptr;
+    }
+    *reinterpret_cast<size_t *>(block) = size;
+    AllocationCounter &counter = AllocationCounter::get();
+    counter.count++;
+    counter.bytes += static_cast<int64_t>(size);
+    counter.peak_bytes = std::max(counter.peak_bytes, counter.bytes);
+    return block + ALLOCATION_HEADER;
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+// the free() of a block from counted_alloc() looks like a mismatch once inlined
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+inline void counted_free(void *ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    char *block = static_cast<char *>(ptr) - ALLOCATION_HEADER;
+    AllocationCounter::get().bytes -= static_cast<int64_t>(*reinterpret_cast<size_t *>(block));
+    std::free(block);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+}
+
+void *operator new(size_t size)
+{
+    void *ptr = spre::counted_alloc(size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return spre::counted_alloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return spre::counted_alloc(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    spre::counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    spre::counted_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    spre::counted_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    spre::counted_free(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept
+{
+    spre::counted_free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept
+{
+    spre::counted_free(ptr);
+}
+#endif
+
+#endif // !SIMPLEREGEXLANGUAGE_INSTRUMENT_H_
@@ -0,0 +1,323 @@
+/*
+ * a DFA turned into x86-64 machine code
+ *
+ * for the few queries which are matched all the time, the whole DFA
+ * (see dfa.hpp) is built ahead of time and every state becomes a piece
+ * of code. There is no table left: a state compares the byte it reads
+ * with the ranges of bytes which leave it and jumps straight to the code
+ * of the next state, e.g. digit is a subtraction, a compare and a
+ * branch. A state with many different ranges uses a jump table instead.
+ *
+ *     state:  cmp rdi, rsi           ; the end of the input
+ *             je  yes / no           ; whether the state accepts there
+ *             movzx eax, byte [rdi]
+ *             inc rdi
+ *             lea edx, [rax - '0']   ; one range, here '0' to '9'
+ *             cmp edx, 9
+ *             jbe next
+ *             jmp other              ; the state most bytes go to
+ *
+ * the code is generated into memory mapped writable, which is made
+ * executable (and no longer writable) before it runs. It is only used
+ * on x86-64 with the System V calling convention (Linux, the BSDs,
+ * macOS). Everywhere else, when SPRE_NO_JIT is defined, or when the DFA
+ * has too many states, the same calls run on the table driven DFA.
+ *
+ * no code is generated for a program which is not sound (see
+ * Program::is_sound()), e.g. the empty one of a query which could not
+ * be compiled. The DFA takes its calls, and never matches.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_JIT_H_
+#define SIMPLEREGEXLANGUAGE_JIT_H_
+
+#include "spre/dfa.hpp"
+#include "spre/program.hpp"
+#include "spre/utf8.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)) && !defined(SPRE_NO_JIT)
+#include <sys/mman.h>
+#define SPRE_HAS_JIT 1
+#endif
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+class Jit
+{
+  public:
+    explicit Jit(const Program &program, size_t max_states = 4096);
+    Jit(const Jit &) = delete;
+    Jit &operator=(const Jit &) = delete;
+    ~Jit();
+    bool is_native() const;
+    size_t get_code_size() const;
+    bool match(const string &text);
+    bool match(const char *text, size_t len);
+    void match_batch(const vector<string> &texts, vector<uint64_t> &bitmap);
+
+  private:
+    typedef int (*Function)(const unsigned char *begin, const unsigned char *end);
+
+    struct Fixup
+    {
+        size_t pos;    // of the 32 bits to fill in
+        uint32_t label;
+        size_t base;   // the target is stored relative to this
+    };
+
+    const Program &program_;
+    Dfa dfa_;
+    void *code_;
+    size_t code_size_;
+    Function function_; // nullptr when the DFA runs instead
+
+    uint32_t get_label(uint32_t row) const;
+    void generate(string &code) const;
+    static void put(string &code, const char *bytes, size_t count);
+    static void put_u32(string &code, uint32_t value);
+    static void put_jump(string &code, const char *bytes, size_t count, uint32_t label, vector<Fixup> &fixups);
+    bool install(const string &code);
+};
+
+Jit::Jit(const Program &program, size_t max_states)
+    : program_(program), dfa_(program, max_states), code_(nullptr), code_size_(0), function_(nullptr)
+{
+#ifdef SPRE_HAS_JIT
+    if (program.is_sound() && dfa_.build())
+    {
+        string code;
+        generate(code);
+        install(code);
+    }
+#endif
+}
+
+Jit::~Jit()
+{
+#ifdef SPRE_HAS_JIT
+    if (code_ != nullptr)
+    {
+        munmap(code_, code_size_);
+    }
+#endif
+}
+
+inline bool Jit::is_native() const
+{
+    return function_ != nullptr;
+}
+
+inline size_t Jit::get_code_size() const
+{
+    return code_size_;
+}
+
+inline bool Jit::match(const string &text)
+{
+    return match(text.data(), text.length());
+}
+
+inline bool Jit::match(const char *text, size_t len)
+{
+    if (function_ == nullptr)
+    {
+        return dfa_.match(text, len);
+    }
+    if (len < program_.get_min_length() || (program_.is_utf8() && !is_valid_utf8(text, len)))
+    {
+        return false;
+    }
+    const unsigned char *begin = reinterpret_cast<const unsigned char *>(text);
+    return function_(begin, begin + len) != 0;
+}
+
+inline void Jit::match_batch(const vector<string> &texts, vector<uint64_t> &bitmap)
+{
+    // bit i % 64 of bitmap[i / 64] tells whether texts[i] matches
+    if (function_ == nullptr)
+    {
+        dfa_.match_batch(texts, bitmap);
+        return;
+    }
+    bitmap.assign((texts.size() + 63) / 64, 0);
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        if (match(texts[i]))
+        {
+            bitmap[i / 64] |= uint64_t(1) << (i % 64);
+        }
+    }
+}
+
+inline uint32_t Jit::get_label(uint32_t row) const
+{
+    // one label for every state, then the ones returning 1 and 0
+    size_t state_count = dfa_.get_state_count();
+    if (row == Dfa::MATCHED_ROW)
+    {
+        return static_cast<uint32_t>(state_count);
+    }
+    if (row == Dfa::DEAD_ROW)
+    {
+        return static_cast<uint32_t>(state_count + 1);
+    }
+    return static_cast<uint32_t>(row / dfa_.class_count_);
+}
+
+inline void Jit::generate(string &code) const
+{
+    // int function(const unsigned char *rdi, const unsigned char *rsi)
+    size_t state_count = dfa_.get_state_count();
+    vector<size_t> labels(state_count + 2, 0);
+    vector<Fixup> fixups;
+
+    put_jump(code, "\xE9", 1, get_label(dfa_.start_), fixups); // jmp start
+    for (size_t index = 0; index < state_count; index++)
+    {
+        uint32_t row = static_cast<uint32_t>(index * dfa_.class_count_);
+        labels[index] = code.size();
+        put(code, "\x48\x39\xF7", 3); // cmp rdi, rsi
+        put_jump(code, "\x0F\x84", 2, static_cast<uint32_t>(state_count + (dfa_.end_accepts_[index] > 0 ? 0 : 1)),
+                 fixups); // je yes / no
+        put(code, "\x0F\xB6\x07\x48\xFF\xC7", 6); // movzx eax, byte [rdi]; inc rdi
+
+        // the ranges of bytes going to the same label
+        vector<uint32_t> targets(256);
+        for (size_t byte = 0; byte < 256; byte++)
+        {
+            targets[byte] = get_label(dfa_.table_[row + dfa_.classes_[byte]]);
+        }
+        vector<std::pair<size_t, size_t>> ranges;
+        for (size_t byte = 0; byte < 256; byte++)
+        {
+            if (byte == 0 || targets[byte] != targets[byte - 1])
+            {
+                ranges.push_back(std::make_pair(byte, byte));
+            }
+            ranges.back().second = byte;
+        }
+
+        // the label most bytes go to is the one left after all the compares
+        vector<size_t> widths(state_count + 2, 0);
+        uint32_t fallback = targets[0];
+        for (auto const &range : ranges)
+        {
+            uint32_t target = targets[range.first];
+            widths[target] += range.second - range.first + 1;
+            if (widths[target] > widths[fallback])
+            {
+                fallback = target;
+            }
+        }
+        size_t compares = 0;
+        for (auto const &range : ranges)
+        {
+            compares += targets[range.first] != fallback ? 1 : 0;
+        }
+
+        if (compares > 8)
+        {
+            // lea rdx, [rip + table]; movsxd rax, dword [rdx + rax * 4];
+            // add rax, rdx; jmp rax; then the table, relative to itself
+            put(code, "\x48\x8D\x15", 3);
+            put_u32(code, 9);
+            put(code, "\x48\x63\x04\x82\x48\x01\xD0\xFF\xE0", 9);
+            size_t base = code.size();
+            for (size_t byte = 0; byte < 256; byte++)
+            {
+                fixups.push_back(Fixup{code.size(), targets[byte], base});
+                put_u32(code, 0);
+            }
+            continue;
+        }
+        for (auto const &range : ranges)
+        {
+            uint32_t target = targets[range.first];
+            if (target == fallback)
+            {
+                continue;
+            }
+            if (range.first == range.second)
+            {
+                put(code, "\x3D", 1); // cmp eax, byte
+                put_u32(code, static_cast<uint32_t>(range.first));
+                put_jump(code, "\x0F\x84", 2, target, fixups); // je target
+            }
+            else
+            {
+                put(code, "\x8D\x90", 2); // lea edx, [rax - first]
+                put_u32(code, static_cast<uint32_t>(0 - range.first));
+                put(code, "\x81\xFA", 2); // cmp edx, last - first
+                put_u32(code, static_cast<uint32_t>(range.second - range.first));
+                put_jump(code, "\x0F\x86", 2, target, fixups); // jbe target
+            }
+        }
+        put_jump(code, "\xE9", 1, fallback, fixups); // jmp fallback
+    }
+
+    labels[state_count] = code.size();
+    put(code, "\xB8\x01\x00\x00\x00\xC3", 6); // mov eax, 1; ret
+    labels[state_count + 1] = code.size();
+    put(code, "\x31\xC0\xC3", 3); // xor eax, eax; ret
+
+    for (auto const &fixup : fixups)
+    {
+        uint32_t offset = static_cast<uint32_t>(labels[fixup.label] - fixup.base);
+        memcpy(&code[fixup.pos], &offset, sizeof(offset));
+    }
+}
+
+inline void Jit::put(string &code, const char *bytes, size_t count)
+{
+    code.append(bytes, count);
+}
+
+inline void Jit::put_u32(string &code, uint32_t value)
+{
+    // x86-64 is little endian, and so is the machine generating for it
+    char bytes[4];
+    memcpy(bytes, &value, sizeof(value));
+    code.append(bytes, 4);
+}
+
+inline void Jit::put_jump(string &code, const char *bytes, size_t count, uint32_t label, vector<Fixup> &fixups)
+{
+    // a jump with a 32 bits displacement from the end of the instruction
+    put(code, bytes, count);
+    fixups.push_back(Fixup{code.size(), label, code.size() + 4});
+    put_u32(code, 0);
+}
+
+inline bool Jit::install(const string &code)
+{
+#ifdef SPRE_HAS_JIT
+    void *addr = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+    {
+        return false;
+    }
+    memcpy(addr, code.data(), code.size());
+    if (mprotect(addr, code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(addr, code.size());
+        return false;
+    }
+    code_ = addr;
+    code_size_ = code.size();
+    function_ = reinterpret_cast<Function>(addr);
+    return true;
+#else
+    (void)code;
+    return false;
+#endif
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_JIT_H_
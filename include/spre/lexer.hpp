@@ -22,6 +22,7 @@
 
 #include "spre/dictionary.hpp"
 #include "spre/token.hpp"
+#include <algorithm>
 #include <cctype>
 #include <cstdio>
 #include <string>
@@ -37,6 +38,7 @@ class Lexer
     ~Lexer();
     Token get_token() const;
     Token get_next_token();
+    size_t get_prev_end() const;
     bool has_error() const;
     void report_error() const;
     bool has_ended() const;
@@ -60,11 +62,13 @@ class Lexer
     string buffer_;        // one string object to eat the chars while necessary
     State state_;
     Token token_;
+    size_t prev_end_;      // where the token before token_ ends
     Dictionary dictionary_;
     bool error_flag_;
     string error_msg_;
     const bool show_error_;
 
+    Token scan_next_token();
     void move_to_next_char();
     char peek_prev_char(size_t k = 1) const;
     char peek_next_char(size_t k = 1) const;
@@ -76,7 +80,7 @@ class Lexer
 
 Lexer::Lexer(const string &src, bool show_error) : src_(src), src_len_(src.length()),
                                                    src_cursor_(0), curr_char_(' '),
-                                                   token_(Token()), state_(State::NONE),
+                                                   token_(Token()), state_(State::NONE), prev_end_(0),
                                                    error_flag_(false), show_error_(show_error)
 {
 }
@@ -140,6 +144,27 @@ inline char Lexer::peek_next_char(size_t k) const
 }
 
 inline Token Lexer::get_next_token()
+{
+    // the token starts at the first char which is not skipped, and ends
+    // right before curr_char_
+    size_t begin = token_.get_end();
+    while (begin < src_len_ && (std::isspace(src_[begin]) || src_[begin] == ','))
+    {
+        begin++;
+    }
+    prev_end_ = token_.get_end();
+    scan_next_token();
+    size_t end = std::min(src_cursor_ == 0 ? 0 : src_cursor_ - 1, src_len_);
+    token_.set_span(std::min(begin, end), end);
+    return token_;
+}
+
+inline size_t Lexer::get_prev_end() const
+{
+    return prev_end_;
+}
+
+inline Token Lexer::scan_next_token()
 {
     // after running the previous get_next_token()
     // normally state_ == State::NONE
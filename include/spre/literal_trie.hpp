@@ -0,0 +1,266 @@
+/*
+ * the literal branches of an "any of", merged into a trie
+ *
+ * any of (literally "GET", literally "GEX") is compiled as G, E and then
+ * one SWITCH on T or X, rather than as two branches which are both tried
+ * at every position. Subtrees which look the same are emitted only once,
+ * so the T and the X above jump to the very same code afterwards, the
+ * way GE[TX] would.
+ *
+ * merging must not change which branch wins. Two different literals
+ * could both match at the same position only if one is a prefix of the
+ * other, so what matters is where the end of the shorter one goes among
+ * the longer ones below it. add() refuses a literal which would have to
+ * go on both sides of such an end, e.g. "GET", "GE", "GETX": "GETX" has
+ * to come after "GE" but it shares "GET" with a branch which comes
+ * before it. The compiler then starts a new trie from that literal.
+ *
+ * a trie which folds case (for case insensitive queries) keeps the
+ * literals in lowercase, so "GET" and "get" are the same literal, and
+ * reads both cases of a letter wherever it reads one.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_LITERAL_TRIE_H_
+#define SIMPLEREGEXLANGUAGE_LITERAL_TRIE_H_
+
+#include "spre/program.hpp"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+class LiteralTrie
+{
+  public:
+    explicit LiteralTrie(bool fold = false);
+    ~LiteralTrie();
+    bool add(const string &src, size_t index);
+    bool empty() const;
+    uint32_t compile(Program &program, vector<uint32_t> &exits);
+
+  private:
+    struct Node
+    {
+        std::map<unsigned char, uint32_t> children;
+        size_t end;       // the index of the literal ending here, npos for none
+        size_t min_index; // the smallest index of the literals below
+        uint32_t shape;   // nodes with the same shape compile to the same code
+    };
+
+    vector<Node> nodes_;
+    bool empty_;
+    const bool fold_;
+
+    uint32_t new_node(size_t index);
+    bool is_before_end(const Node &node, uint32_t child) const;
+    uint32_t find_shapes(uint32_t node, std::map<vector<uint32_t>, uint32_t> &shapes);
+    uint32_t emit_node(uint32_t node, Program &program, vector<uint32_t> &exits,
+                       vector<uint32_t> &emitted);
+};
+
+LiteralTrie::LiteralTrie(bool fold) : empty_(true), fold_(fold)
+{
+    new_node(string::npos);
+}
+
+LiteralTrie::~LiteralTrie()
+{
+}
+
+inline bool LiteralTrie::add(const string &src, size_t index)
+{
+    // the literals have to be added in the order of their priorities
+    string literal = src;
+    if (fold_)
+    {
+        for (auto &c : literal)
+        {
+            c = c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+    }
+    uint32_t node = 0;
+    for (auto const &c : literal)
+    {
+        auto iter = nodes_[node].children.find(static_cast<unsigned char>(c));
+        if (iter == nodes_[node].children.end())
+        {
+            break;
+        }
+        if (nodes_[node].end != string::npos && nodes_[iter->second].min_index < nodes_[node].end)
+        {
+            return false;
+        }
+        node = iter->second;
+    }
+
+    empty_ = false;
+    node = 0;
+    for (auto const &c : literal)
+    {
+        unsigned char byte = static_cast<unsigned char>(c);
+        auto iter = nodes_[node].children.find(byte);
+        if (iter == nodes_[node].children.end())
+        {
+            uint32_t child = new_node(index);
+            nodes_[node].children[byte] = child;
+            node = child;
+        }
+        else
+        {
+            node = iter->second;
+        }
+    }
+    if (nodes_[node].end == string::npos)
+    {
+        // the same literal twice, the later one could never win
+        nodes_[node].end = index;
+    }
+    return true;
+}
+
+inline bool LiteralTrie::empty() const
+{
+    return empty_;
+}
+
+inline uint32_t LiteralTrie::compile(Program &program, vector<uint32_t> &exits)
+{
+    // returns the entry of the code, every pc left in exits is a JUMP
+    // whose target is where the matching continues after the trie
+    std::map<vector<uint32_t>, uint32_t> shapes;
+    find_shapes(0, shapes);
+    vector<uint32_t> emitted(shapes.size(), PROGRAM_INFINITY);
+    return emit_node(0, program, exits, emitted);
+}
+
+inline uint32_t LiteralTrie::new_node(size_t index)
+{
+    Node node;
+    node.end = string::npos;
+    node.min_index = index;
+    node.shape = 0;
+    nodes_.push_back(node);
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+inline bool LiteralTrie::is_before_end(const Node &node, uint32_t child) const
+{
+    // add() makes sure a subtree is either all before the end or all after
+    return node.end == string::npos || nodes_[child].min_index < node.end;
+}
+
+inline uint32_t LiteralTrie::find_shapes(uint32_t node, std::map<vector<uint32_t>, uint32_t> &shapes)
+{
+    vector<uint32_t> shape;
+    shape.push_back(nodes_[node].end != string::npos ? 1 : 0);
+    for (auto const &iter : nodes_[node].children)
+    {
+        shape.push_back(iter.first);
+        shape.push_back(find_shapes(iter.second, shapes));
+        shape.push_back(is_before_end(nodes_[node], iter.second) ? 1 : 0);
+    }
+    auto found = shapes.insert(std::make_pair(shape, static_cast<uint32_t>(shapes.size())));
+    nodes_[node].shape = found.first->second;
+    return nodes_[node].shape;
+}
+
+inline uint32_t LiteralTrie::emit_node(uint32_t node, Program &program, vector<uint32_t> &exits,
+                                       vector<uint32_t> &emitted)
+{
+    const Node &curr = nodes_[node];
+    if (emitted[curr.shape] != PROGRAM_INFINITY)
+    {
+        return emitted[curr.shape];
+    }
+    uint32_t entry = static_cast<uint32_t>(program.size());
+    emitted[curr.shape] = entry;
+
+    // the children before the end, the end, then the children after it
+    vector<vector<std::pair<unsigned char, uint32_t>>> items(3);
+    for (auto const &iter : curr.children)
+    {
+        items[is_before_end(curr, iter.second) ? 0 : 2].push_back(iter);
+    }
+    vector<size_t> order;
+    for (size_t i = 0; i < 3; i++)
+    {
+        if (i == 1 ? curr.end != string::npos : !items[i].empty())
+        {
+            order.push_back(i);
+        }
+    }
+
+    // a chain of SPLITs, one less than the items: the i-th one goes to the
+    // i-th item first and then to the next SPLIT, the last one to the last item
+    vector<uint32_t> splits;
+    for (size_t i = 0; i + 1 < order.size(); i++)
+    {
+        splits.push_back(program.emit(Instruction(OpCode::SPLIT)));
+        if (i > 0)
+        {
+            program.at(splits[i - 1]).y = splits[i];
+        }
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        uint32_t pc = static_cast<uint32_t>(program.size());
+        if (i < splits.size())
+        {
+            program.at(splits[i]).x = pc;
+        }
+        else if (i > 0)
+        {
+            program.at(splits[i - 1]).y = pc;
+        }
+
+        const vector<std::pair<unsigned char, uint32_t>> &children = items[order[i]];
+        if (order[i] == 1)
+        {
+            exits.push_back(program.emit(Instruction(OpCode::JUMP)));
+        }
+        else if (children.size() == 1)
+        {
+            if (fold_ && children[0].first >= 'a' && children[0].first <= 'z')
+            {
+                CharSet set;
+                set.add(children[0].first);
+                set.fold_case();
+                program.emit(Instruction(OpCode::SET, program.add_set(set)));
+            }
+            else
+            {
+                program.emit(Instruction(OpCode::BYTE, children[0].first));
+            }
+            uint32_t next = static_cast<uint32_t>(program.size());
+            uint32_t target = emit_node(children[0].second, program, exits, emitted);
+            if (target != next)
+            {
+                // already emitted somewhere else, nothing new follows the BYTE
+                program.emit(Instruction(OpCode::JUMP, 0, target));
+            }
+        }
+        else
+        {
+            uint32_t pc_switch = program.emit(Instruction(OpCode::SWITCH));
+            vector<uint32_t> table(256, PROGRAM_INFINITY);
+            for (auto const &iter : children)
+            {
+                table[iter.first] = emit_node(iter.second, program, exits, emitted);
+                if (fold_ && iter.first >= 'a' && iter.first <= 'z')
+                {
+                    table[iter.first - 'a' + 'A'] = table[iter.first];
+                }
+            }
+            program.at(pc_switch).arg = program.add_table(table);
+        }
+    }
+    return entry;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_LITERAL_TRIE_H_
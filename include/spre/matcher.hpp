@@ -0,0 +1,777 @@
+/*
+ * the native engine, a Pike VM running a compiled program
+ *
+ * all the threads advance over the input together, one byte at a time,
+ * and no backtracking ever happens. The threads are kept in priority
+ * order, which gives the same leftmost-first results as a backtracking
+ * regex library.
+ *
+ * two threads at the same instruction with the same counters behave the
+ * same from then on, so only the first (the higher priority) one is
+ * kept. The counters are part of that check, and a counter is reset to
+ * 0 when its loop is left, so that finished loops never keep otherwise
+ * equal threads apart.
+ *
+ * so without counted loops a search takes O(n * m) time for n bytes and
+ * a program of m instructions. Counted loops are slower: the threads
+ * which entered a loop at different positions have different counts,
+ * so none of them is dropped, and up to max of them (min for "at
+ * least") are kept at every instruction of its body, which makes it
+ * O(n * m * max). E.g. "digit between 1 and 4096 times, literally "x""
+ * on a long run of digits costs up to 4096 times as much per byte as
+ * "digit once or more, literally "x"". The size of the program does not
+ * depend on the bounds, the time does.
+ *
+ * every counter also has a flag, set when an iteration of its loop
+ * starts and cleared whenever the thread consumes a byte. An iteration
+ * past min which ends with the flag still set matched nothing, and
+ * leaves the loop rather than starting another one at the same position,
+ * as in Perl. The flags are part of the same check as the counters.
+ *
+ * a search could be given a step limit and a cancel flag, so that one
+ * bad input could not keep the caller busy for too long. A step is one
+ * thread visiting one instruction. Both are checked between two bytes
+ * of the input, and the search gives up with MatchResult::STEP_LIMIT_EXCEEDED
+ * or MatchResult::CANCELLED instead of a (possibly wrong) answer.
+ *
+ * before running, the length bounds and the anchors of the program (see
+ * program.hpp) decide where a match could start at all: an input shorter
+ * than the shortest match is rejected at once, "begin with" only starts
+ * at 0, and "must end" with a bounded length only starts near the end.
+ * A "must end" query with a reversed program runs that one backwards
+ * from the end first, to find the only start worth trying.
+ *
+ * a search without a Match only has to say whether there is one, so it
+ * stops at the first MATCH any thread reaches, rather than waiting for
+ * the threads of a higher priority to finish, and a "must end" query
+ * stops once the reversed program has found a start. This is what makes
+ * "all lazy" queries fast as well: their threads reach a MATCH as soon
+ * as they could, and nothing longer is ever tried.
+ *
+ * a lookaround is decided at every position of the input at once, the
+ * first time a thread reaches it: one pass of the Pike VM over its body,
+ * which starts a new thread at every position and marks where the body
+ * matches. The body of a lookbehind runs forwards from the beginning and
+ * marks where it ends, the one of a lookahead was compiled backwards
+ * (see compiler.hpp) and runs from the end, marking where it would
+ * start. The search then starts over, and from then on an ASSERT_LOOK is
+ * only a lookup, however many threads reach it and wherever they
+ * started. Every look is decided at most once per input, so the whole
+ * search stays linear in its length, and an input which never gets as
+ * far as a lookaround pays nothing for it.
+ *
+ * a program compiled with the unicode flag only makes sense of valid
+ * UTF-8, any other input is refused with MatchResult::INVALID_UTF8 before
+ * anything runs.
+ *
+ * with a Profile set, every instruction counts the steps taken on it,
+ * the bytes it consumed, and the threads which failed on it (a byte it
+ * does not accept, an assertion which does not hold, or a duplicate of a
+ * thread already there). A failure is where a backtracking engine would
+ * have backtracked from.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_MATCHER_H_
+#define SIMPLEREGEXLANGUAGE_MATCHER_H_
+
+#include "spre/program.hpp"
+#include "spre/utf8.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using std::string;
+using std::unordered_set;
+using std::vector;
+
+namespace spre
+{
+enum class MatchResult
+{
+    MATCHED,
+    NOT_MATCHED,
+    STEP_LIMIT_EXCEEDED,
+    CANCELLED,
+    INVALID_UTF8
+};
+
+class Match
+{
+  public:
+    Match();
+    ~Match();
+    MatchResult get_result() const;
+    bool has_matched() const;
+    size_t get_begin() const;
+    size_t get_end() const;
+    size_t get_group_count() const;
+    bool has_group(size_t index) const;
+    size_t get_group_begin(size_t index) const;
+    size_t get_group_end(size_t index) const;
+    string get_group(const string &text, size_t index) const;
+
+  private:
+    friend class Matcher;
+    MatchResult result_;
+    vector<size_t> slots_; // begin and end of every group, string::npos if not set
+};
+
+Match::Match() : result_(MatchResult::NOT_MATCHED)
+{
+}
+
+Match::~Match()
+{
+}
+
+inline MatchResult Match::get_result() const
+{
+    return result_;
+}
+
+inline bool Match::has_matched() const
+{
+    return result_ == MatchResult::MATCHED;
+}
+
+inline size_t Match::get_begin() const
+{
+    return get_group_begin(0);
+}
+
+inline size_t Match::get_end() const
+{
+    return get_group_end(0);
+}
+
+inline size_t Match::get_group_count() const
+{
+    return slots_.size() / 2;
+}
+
+inline bool Match::has_group(size_t index) const
+{
+    return index < get_group_count() && slots_[2 * index] != string::npos && slots_[2 * index + 1] != string::npos;
+}
+
+inline size_t Match::get_group_begin(size_t index) const
+{
+    return has_group(index) ? slots_[2 * index] : string::npos;
+}
+
+inline size_t Match::get_group_end(size_t index) const
+{
+    return has_group(index) ? slots_[2 * index + 1] : string::npos;
+}
+
+inline string Match::get_group(const string &text, size_t index) const
+{
+    if (!has_group(index))
+    {
+        return "";
+    }
+    return text.substr(slots_[2 * index], slots_[2 * index + 1] - slots_[2 * index]);
+}
+
+struct Profile
+{
+    // indexed by the pc
+    vector<uint64_t> steps;
+    vector<uint64_t> failures;
+    vector<uint64_t> bytes;
+};
+
+class Matcher
+{
+  public:
+    explicit Matcher(const Program &program);
+    ~Matcher();
+    bool search(const string &text, Match *match = nullptr);
+    bool search(const char *text, size_t len, Match *match = nullptr);
+    void set_step_limit(size_t step_limit);
+    void set_cancel_flag(const std::atomic<bool> *cancel_flag);
+    void set_profile(Profile *profile);
+
+  private:
+    struct Thread
+    {
+        uint32_t pc;
+        vector<size_t> slots;
+        vector<uint32_t> counters;
+    };
+
+    struct CountersHash
+    {
+        size_t operator()(const vector<uint32_t> &counters) const
+        {
+            size_t res = 14695981039346656037ULL;
+            for (auto const &iter : counters)
+            {
+                res = (res ^ iter) * 1099511628211ULL;
+            }
+            return res;
+        }
+    };
+
+    const Program &program_;
+    bool sound_; // an unsound program (see Program::is_sound()) never matches
+    vector<Thread> clist_;
+    vector<Thread> nlist_;
+    vector<Thread> stack_;
+    vector<size_t> mark_; // the generation when an instruction is visited
+    vector<vector<bool>> holds_; // for every look, whether it holds at each position
+    vector<bool> decided_;       // whether holds_ is known for a look yet
+    uint32_t missing_;           // a look reached before it was decided, NO_LOOK for none
+    vector<unordered_set<vector<uint32_t>, CountersHash>> seen_counters_;
+    size_t generation_;
+    size_t step_limit_; // 0 means no limit
+    size_t steps_;
+    const std::atomic<bool> *cancel_flag_;
+    Profile *profile_; // nullptr when not profiling
+    MatchResult result_;
+
+    static const uint32_t NO_LOOK = PROGRAM_INFINITY;
+
+    bool run(const char *text, size_t len, size_t first, size_t last, vector<size_t> &best, bool any);
+    size_t run_reverse(const char *text, size_t len);
+    bool decide_look(const char *text, size_t len, uint32_t index);
+    bool run_look(const char *text, size_t len, const Look &look, vector<bool> &holds);
+    bool accepts(const Instruction &inst, char c, uint32_t &pc) const;
+    bool step(const Instruction &inst, const char *text, size_t len, size_t pos, uint32_t &pc);
+    bool out_of_budget();
+    Thread new_thread(uint32_t pc) const;
+    bool visit(const Thread &thread);
+    void add_thread(vector<Thread> &list, Thread thread, const char *text, size_t len, size_t pos);
+};
+
+Matcher::Matcher(const Program &program)
+    : program_(program), sound_(program.is_sound()), mark_(program.size(), 0), missing_(NO_LOOK),
+      seen_counters_(program.get_counter_count() == 0 ? 0 : program.size()), generation_(0), step_limit_(0), steps_(0), cancel_flag_(nullptr), profile_(nullptr),
+      result_(MatchResult::NOT_MATCHED)
+{
+}
+
+Matcher::~Matcher()
+{
+}
+
+inline bool Matcher::search(const string &text, Match *match)
+{
+    return search(text.data(), text.length(), match);
+}
+
+inline void Matcher::set_step_limit(size_t step_limit)
+{
+    step_limit_ = step_limit;
+}
+
+inline void Matcher::set_cancel_flag(const std::atomic<bool> *cancel_flag)
+{
+    cancel_flag_ = cancel_flag;
+}
+
+inline void Matcher::set_profile(Profile *profile)
+{
+    // the counts are added to whatever the profile holds already
+    profile_ = profile;
+    if (profile_ != nullptr)
+    {
+        profile_->steps.resize(std::max(profile_->steps.size(), program_.size()), 0);
+        profile_->failures.resize(std::max(profile_->failures.size(), program_.size()), 0);
+        profile_->bytes.resize(std::max(profile_->bytes.size(), program_.size()), 0);
+    }
+}
+
+inline bool Matcher::search(const char *text, size_t len, Match *match)
+{
+    vector<size_t> best;
+    bool matched = false;
+
+    steps_ = 0;
+    result_ = MatchResult::NOT_MATCHED;
+
+    // [first, last] are the positions where a match could start
+    size_t min_length = program_.get_min_length();
+    size_t max_length = program_.get_max_length();
+    size_t first = 0;
+    size_t last = len >= min_length ? len - min_length : 0;
+    if (program_.is_anchored_begin())
+    {
+        last = 0;
+    }
+    if (program_.is_anchored_end() && max_length != LENGTH_INFINITY && len > max_length)
+    {
+        first = len - max_length;
+    }
+
+    bool valid = !program_.is_utf8() || is_valid_utf8(text, len);
+    if (!valid)
+    {
+        result_ = MatchResult::INVALID_UTF8;
+    }
+    decided_.assign(program_.get_look_count(), false);
+    holds_.resize(program_.get_look_count());
+    if (sound_ && valid && len >= min_length && first <= last)
+    {
+        // starts over whenever a look has to be decided first
+        size_t start = first;
+        do
+        {
+            missing_ = NO_LOOK;
+            first = start;
+            matched = false;
+            if (program_.has_reverse())
+            {
+                // find where the match starts from the end, then only run there
+                first = last = run_reverse(text, len);
+            }
+            if (missing_ == NO_LOOK && first != string::npos)
+            {
+                // the reversed program has already found a match, the
+                // forward one is only needed for where it ends
+                matched = (match == nullptr && program_.has_reverse()) ||
+                          run(text, len, first, last, best, match == nullptr);
+            }
+        } while (missing_ != NO_LOOK && decide_look(text, len, missing_));
+    }
+
+    if (result_ != MatchResult::NOT_MATCHED)
+    {
+        matched = false;
+        best.clear();
+    }
+    else if (matched)
+    {
+        result_ = MatchResult::MATCHED;
+    }
+
+    if (match != nullptr)
+    {
+        match->result_ = result_;
+        match->slots_ = std::move(best);
+    }
+    return matched;
+}
+
+inline bool Matcher::run(const char *text, size_t len, size_t first, size_t last, vector<size_t> &best, bool any)
+{
+    // with any, the first thread to reach a MATCH is enough, whatever its
+    // priority
+    bool matched = false;
+
+    clist_.clear();
+    generation_++;
+    add_thread(clist_, new_thread(0), text, len, first);
+
+    for (size_t pos = first; !clist_.empty() || (!matched && pos < last); pos++)
+    {
+        if (out_of_budget() || missing_ != NO_LOOK)
+        {
+            return false;
+        }
+
+        generation_++;
+        nlist_.clear();
+        steps_ += clist_.size();
+        for (auto &thread : clist_)
+        {
+            const Instruction &inst = program_.at(thread.pc);
+            if (inst.op == OpCode::MATCH && any)
+            {
+                return true;
+            }
+            if (inst.op == OpCode::MATCH)
+            {
+                // the threads after this one have lower priorities, cut them off
+                matched = true;
+                best = thread.slots;
+                break;
+            }
+            if (step(inst, text, len, pos, thread.pc))
+            {
+                add_thread(nlist_, std::move(thread), text, len, pos + 1);
+            }
+        }
+
+        if (pos >= len)
+        {
+            break;
+        }
+        if (!matched && pos + 1 <= last)
+        {
+            // try to start a new match here, with the lowest priority
+            add_thread(nlist_, new_thread(0), text, len, pos + 1);
+        }
+        clist_.swap(nlist_);
+    }
+
+    return matched;
+}
+
+inline size_t Matcher::run_reverse(const char *text, size_t len)
+{
+    // the reversed program reads the input backwards from the end, there
+    // are no priorities to keep, we only want the leftmost start of all
+    size_t start = string::npos;
+
+    clist_.clear();
+    generation_++;
+    add_thread(clist_, new_thread(program_.get_reverse_start()), text, len, len);
+
+    for (size_t pos = len; !clist_.empty(); pos--)
+    {
+        if (out_of_budget() || missing_ != NO_LOOK)
+        {
+            return string::npos;
+        }
+
+        generation_++;
+        nlist_.clear();
+        steps_ += clist_.size();
+        for (auto &thread : clist_)
+        {
+            const Instruction &inst = program_.at(thread.pc);
+            if (inst.op == OpCode::MATCH)
+            {
+                start = pos;
+                continue;
+            }
+            if (step(inst, text, pos, pos - 1, thread.pc))
+            {
+                add_thread(nlist_, std::move(thread), text, len, pos - 1);
+            }
+        }
+
+        if (pos == 0)
+        {
+            break;
+        }
+        clist_.swap(nlist_);
+    }
+
+    return start;
+}
+
+inline bool Matcher::decide_look(const char *text, size_t len, uint32_t index)
+{
+    // false if the budget ran out. The looks inside the body are decided
+    // on the way, the nesting is as deep as the recursion goes
+    while (true)
+    {
+        missing_ = NO_LOOK;
+        holds_[index].assign(len + 1, false);
+        if (!run_look(text, len, program_.get_look(index), holds_[index]))
+        {
+            return false;
+        }
+        if (missing_ == NO_LOOK)
+        {
+            decided_[index] = true;
+            return true;
+        }
+        if (missing_ >= index)
+        {
+            // only the looks inside come before a look, a broken image
+            // could have any other one
+            return false;
+        }
+        if (!decide_look(text, len, missing_))
+        {
+            return false;
+        }
+    }
+}
+
+inline bool Matcher::run_look(const char *text, size_t len, const Look &look, vector<bool> &holds)
+{
+    // there are no priorities to keep, only where the body matches. A
+    // body has no SAVE, so its threads carry no slots to copy around
+    Thread start;
+    start.pc = look.start;
+    start.counters.assign(2 * program_.get_counter_count(), 0);
+    size_t pos = look.ahead ? len : 0;
+    clist_.clear();
+    generation_++;
+    add_thread(clist_, start, text, len, pos);
+
+    while (missing_ == NO_LOOK)
+    {
+        if (out_of_budget())
+        {
+            return false;
+        }
+
+        bool done = look.ahead ? pos == 0 : pos == len;
+        size_t next = look.ahead ? pos - 1 : pos + 1;
+        generation_++;
+        nlist_.clear();
+        steps_ += clist_.size();
+        for (auto &thread : clist_)
+        {
+            const Instruction &inst = program_.at(thread.pc);
+            if (inst.op == OpCode::MATCH)
+            {
+                holds[pos] = true;
+                continue;
+            }
+            if (!done && step(inst, text, len, look.ahead ? pos - 1 : pos, thread.pc))
+            {
+                add_thread(nlist_, std::move(thread), text, len, next);
+            }
+        }
+
+        if (done)
+        {
+            break;
+        }
+        add_thread(nlist_, start, text, len, next);
+        clist_.swap(nlist_);
+        pos = next;
+    }
+    return true;
+}
+
+inline bool Matcher::accepts(const Instruction &inst, char c, uint32_t &pc) const
+{
+    // moves pc to the next instruction if the byte is consumed
+    unsigned char byte = static_cast<unsigned char>(c);
+    switch (inst.op)
+    {
+    case OpCode::BYTE:
+        pc += 1;
+        return byte == inst.arg;
+    case OpCode::SET:
+        pc += 1;
+        return program_.get_set(inst.arg).has(byte);
+    case OpCode::SWITCH:
+        pc = program_.get_table(inst.arg)[byte];
+        return pc != PROGRAM_INFINITY;
+    default:
+        return false;
+    }
+}
+
+inline bool Matcher::step(const Instruction &inst, const char *text, size_t len, size_t pos, uint32_t &pc)
+{
+    // whether the thread at pc consumes text[pos], which is past the end
+    // when pos >= len
+    if (profile_ == nullptr)
+    {
+        return pos < len && accepts(inst, text[pos], pc);
+    }
+    uint32_t curr = pc;
+    profile_->steps[curr]++;
+    if (pos < len && accepts(inst, text[pos], pc))
+    {
+        profile_->bytes[curr]++;
+        return true;
+    }
+    profile_->failures[curr]++;
+    return false;
+}
+
+inline bool Matcher::out_of_budget()
+{
+    if (step_limit_ != 0 && steps_ > step_limit_)
+    {
+        result_ = MatchResult::STEP_LIMIT_EXCEEDED;
+        return true;
+    }
+    if (cancel_flag_ != nullptr && cancel_flag_->load(std::memory_order_relaxed))
+    {
+        result_ = MatchResult::CANCELLED;
+        return true;
+    }
+    return false;
+}
+
+inline Matcher::Thread Matcher::new_thread(uint32_t pc) const
+{
+    Thread thread;
+    thread.pc = pc;
+    thread.slots.assign(2 * program_.get_capture_count(), string::npos);
+    // the counters, then the flags of their iterations
+    thread.counters.assign(2 * program_.get_counter_count(), 0);
+    return thread;
+}
+
+inline bool Matcher::visit(const Thread &thread)
+{
+    if (mark_[thread.pc] != generation_)
+    {
+        mark_[thread.pc] = generation_;
+        if (!seen_counters_.empty())
+        {
+            seen_counters_[thread.pc].clear();
+            seen_counters_[thread.pc].insert(thread.counters);
+        }
+        return true;
+    }
+    if (seen_counters_.empty())
+    {
+        return false;
+    }
+    return seen_counters_[thread.pc].insert(thread.counters).second;
+}
+
+inline void Matcher::add_thread(vector<Thread> &list, Thread thread, const char *text, size_t len, size_t pos)
+{
+    // follow all the instructions which do not consume input,
+    // depth first so that the priorities are kept. The thread is new or
+    // has just consumed a byte, so none of its iterations is empty
+    size_t counter_count = program_.get_counter_count();
+    std::fill(thread.counters.begin() + counter_count, thread.counters.end(), 0);
+    stack_.clear();
+    stack_.push_back(std::move(thread));
+    while (!stack_.empty())
+    {
+        Thread curr = std::move(stack_.back());
+        stack_.pop_back();
+        steps_ += 1;
+        if (profile_ != nullptr)
+        {
+            profile_->steps[curr.pc]++;
+        }
+        if (!visit(curr))
+        {
+            if (profile_ != nullptr)
+            {
+                profile_->failures[curr.pc]++;
+            }
+            continue;
+        }
+
+        const Instruction &inst = program_.at(curr.pc);
+        switch (inst.op)
+        {
+        case OpCode::JUMP:
+            curr.pc = inst.x;
+            stack_.push_back(std::move(curr));
+            break;
+        case OpCode::SPLIT:
+        {
+            Thread other = curr;
+            other.pc = inst.y;
+            stack_.push_back(std::move(other));
+            curr.pc = inst.x;
+            stack_.push_back(std::move(curr));
+            break;
+        }
+        case OpCode::SAVE:
+            curr.slots[inst.arg] = pos;
+            curr.pc += 1;
+            stack_.push_back(std::move(curr));
+            break;
+        case OpCode::ASSERT_BEGIN:
+            if (pos == 0 || (inst.arg != 0 && text[pos - 1] == '\n'))
+            {
+                curr.pc += 1;
+                stack_.push_back(std::move(curr));
+            }
+            else if (profile_ != nullptr)
+            {
+                profile_->failures[curr.pc]++;
+            }
+            break;
+        case OpCode::ASSERT_END:
+            if (pos == len || (inst.arg != 0 && text[pos] == '\n'))
+            {
+                curr.pc += 1;
+                stack_.push_back(std::move(curr));
+            }
+            else if (profile_ != nullptr)
+            {
+                profile_->failures[curr.pc]++;
+            }
+            break;
+        case OpCode::COUNTER_INIT:
+            curr.counters[inst.arg] = 0;
+            curr.pc += 1;
+            stack_.push_back(std::move(curr));
+            break;
+        case OpCode::COUNTER_TEST:
+        {
+            uint32_t count = curr.counters[inst.arg];
+            curr.counters[counter_count + inst.arg] = 1;
+            if (count < inst.min)
+            {
+                curr.pc = inst.x;
+                stack_.push_back(std::move(curr));
+                break;
+            }
+
+            Thread exit = curr;
+            exit.counters[inst.arg] = 0;
+            exit.counters[counter_count + inst.arg] = 0;
+            exit.pc = inst.y;
+            if (inst.max != PROGRAM_INFINITY && count >= inst.max)
+            {
+                stack_.push_back(std::move(exit));
+                break;
+            }
+
+            curr.pc = inst.x;
+            if (inst.greedy)
+            {
+                stack_.push_back(std::move(exit));
+                stack_.push_back(std::move(curr));
+            }
+            else
+            {
+                stack_.push_back(std::move(curr));
+                stack_.push_back(std::move(exit));
+            }
+            break;
+        }
+        case OpCode::ASSERT_LOOK:
+            if (!decided_[inst.arg])
+            {
+                // the search starts over once the look is decided
+                missing_ = inst.arg;
+            }
+            else if (holds_[inst.arg][pos] != program_.get_look(inst.arg).negate)
+            {
+                curr.pc = inst.x;
+                stack_.push_back(std::move(curr));
+            }
+            else if (profile_ != nullptr)
+            {
+                profile_->failures[curr.pc]++;
+            }
+            break;
+        case OpCode::COUNTER_INCR:
+        {
+            // without an upper bound, any count past min is the same,
+            // so it stops there and the number of states stays finite
+            uint32_t count = curr.counters[inst.arg] + 1;
+            bool empty = curr.counters[counter_count + inst.arg] != 0;
+            curr.counters[counter_count + inst.arg] = 0;
+            if (empty && count >= inst.min)
+            {
+                curr.counters[inst.arg] = 0;
+                curr.pc = inst.y;
+                stack_.push_back(std::move(curr));
+                break;
+            }
+            if (inst.max == PROGRAM_INFINITY)
+            {
+                count = std::min(count, inst.min);
+            }
+            curr.counters[inst.arg] = count;
+            curr.pc = inst.x;
+            stack_.push_back(std::move(curr));
+            break;
+        }
+        default:
+            // BYTE, SET, SWITCH and MATCH wait for the next step
+            list.push_back(std::move(curr));
+            break;
+        }
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_MATCHER_H_
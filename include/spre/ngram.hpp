@@ -0,0 +1,699 @@
+/*
+ * the trigrams a text has to contain for a query to match it
+ *
+ * an index of the trigrams of many documents (see trigram_index.hpp) only
+ * helps if it is known which trigrams a match needs. NGramExtractor works
+ * that out from the asts, as a boolean query of trigrams (NGramQuery):
+ *
+ *     literally "ERROR", anything never or more, literally "took"
+ *         -> "ERR" "ROR" "RRO" "ook" "too"
+ *     any of (literally "GET", literally "PUT"), literally " /api"
+ *         -> " /a" "/ap" "T /" "api" (("ET " "GET") | ("PUT" "UT "))
+ *
+ * every document a query matches satisfies its NGramQuery, so the other
+ * documents could be skipped without running the query on them. The
+ * reverse does not hold, the documents found still have to be matched.
+ *
+ * the analysis follows Russ Cox, "Regular Expression Matching with a
+ * Trigram Index". Every item of a sequence gets the set of strings it
+ * matches exactly, while that set is known and small (a literal, a one of
+ * with a few bytes, an any of of such), and otherwise the prefixes and
+ * the suffixes its matches could have, together with the trigrams they
+ * need. The sets of neighbours are crossed, so literally "ab", one of
+ * "cd" still needs "abc" or "abd". Anything else, e.g. letter, anything,
+ * raw or a lookaround, needs no trigram. So does a query which is case
+ * insensitive, as the index holds the bytes as they are.
+ *
+ * with the unicode flag, letter, whitespace and the like are classes of
+ * code points (see unicode.hpp), which need no trigram either, and a one
+ * of with characters outside of ASCII matches exactly their UTF-8.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_NGRAM_H_
+#define SIMPLEREGEXLANGUAGE_NGRAM_H_
+
+#include "spre/ast.hpp"
+#include "spre/charset.hpp"
+#include "spre/utf8.hpp"
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+const size_t NGRAM_LENGTH = 3; // the n-grams are trigrams
+
+class NGramQuery
+{
+  public:
+    enum class Op
+    {
+        ALL, // every gram and every sub query, nothing at all matches any text
+        ANY  // some gram or some sub query, nothing at all matches no text
+    };
+
+    explicit NGramQuery(Op op = Op::ALL);
+    ~NGramQuery();
+    static NGramQuery make_gram(const string &gram);
+    NGramQuery and_query(const NGramQuery &other) const;
+    NGramQuery or_query(const NGramQuery &other) const;
+    Op get_op() const;
+    const vector<string> &get_grams() const;
+    const vector<NGramQuery> &get_subs() const;
+    bool is_all() const;
+    bool is_none() const;
+    bool matches(const string &text) const;
+    string to_string() const;
+
+  private:
+    Op op_;
+    vector<string> grams_; // sorted
+    vector<NGramQuery> subs_;
+
+    NGramQuery combine(Op op, const NGramQuery &other) const;
+    void add_part(const NGramQuery &part);
+};
+
+NGramQuery::NGramQuery(Op op) : op_(op)
+{
+}
+
+NGramQuery::~NGramQuery()
+{
+}
+
+inline NGramQuery NGramQuery::make_gram(const string &gram)
+{
+    NGramQuery query(Op::ALL);
+    query.grams_.push_back(gram);
+    return query;
+}
+
+inline NGramQuery NGramQuery::and_query(const NGramQuery &other) const
+{
+    return combine(Op::ALL, other);
+}
+
+inline NGramQuery NGramQuery::or_query(const NGramQuery &other) const
+{
+    return combine(Op::ANY, other);
+}
+
+inline NGramQuery::Op NGramQuery::get_op() const
+{
+    return op_;
+}
+
+inline const vector<string> &NGramQuery::get_grams() const
+{
+    return grams_;
+}
+
+inline const vector<NGramQuery> &NGramQuery::get_subs() const
+{
+    return subs_;
+}
+
+inline bool NGramQuery::is_all() const
+{
+    // matches every text, the index could not narrow anything down
+    return op_ == Op::ALL && grams_.empty() && subs_.empty();
+}
+
+inline bool NGramQuery::is_none() const
+{
+    return op_ == Op::ANY && grams_.empty() && subs_.empty();
+}
+
+inline bool NGramQuery::matches(const string &text) const
+{
+    // whether the text has the grams, as the index would tell
+    for (auto const &gram : grams_)
+    {
+        bool found = text.find(gram) != string::npos;
+        if (found != (op_ == Op::ALL))
+        {
+            return found;
+        }
+    }
+    for (auto const &sub : subs_)
+    {
+        bool found = sub.matches(text);
+        if (found != (op_ == Op::ALL))
+        {
+            return found;
+        }
+    }
+    return op_ == Op::ALL;
+}
+
+inline string NGramQuery::to_string() const
+{
+    // "abc" "bcd" for all of them, "abc" | "bcd" for any of them
+    if (is_all())
+    {
+        return "+";
+    }
+    if (is_none())
+    {
+        return "-";
+    }
+    string res;
+    const char *separator = op_ == Op::ALL ? " " : " | ";
+    for (auto const &gram : grams_)
+    {
+        if (!res.empty())
+        {
+            res.append(separator);
+        }
+        res.append("\"" + gram + "\"");
+    }
+    for (auto const &sub : subs_)
+    {
+        if (!res.empty())
+        {
+            res.append(separator);
+        }
+        res.append("(" + sub.to_string() + ")");
+    }
+    return res;
+}
+
+inline NGramQuery NGramQuery::combine(Op op, const NGramQuery &other) const
+{
+    // everything and nothing are folded away, and so are the sub queries
+    // of the same op, e.g. (a b) c is a b c
+    const NGramQuery *parts[] = {this, &other};
+    for (auto const part : parts)
+    {
+        if (op == Op::ALL ? part->is_none() : part->is_all())
+        {
+            return *part;
+        }
+    }
+    if (op == Op::ANY && op_ == Op::ALL && other.op_ == Op::ALL)
+    {
+        // the grams both need are pulled out, (a b) | (a c) is a (b | c)
+        NGramQuery common(Op::ALL);
+        std::set_intersection(grams_.begin(), grams_.end(), other.grams_.begin(), other.grams_.end(),
+                              std::back_inserter(common.grams_));
+        if (!common.grams_.empty())
+        {
+            NGramQuery rest[] = {*this, other};
+            for (auto &iter : rest)
+            {
+                vector<string> grams;
+                std::set_difference(iter.grams_.begin(), iter.grams_.end(), common.grams_.begin(),
+                                    common.grams_.end(), std::back_inserter(grams));
+                iter.grams_.swap(grams);
+            }
+            return common.and_query(rest[0].or_query(rest[1]));
+        }
+    }
+    NGramQuery query(op);
+    for (auto const part : parts)
+    {
+        if (op == Op::ALL ? part->is_all() : part->is_none())
+        {
+            continue;
+        }
+        if (part->op_ == op || part->grams_.size() + part->subs_.size() == 1)
+        {
+            query.add_part(*part);
+        }
+        else
+        {
+            query.subs_.push_back(*part);
+        }
+    }
+    if (query.grams_.empty() && query.subs_.size() == 1)
+    {
+        NGramQuery sub = query.subs_[0];
+        return sub;
+    }
+    return query;
+}
+
+inline void NGramQuery::add_part(const NGramQuery &part)
+{
+    // the grams and the sub queries of part, which has the op of this one
+    // or only a single gram or sub query
+    for (auto const &gram : part.grams_)
+    {
+        auto iter = std::lower_bound(grams_.begin(), grams_.end(), gram);
+        if (iter == grams_.end() || *iter != gram)
+        {
+            grams_.insert(iter, gram);
+        }
+    }
+    for (auto const &sub : part.subs_)
+    {
+        if (sub.op_ == op_)
+        {
+            add_part(sub);
+        }
+        else
+        {
+            subs_.push_back(sub);
+        }
+    }
+}
+
+class NGramExtractor
+{
+  public:
+    explicit NGramExtractor(size_t max_exact = 16, size_t max_set = 32);
+    ~NGramExtractor();
+    NGramQuery extract(const vector<unique_ptr<ExprAST>> &asts) const;
+
+  private:
+    struct Info
+    {
+        bool can_empty;         // whether it could match the empty string
+        bool exact_known;       // whether exact is all it could match
+        std::set<string> exact;
+        std::set<string> prefix; // when exact is not known
+        std::set<string> suffix;
+        NGramQuery match;        // what every match needs
+    };
+
+    const size_t max_exact_; // more exact strings are turned into trigrams
+    const size_t max_set_;   // larger one of are taken as any byte
+    mutable bool utf8_;      // of the query extract() is working on
+
+    Info analyze_sequence(const vector<unique_ptr<ExprAST>> &asts) const;
+    Info analyze_expr(const ExprAST &ast) const;
+    Info analyze_repeat(const Info &info, size_t min, size_t max) const;
+    Info concat(const Info &x, const Info &y) const;
+    Info alternate(Info x, Info y) const;
+    void simplify(Info &info, bool force) const;
+    void simplify_set(Info &info, std::set<string> &set, bool is_suffix) const;
+    void add_exact(Info &info) const;
+    bool has_flag(const vector<unique_ptr<ExprAST>> &asts, const string &flag) const;
+    static Info make_exact(const std::set<string> &exact);
+    static Info make_any(bool can_empty);
+    NGramQuery make_grams(const std::set<string> &set) const;
+    static std::set<string> cross(const std::set<string> &x, const std::set<string> &y);
+    static size_t get_min_length(const std::set<string> &set);
+};
+
+NGramExtractor::NGramExtractor(size_t max_exact, size_t max_set)
+    : max_exact_(max_exact), max_set_(max_set), utf8_(false)
+{
+}
+
+NGramExtractor::~NGramExtractor()
+{
+}
+
+inline NGramQuery NGramExtractor::extract(const vector<unique_ptr<ExprAST>> &asts) const
+{
+    // the asts of a query without errors, see Parser
+    if (has_flag(asts, "i"))
+    {
+        return NGramQuery(NGramQuery::Op::ALL);
+    }
+    utf8_ = has_flag(asts, "u");
+    Info info = analyze_sequence(asts);
+    simplify(info, true);
+    add_exact(info);
+    return info.match;
+}
+
+inline NGramExtractor::Info NGramExtractor::analyze_sequence(const vector<unique_ptr<ExprAST>> &asts) const
+{
+    Info info = make_exact({""});
+    for (size_t i = 0; i < asts.size(); i++)
+    {
+        if (asts[i] == nullptr || asts[i]->get_type() == ExprType::QUANTIFIER)
+        {
+            return make_any(true);
+        }
+        Info item = analyze_expr(*asts[i]);
+        if (i + 1 < asts.size() && asts[i + 1] != nullptr && asts[i + 1]->get_type() == ExprType::QUANTIFIER)
+        {
+            const QuantifierExprAST &quantifier = static_cast<const QuantifierExprAST &>(*asts[i + 1]);
+            item = analyze_repeat(item, quantifier.get_min(), quantifier.get_max());
+            i++;
+        }
+        info = concat(info, item);
+    }
+    return info;
+}
+
+inline NGramExtractor::Info NGramExtractor::analyze_expr(const ExprAST &ast) const
+{
+    switch (ast.get_type())
+    {
+    case ExprType::CHARACTER:
+    {
+        const CharacterExprAST &character = static_cast<const CharacterExprAST &>(ast);
+        if (character.get_kind() == CharacterExprAST::Kind::LITERAL)
+        {
+            return make_exact({character.get_literal()});
+        }
+        if (utf8_ && character.get_class() != CharacterExprAST::Class::NONE)
+        {
+            const string &chars = character.get_literal();
+            if (character.get_class() != CharacterExprAST::Class::ONE_OF || !is_valid_utf8(chars))
+            {
+                return make_any(false);
+            }
+            std::set<string> exact;
+            for (size_t pos = 0, length = 0; pos < chars.length(); pos += length)
+            {
+                uint32_t code_point = 0;
+                length = decode_utf8(chars.data() + pos, chars.length() - pos, code_point);
+                exact.insert(chars.substr(pos, length));
+            }
+            if (exact.size() > max_set_)
+            {
+                return make_any(false);
+            }
+            Info info = make_exact(exact);
+            simplify(info, false);
+            return info;
+        }
+        if (character.get_kind() == CharacterExprAST::Kind::RAW || character.get_set().count() > max_set_)
+        {
+            return make_any(character.get_kind() == CharacterExprAST::Kind::RAW);
+        }
+        std::set<string> exact;
+        for (unsigned c = 0; c < 256; c++)
+        {
+            if (character.get_set().has(static_cast<unsigned char>(c)))
+            {
+                exact.insert(string(1, static_cast<char>(c)));
+            }
+        }
+        Info info = make_exact(exact);
+        simplify(info, false);
+        return info;
+    }
+    case ExprType::GROUP:
+        return analyze_sequence(static_cast<const GroupExprAST &>(ast).get_cond());
+    case ExprType::FRAGMENT:
+        return analyze_sequence(static_cast<const FragmentExprAST &>(ast).get_asts());
+    case ExprType::ALTERNATION:
+    {
+        auto const &branches = static_cast<const AlternationExprAST &>(ast).get_branches();
+        if (branches.empty())
+        {
+            return make_any(true);
+        }
+        Info info = analyze_sequence(branches[0]);
+        for (size_t i = 1; i < branches.size(); i++)
+        {
+            info = alternate(std::move(info), analyze_sequence(branches[i]));
+        }
+        return info;
+    }
+    default:
+        // anchors, flags and lookarounds consume nothing
+        return make_exact({""});
+    }
+}
+
+inline NGramExtractor::Info NGramExtractor::analyze_repeat(const Info &info, size_t min, size_t max) const
+{
+    if (min == max && min <= max_exact_)
+    {
+        // exactly n times, e.g. digit exactly 4 times, is n items in a row
+        Info res = make_exact({""});
+        for (size_t i = 0; i < min; i++)
+        {
+            res = concat(res, info);
+        }
+        return res;
+    }
+    if (min == 0)
+    {
+        return max == 1 ? alternate(info, make_exact({""})) : make_any(true);
+    }
+
+    // at least once: it begins and ends with a match of the item, which
+    // needs what the item needs
+    Info res = info;
+    if (res.exact_known)
+    {
+        add_exact(res);
+        res.prefix = res.exact;
+        res.suffix = res.exact;
+        res.exact.clear();
+        res.exact_known = false;
+        simplify(res, false);
+    }
+    return res;
+}
+
+inline NGramExtractor::Info NGramExtractor::concat(const Info &x, const Info &y) const
+{
+    Info xy = make_exact(std::set<string>());
+    xy.can_empty = x.can_empty && y.can_empty;
+    xy.exact_known = false;
+    xy.match = x.match.and_query(y.match);
+    if (x.exact_known && y.exact_known)
+    {
+        xy.exact = cross(x.exact, y.exact);
+        xy.exact_known = true;
+    }
+    else
+    {
+        if (x.exact_known)
+        {
+            xy.prefix = cross(x.exact, y.prefix);
+        }
+        else
+        {
+            xy.prefix = x.prefix;
+            if (x.can_empty)
+            {
+                xy.prefix.insert(y.prefix.begin(), y.prefix.end());
+            }
+        }
+        if (y.exact_known)
+        {
+            xy.suffix = cross(x.suffix, y.exact);
+        }
+        else
+        {
+            xy.suffix = y.suffix;
+            if (y.can_empty)
+            {
+                xy.suffix.insert(x.suffix.begin(), x.suffix.end());
+            }
+        }
+    }
+
+    // where neither is exact, a match has a suffix of x right before a
+    // prefix of y, whose trigrams are not accounted for anywhere else
+    if (!x.exact_known && !y.exact_known && x.suffix.size() <= max_set_ && y.prefix.size() <= max_set_
+        && get_min_length(x.suffix) + get_min_length(y.prefix) >= NGRAM_LENGTH)
+    {
+        xy.match = xy.match.and_query(make_grams(cross(x.suffix, y.prefix)));
+    }
+    simplify(xy, false);
+    return xy;
+}
+
+inline NGramExtractor::Info NGramExtractor::alternate(Info x, Info y) const
+{
+    Info xy = make_exact(std::set<string>());
+    xy.can_empty = x.can_empty || y.can_empty;
+    xy.exact_known = false;
+    if (x.exact_known && y.exact_known)
+    {
+        xy.exact = x.exact;
+        xy.exact.insert(y.exact.begin(), y.exact.end());
+        xy.exact_known = true;
+    }
+    else
+    {
+        // an exact side becomes its own prefixes and suffixes
+        Info *sides[] = {&x, &y};
+        for (auto side : sides)
+        {
+            if (side->exact_known)
+            {
+                xy.prefix.insert(side->exact.begin(), side->exact.end());
+                xy.suffix.insert(side->exact.begin(), side->exact.end());
+                add_exact(*side);
+            }
+            else
+            {
+                xy.prefix.insert(side->prefix.begin(), side->prefix.end());
+                xy.suffix.insert(side->suffix.begin(), side->suffix.end());
+            }
+        }
+    }
+    xy.match = x.match.or_query(y.match);
+    simplify(xy, false);
+    return xy;
+}
+
+inline void NGramExtractor::simplify(Info &info, bool force) const
+{
+    // too many exact strings, or long enough ones, are turned into the
+    // trigrams they need, keeping their ends as the prefixes and suffixes
+    if (info.exact_known
+        && (info.exact.size() > max_exact_ || get_min_length(info.exact) > NGRAM_LENGTH
+            || (force && get_min_length(info.exact) >= NGRAM_LENGTH)))
+    {
+        add_exact(info);
+        for (auto const &s : info.exact)
+        {
+            if (s.length() < NGRAM_LENGTH)
+            {
+                info.prefix.insert(s);
+                info.suffix.insert(s);
+            }
+            else
+            {
+                info.prefix.insert(s.substr(0, NGRAM_LENGTH - 1));
+                info.suffix.insert(s.substr(s.length() - (NGRAM_LENGTH - 1)));
+            }
+        }
+        info.exact.clear();
+        info.exact_known = false;
+    }
+    if (!info.exact_known)
+    {
+        simplify_set(info, info.prefix, false);
+        simplify_set(info, info.suffix, true);
+    }
+}
+
+inline void NGramExtractor::simplify_set(Info &info, std::set<string> &set, bool is_suffix) const
+{
+    // the trigrams of the set are needed anyway, after that only the
+    // n - 1 bytes next to the neighbour matter
+    info.match = info.match.and_query(make_grams(set));
+    std::set<string> trimmed;
+    for (auto const &s : set)
+    {
+        if (s.length() < NGRAM_LENGTH)
+        {
+            trimmed.insert(s);
+        }
+        else if (is_suffix)
+        {
+            trimmed.insert(s.substr(s.length() - (NGRAM_LENGTH - 1)));
+        }
+        else
+        {
+            trimmed.insert(s.substr(0, NGRAM_LENGTH - 1));
+        }
+    }
+
+    // "a" says less than "ab" does, so the longer one is dropped
+    set.clear();
+    for (auto const &s : trimmed)
+    {
+        bool redundant = false;
+        for (size_t len = 0; len < s.length() && !redundant; len++)
+        {
+            redundant = trimmed.count(is_suffix ? s.substr(s.length() - len) : s.substr(0, len)) != 0;
+        }
+        if (!redundant)
+        {
+            set.insert(s);
+        }
+    }
+}
+
+inline void NGramExtractor::add_exact(Info &info) const
+{
+    if (info.exact_known)
+    {
+        info.match = info.match.and_query(make_grams(info.exact));
+    }
+}
+
+inline bool NGramExtractor::has_flag(const vector<unique_ptr<ExprAST>> &asts, const string &flag) const
+{
+    // flags only come at the top level of a query
+    for (auto const &iter : asts)
+    {
+        if (iter != nullptr && iter->get_type() == ExprType::FLAG && iter->get_val() == flag)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline NGramExtractor::Info NGramExtractor::make_exact(const std::set<string> &exact)
+{
+    Info info;
+    info.can_empty = exact.count("") != 0;
+    info.exact_known = true;
+    info.exact = exact;
+    return info;
+}
+
+inline NGramExtractor::Info NGramExtractor::make_any(bool can_empty)
+{
+    // matches any string (of at least one byte unless can_empty)
+    Info info;
+    info.can_empty = can_empty;
+    info.exact_known = false;
+    info.prefix.insert("");
+    info.suffix.insert("");
+    return info;
+}
+
+inline NGramQuery NGramExtractor::make_grams(const std::set<string> &set) const
+{
+    // any of the strings, each one with all of its trigrams. A string too
+    // short to have one could be anywhere, and too many strings would cost
+    // the index more to look up than they narrow down
+    if (get_min_length(set) < NGRAM_LENGTH || set.size() > max_set_)
+    {
+        return NGramQuery(NGramQuery::Op::ALL);
+    }
+    NGramQuery query(NGramQuery::Op::ANY);
+    for (auto const &s : set)
+    {
+        NGramQuery grams(NGramQuery::Op::ALL);
+        for (size_t i = 0; i + NGRAM_LENGTH <= s.length(); i++)
+        {
+            grams = grams.and_query(NGramQuery::make_gram(s.substr(i, NGRAM_LENGTH)));
+        }
+        query = query.or_query(grams);
+    }
+    return query;
+}
+
+inline std::set<string> NGramExtractor::cross(const std::set<string> &x, const std::set<string> &y)
+{
+    std::set<string> res;
+    for (auto const &a : x)
+    {
+        for (auto const &b : y)
+        {
+            res.insert(a + b);
+        }
+    }
+    return res;
+}
+
+inline size_t NGramExtractor::get_min_length(const std::set<string> &set)
+{
+    size_t min = set.empty() ? 0 : string::npos;
+    for (auto const &s : set)
+    {
+        min = std::min(min, s.length());
+    }
+    return min;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_NGRAM_H_
@@ -4,6 +4,7 @@
 #include "spre/ast.hpp"
 #include "spre/lexer.hpp"
 #include "spre/token.hpp"
+#include <algorithm>
 #include <cstdio>
 #include <memory>
 #include <string>
@@ -16,32 +17,57 @@ using std::vector;
 
 namespace spre
 {
+// how deep groups may be nested, e.g. capture (any of (until (...)))
+const size_t DEFAULT_MAX_DEPTH = 10000;
+
 class Parser
 {
   public:
-    explicit Parser(Lexer &lexer, bool show_error = true);
+    explicit Parser(Lexer &lexer, bool show_error = true, size_t max_depth = DEFAULT_MAX_DEPTH);
     ~Parser();
     bool has_error() const;
     void report_error() const;
+    void set_fragments(const FragmentMap *fragments);
     vector<unique_ptr<ExprAST>> parse();
 
   private:
+    struct Frame
+    {
+        // a group whose ")" is not reached yet
+        Frame(TokenValue value, size_t token_begin, size_t token_end);
+
+        TokenValue token_value; // capture, until, any of or a lookaround
+        size_t begin;           // of that token
+        size_t end;
+        vector<unique_ptr<ExprAST>> cond;
+        vector<vector<unique_ptr<ExprAST>>> branches; // of any of
+    };
+
     Lexer &lexer_;
+    const size_t max_depth_;
+    const FragmentMap *fragments_; // what fragment "name" could refer to
     bool error_flag_;
     string error_msg_;
     const bool show_error_;
 
     unique_ptr<ExprAST> parse_token(const Token &token);
+    void open_group(const Token &token, vector<Frame> &frames, vector<unique_ptr<ExprAST>> &asts);
+    unique_ptr<ExprAST> close_group(Frame &frame);
+    unique_ptr<ExprAST> make_group(Frame &frame);
+    void add_ast(unique_ptr<ExprAST> ptr, vector<Frame> &frames, vector<unique_ptr<ExprAST>> &asts);
+    string get_group_name(const TokenValue &token_value) const;
     unique_ptr<CharacterExprAST> parse_character(const TokenValue &token_value);
+    unique_ptr<FragmentExprAST> parse_fragment();
     unique_ptr<QuantifierExprAST> parse_quantifier(const TokenValue &token_value);
-    unique_ptr<GroupExprAST> parse_group(const TokenValue &token_value);
-    unique_ptr<LookAroundExprAST> parse_lookaround(const TokenValue &token_value);
     unique_ptr<FlagExprAST> parse_flag(const TokenValue &token_value);
     unique_ptr<AnchorExprAST> parse_anchor(const TokenValue &token_value);
     unique_ptr<EOFExprAST> parse_eof(const TokenValue &token_value);
+    string unescape(const string &val) const;
+    bool parse_number(const Token &token, size_t &number);
 };
 
-Parser::Parser(Lexer &lexer, bool show_error) : lexer_(lexer), error_flag_(false), show_error_(show_error)
+Parser::Parser(Lexer &lexer, bool show_error, size_t max_depth)
+    : lexer_(lexer), max_depth_(max_depth), fragments_(nullptr), error_flag_(false), show_error_(show_error)
 {
     lexer_.get_next_token(); // so now we have the first token
 }
@@ -50,6 +76,11 @@ Parser::~Parser()
 {
 }
 
+Parser::Frame::Frame(TokenValue value, size_t token_begin, size_t token_end)
+    : token_value(value), begin(token_begin), end(token_end)
+{
+}
+
 inline bool Parser::has_error() const
 {
     return error_flag_;
@@ -66,22 +97,68 @@ inline void Parser::report_error() const
     fprintf(stderr, "\n");
 }
 
+inline void Parser::set_fragments(const FragmentMap *fragments)
+{
+    // before parse(), e.g. those of a FragmentLibrary
+    fragments_ = fragments;
+}
+
 inline vector<unique_ptr<ExprAST>> Parser::parse()
 {
+    // the groups still open are kept on a stack of their own rather than
+    // the call stack, so a query nested thousands of groups deep costs one
+    // frame per group and stops at max_depth_ with an error
     vector<unique_ptr<ExprAST>> asts;
+    vector<Frame> frames;
     bool eof = false;
 
     while (!lexer_.has_error() && !error_flag_ && !eof)
     {
         Token token = lexer_.get_token();
+        if (token.get_token_type() == TokenType::GROUP || token.get_token_type() == TokenType::LOOKAROUND)
+        {
+            open_group(token, frames, asts);
+            continue;
+        }
+        if (!frames.empty() && token.get_token_value() == TokenValue::GROUP_END
+            && frames.back().token_value == TokenValue::ANY_OF && frames.back().branches.empty())
+        {
+            error_flag_ = true;
+            error_msg_ = "any of should have at least one choice";
+            break;
+        }
+        if (!frames.empty() && token.get_token_value() == TokenValue::GROUP_END
+            && (!frames.back().cond.empty() || !frames.back().branches.empty()))
+        {
+            // an empty condition is left to parse_token(), which rejects the ")"
+            Frame frame = std::move(frames.back());
+            frames.pop_back();
+            add_ast(close_group(frame), frames, asts);
+            continue;
+        }
+        if (!frames.empty()
+            && (token.get_token_type() == TokenType::END_OF_FILE || token.get_token_type() == TokenType::UNDEFINED))
+        {
+            error_flag_ = true;
+            error_msg_ = get_group_name(frames.back().token_value) + " condition doesn't end correctly";
+            break;
+        }
         if (token.get_token_type() == TokenType::END_OF_FILE)
         {
             eof = true;
         }
 
-        unique_ptr<ExprAST> ptr = parse_token(token);
+        add_ast(parse_token(token), frames, asts);
+    }
 
-        asts.push_back(std::move(ptr));
+    if (!frames.empty())
+    {
+        // the outermost group could not be parsed
+        asts.push_back(nullptr);
+    }
+    if (show_error_)
+    {
+        report_error();
     }
     return std::move(asts);
 }
@@ -89,21 +166,21 @@ inline vector<unique_ptr<ExprAST>> Parser::parse()
 
 inline unique_ptr<ExprAST> Parser::parse_token(const Token &token)
 {
+    // anything but a group, see open_group() and close_group() for those
     unique_ptr<ExprAST> ptr;
     switch (token.get_token_type())
     {
     case TokenType::CHARACTER:
+        if (token.get_token_value() == TokenValue::FRAGMENT)
+        {
+            ptr = std::move(parse_fragment());
+            break;
+        }
         ptr = std::move(parse_character(token.get_token_value()));
         break;
     case TokenType::QUANTIFIER:
         ptr = std::move(parse_quantifier(token.get_token_value()));
         break;
-    case TokenType::GROUP:
-        ptr = std::move(parse_group(token.get_token_value()));
-        break;
-    case TokenType::LOOKAROUND:
-        ptr = std::move(parse_lookaround(token.get_token_value()));
-        break;
     case TokenType::FLAG:
         ptr = std::move(parse_flag(token.get_token_value()));
         break;
@@ -121,9 +198,17 @@ inline unique_ptr<ExprAST> Parser::parse_token(const Token &token)
         break;
     }
 
-    if (show_error_)
+    if (ptr == nullptr && !error_flag_)
     {
-        report_error();
+        // e.g. a "(" or ")" of its own, which would never be consumed
+        error_flag_ = true;
+        error_msg_ = "unexpected \"" + token.get_value() + "\"";
+    }
+
+    if (ptr != nullptr)
+    {
+        // the parser is at the token after the ast by now
+        ptr->set_span(token.get_begin(), std::max(token.get_end(), lexer_.get_prev_end()));
     }
 
     return std::move(ptr);
@@ -144,22 +229,27 @@ inline unique_ptr<CharacterExprAST> Parser::parse_character(const TokenValue &to
             return ptr;
         }
 
-        string val;
         switch (token_value)
         {
         case TokenValue::LITERALLY:
-            val = "(?:" + next_token.get_value() + ")";
+            ptr = make_unique<CharacterExprAST>("(?:" + next_token.get_value() + ")",
+                                                unescape(next_token.get_value()));
             break;
         case TokenValue::ONE_OF:
-            val = "[" + next_token.get_value() + "]";
+        {
+            string chars = unescape(next_token.get_value());
+            CharSet set;
+            set.add_string(chars);
+            ptr = make_unique<CharacterExprAST>("[" + next_token.get_value() + "]", set,
+                                                CharacterExprAST::Class::ONE_OF, chars);
             break;
+        }
         case TokenValue::RAW:
-            val = next_token.get_value();
+            ptr = make_unique<CharacterExprAST>(next_token.get_value());
             break;
         default:
             break;
         }
-        ptr = make_unique<CharacterExprAST>(val);
         lexer_.get_next_token(); // so we eat the leagal token
         return ptr;
     }
@@ -171,21 +261,28 @@ inline unique_ptr<CharacterExprAST> Parser::parse_character(const TokenValue &to
         if (guess_from.get_token_value() != TokenValue::FROM)
         {
             string val;
+            CharSet set;
+            CharacterExprAST::Class set_class = CharacterExprAST::Class::NONE;
             switch (token_value)
             {
             case TokenValue::LETTER:
                 val = "[a-z]";
+                set.add_range('a', 'z');
+                set_class = CharacterExprAST::Class::LETTER;
                 break;
             case TokenValue::UPPERCASE_LETTER:
                 val = "[A-Z]";
+                set.add_range('A', 'Z');
+                set_class = CharacterExprAST::Class::UPPERCASE_LETTER;
                 break;
             case TokenValue::DIGIT:
                 val = "[0-9]";
+                set.add_range('0', '9');
                 break;
             default:
                 break;
             }
-            ptr = make_unique<CharacterExprAST>(val);
+            ptr = make_unique<CharacterExprAST>(val, set, set_class);
             // now we already at the one after letter/digit/...
             // because we already move to here for guessing from
             return ptr;
@@ -202,51 +299,73 @@ inline unique_ptr<CharacterExprAST> Parser::parse_character(const TokenValue &to
 
         string az = guess_to.get_value();
 
-        if (az.length() != 2)
+        if (az.length() != 2 || az[0] > az[1])
         {
             error_flag_ = true;
             error_msg_ = "the range \"from\" and \"to\" is not well defined";
             return ptr;
         }
 
+        CharSet set;
+        set.add_range(az[0], az[1]);
         az.insert(1, "-");
         az.insert(0, "[");
         az.append("]");
-        ptr = make_unique<CharacterExprAST>(az);
+        ptr = make_unique<CharacterExprAST>(az, set);
         lexer_.get_next_token(); // so we eat the leagal token to
         return ptr;
     }
 
     string val;
+    CharSet set;
+    CharacterExprAST::Class set_class = CharacterExprAST::Class::NONE;
     switch (token_value)
     {
     case TokenValue::ANY_CHARACTER:
-        val = "\\w";
-        break;
     case TokenValue::NO_CHARACTER:
-        val = "\\W";
+        val = token_value == TokenValue::ANY_CHARACTER ? "\\w" : "\\W";
+        set.add_range('a', 'z');
+        set.add_range('A', 'Z');
+        set.add_range('0', '9');
+        set.add('_');
+        set_class = CharacterExprAST::Class::WORD;
+        if (token_value == TokenValue::NO_CHARACTER)
+        {
+            set.negate();
+            set_class = CharacterExprAST::Class::NOT_WORD;
+        }
         break;
     case TokenValue::ANYTHING:
         val = ".";
+        set.add('\n');
+        set.negate();
+        set_class = CharacterExprAST::Class::ANYTHING;
         break;
     case TokenValue::NEW_LINE:
         val = "\\n";
+        set.add('\n');
         break;
     case TokenValue::WHITESPACE:
-        val = "\\s";
-        break;
     case TokenValue::NO_WHITESPACE:
-        val = "\\S";
+        val = token_value == TokenValue::WHITESPACE ? "\\s" : "\\S";
+        set.add_string(" \t\n\v\f\r");
+        set_class = CharacterExprAST::Class::WHITESPACE;
+        if (token_value == TokenValue::NO_WHITESPACE)
+        {
+            set.negate();
+            set_class = CharacterExprAST::Class::NOT_WHITESPACE;
+        }
         break;
     case TokenValue::TAB:
         val = "\\t";
+        set.add('\t');
         break;
     default:
         break;
     }
     if (val.length() != 0)
     {
-        ptr = make_unique<CharacterExprAST>(val);
+        ptr = make_unique<CharacterExprAST>(val, set, set_class);
         lexer_.get_next_token(); // so we eat the leagal token
     }
     else
@@ -259,10 +378,31 @@ inline unique_ptr<CharacterExprAST> Parser::parse_character(const TokenValue &to
     return std::move(ptr);
 }
 
+inline unique_ptr<FragmentExprAST> Parser::parse_fragment()
+{
+    unique_ptr<FragmentExprAST> ptr;
+    Token name = lexer_.get_next_token();
+    if (name.get_token_type() != TokenType::SRC_STRING)
+    {
+        error_flag_ = true;
+        error_msg_ = "missing string literal";
+        return ptr;
+    }
+    if (fragments_ == nullptr || fragments_->find(name.get_value()) == fragments_->end())
+    {
+        error_flag_ = true;
+        error_msg_ = "the fragment \"" + name.get_value() + "\" is not defined";
+        return ptr;
+    }
+    // the asts of the fragment are shared, not parsed again
+    ptr = make_unique<FragmentExprAST>(name.get_value(), fragments_->find(name.get_value())->second);
+    lexer_.get_next_token(); // so we eat the leagal token
+    return ptr;
+}
+
 inline unique_ptr<QuantifierExprAST> Parser::parse_quantifier(const TokenValue &token_value)
 {
     unique_ptr<QuantifierExprAST> ptr;
-    string val;
 
     switch (token_value)
     {
@@ -280,8 +420,12 @@ inline unique_ptr<QuantifierExprAST> Parser::parse_quantifier(const TokenValue &
             }
             else
             {
-                ptr = make_unique<QuantifierExprAST>("{" + next_token.get_value() + "}");
-                lexer_.get_next_token(); // eat the trailing "times"
+                size_t x = 0;
+                if (parse_number(next_token, x))
+                {
+                    ptr = make_unique<QuantifierExprAST>(x, x);
+                    lexer_.get_next_token(); // eat the trailing "times"
+                }
             }
         }
         else
@@ -294,18 +438,15 @@ inline unique_ptr<QuantifierExprAST> Parser::parse_quantifier(const TokenValue &
     }
     
     case TokenValue::EXACTLY_ONE_TIME:
-        val = "{1}";
-        ptr = make_unique<QuantifierExprAST>(val);
+        ptr = make_unique<QuantifierExprAST>(1, 1);
         lexer_.get_next_token();
         break;
     case TokenValue::ONCE:
-        val = "{1}";
-        ptr = make_unique<QuantifierExprAST>(val);
+        ptr = make_unique<QuantifierExprAST>(1, 1);
         lexer_.get_next_token();
         break;
     case TokenValue::TWICE:
-        val = "{2}";
-        ptr = make_unique<QuantifierExprAST>(val);
+        ptr = make_unique<QuantifierExprAST>(2, 2);
         lexer_.get_next_token();
         break;
     case TokenValue::BETWEEN_X_AND_Y_TIMES:
@@ -314,14 +455,21 @@ inline unique_ptr<QuantifierExprAST> Parser::parse_quantifier(const TokenValue &
         Token and_token = lexer_.get_next_token();
         Token y = lexer_.get_next_token();
         Token times = lexer_.get_next_token();
+        size_t min = 0;
+        size_t max = 0;
         if (x.get_token_value() == TokenValue::NUMBER && and_token.get_token_value() == TokenValue::AND && y.get_token_value() == TokenValue::NUMBER)
         {
-            string val = "{";
-            val.append(x.get_value());
-            val.append(",");
-            val.append(y.get_value());
-            val.append("}");
-            ptr = make_unique<QuantifierExprAST>(val);
+            if (!parse_number(x, min) || !parse_number(y, max))
+            {
+                break;
+            }
+            if (min > max)
+            {
+                error_flag_ = true;
+                error_msg_ = "x should not be greater than y in \"between x and y times\"";
+                break;
+            }
+            ptr = make_unique<QuantifierExprAST>(min, max);
             if (times.get_token_value() == TokenValue::TIMES)
             {
                 lexer_.get_next_token(); // eat the trailing "times"
@@ -338,28 +486,29 @@ inline unique_ptr<QuantifierExprAST> Parser::parse_quantifier(const TokenValue &
 		break;
     }
     case TokenValue::OPTIONAL:
-        val = "?";
-        ptr = make_unique<QuantifierExprAST>(val);
+        ptr = make_unique<QuantifierExprAST>(0, 1);
         lexer_.get_next_token();
         break;
     case TokenValue::ONCE_OR_MORE:
-        val = "+";
-        ptr = make_unique<QuantifierExprAST>(val);
+        ptr = make_unique<QuantifierExprAST>(1, QUANTIFIER_INFINITY);
         lexer_.get_next_token();
         break;
     case TokenValue::NEVER_OR_MORE:
-        val = "?";
-        ptr = make_unique<QuantifierExprAST>(val);
+        ptr = make_unique<QuantifierExprAST>(0, QUANTIFIER_INFINITY);
         lexer_.get_next_token();
         break;
     case TokenValue::AT_LEAST_X_TIMES:
     {
         Token x = lexer_.get_next_token();
         Token times = lexer_.get_next_token();
+        size_t min = 0;
         if (x.get_token_value() == TokenValue::NUMBER && times.get_token_value() == TokenValue::TIMES)
         {
-            ptr = make_unique<QuantifierExprAST>("{" + x.get_value() + "}");
-            lexer_.get_next_token();
+            if (parse_number(x, min))
+            {
+                ptr = make_unique<QuantifierExprAST>(min, QUANTIFIER_INFINITY);
+                lexer_.get_next_token();
+            }
         }
         else
         {
@@ -381,196 +530,170 @@ inline unique_ptr<QuantifierExprAST> Parser::parse_quantifier(const TokenValue &
     return std::move(ptr);
 }
 
-inline unique_ptr<GroupExprAST> Parser::parse_group(const TokenValue &token_value)
+inline void Parser::open_group(const Token &token, vector<Frame> &frames, vector<unique_ptr<ExprAST>> &asts)
 {
-    unique_ptr<GroupExprAST> ptr;
-    switch (token_value)
-    {
-    case TokenValue::CAPTURE_AS:
-    {
-        Token group_start = lexer_.get_next_token();
-        if (group_start.get_token_value() != TokenValue::GROUP_START)
-        {
-            // early return
-            ptr = nullptr;
-            error_flag_ = true;
-            error_msg_ = "capture should come with \"(...)\"";
-            return std::move(ptr);
-        }
-        lexer_.get_next_token(); // after parsing "(", now the token become the inside part
-        vector<unique_ptr<ExprAST>> cond;
-        do 
-        {
-            cond.push_back(std::move(parse_token(lexer_.get_token())));
-            // after parsing, lexer_.get_token() become the one following.
-        } while (lexer_.get_token().get_token_value() != TokenValue::GROUP_END
-            && lexer_.get_token().get_token_type() != TokenType::END_OF_FILE
-            && lexer_.get_token().get_token_type() != TokenType::UNDEFINED);
-        // after parsing the sub_query_ptr_vec, current token should be ")"!!!
-        
-        if (lexer_.get_token().get_token_value() != TokenValue::GROUP_END)
-        {
-            ptr = nullptr;
-            error_flag_ = true;
-            error_msg_ = "capture condition doesn't end correctly";
-            return std::move(ptr);
-        }
-        ptr = make_unique<GroupExprAST>(std::move(cond));
+    // either pushes a frame, which the ")" closes, or adds the whole group
+    // when its condition is a string, e.g. until "x"
+    const TokenValue token_value = token.get_token_value();
+    Token guess = lexer_.get_next_token();
 
-        Token guess_as = lexer_.get_next_token();
-        if (guess_as.get_token_value() == TokenValue::AS)
+    if (guess.get_token_value() == TokenValue::STRING && token_value != TokenValue::CAPTURE_AS
+        && token_value != TokenValue::ANY_OF)
+    {
+        Frame frame(token_value, token.get_begin(), token.get_end());
+        frame.cond.push_back(std::move(make_unique<CharacterExprAST>("(?:" + guess.get_value() + ")",
+                                                                     unescape(guess.get_value()))));
+        frame.cond.back()->set_span(guess.get_begin(), guess.get_end());
+        lexer_.get_next_token();
+        unique_ptr<ExprAST> ptr = make_group(frame);
+        if (ptr != nullptr)
         {
-            Token name = lexer_.get_next_token();
-            if (name.get_token_value() == TokenValue::STRING)
-            {
-                // prefect name!
-                ptr->set_name(name.get_value());
-                lexer_.get_next_token();
-            }
-            else
-            {
-                ptr = nullptr;
-                error_flag_ = true;
-                error_msg_ = "the name in \"capture (cond) as \"name\"\" is invalid";
-            }
+            ptr->set_span(frame.begin, std::max(frame.end, lexer_.get_prev_end()));
         }
-
-        // right now the current token
-        // is the one after the whole
-        // capture (cond) [as "name"]
-
-        return ptr;
-        //break;
+        add_ast(std::move(ptr), frames, asts);
+        return;
     }
- 
-    case TokenValue::UNTIL:
-    {
-        // similar to capture and lookaround
-
-        Token guess = lexer_.get_next_token();
-        vector<unique_ptr<ExprAST>> cond;
 
-        switch (guess.get_token_value())
+    if (guess.get_token_value() != TokenValue::GROUP_START)
+    {
+        error_flag_ = true;
+        switch (token_value)
         {
-        case TokenValue::STRING:
-            cond.push_back(std::move(make_unique<CharacterExprAST>("(?:" + guess.get_value() + ")")));
-            lexer_.get_next_token();
+        case TokenValue::CAPTURE_AS:
+            error_msg_ = "capture should come with \"(...)\"";
             break;
-        case TokenValue::GROUP_START:
-            lexer_.get_next_token(); // after parsing "(", now the token become the inside part
-            do
-            {
-                cond.push_back(std::move(parse_token(lexer_.get_token())));
-                // after parsing, lexer_.get_token() become the one following.
-            } while (lexer_.get_token().get_token_value() != TokenValue::GROUP_END
-                && lexer_.get_token().get_token_type() != TokenType::END_OF_FILE
-                && lexer_.get_token().get_token_type() != TokenType::UNDEFINED);
-            // after parsing the sub query, current token should be ")"!!!
-
-            if (lexer_.get_token().get_token_value() != TokenValue::GROUP_END)
-            {
-                ptr = nullptr;
-                error_flag_ = true;
-                error_msg_ = "the until condition doesn't end correctly";
-                return ptr;
-            }
-
-            lexer_.get_next_token(); // now the current one is the one after ")"
+        case TokenValue::ANY_OF:
+            error_msg_ = "any of should come with \"(...)\"";
             break;
         default:
-            error_flag_ = true;
-            error_msg_ = "the until part doesn't have correct following statements";
-            return ptr;
-            //break;
+            error_msg_ = get_group_name(token_value) + " part doesn't have correct following statements";
+            break;
         }
-
-        ptr = make_unique<GroupExprAST>(std::move(cond));
-        return ptr;
-		//break;
+        return;
     }
-  
-    case TokenValue::ANY_OF:
-        // TODO
-        break;
-    default:
-        break;
+
+    if (frames.size() >= max_depth_)
+    {
+        error_flag_ = true;
+        error_msg_ = "the groups are nested deeper than " + std::to_string(max_depth_) + " levels";
+        return;
     }
-    return std::move(ptr);
+    frames.emplace_back(token_value, token.get_begin(), token.get_end());
+    lexer_.get_next_token(); // after parsing "(", now the token become the inside part
 }
 
-inline unique_ptr<LookAroundExprAST> Parser::parse_lookaround(const TokenValue &token_value)
+inline unique_ptr<ExprAST> Parser::close_group(Frame &frame)
 {
-    unique_ptr<LookAroundExprAST> ptr;
-
-    Token guess = lexer_.get_next_token();
-    vector<unique_ptr<ExprAST>> cond;
-
-    switch (guess.get_token_value())
+    // the current token is the ")" of the frame
+    unique_ptr<ExprAST> ptr = make_group(frame);
+    Token guess_as = lexer_.get_next_token(); // now the current one is the one after ")"
+    if (ptr != nullptr && frame.token_value == TokenValue::CAPTURE_AS && guess_as.get_token_value() == TokenValue::AS)
     {
-    case TokenValue::STRING:
-        cond.push_back(std::move(make_unique<CharacterExprAST>("(?:"+guess.get_value()+")")));
-        lexer_.get_next_token();
-        break;
-    case TokenValue::GROUP_START:
-        lexer_.get_next_token(); // after parsing "(", now the token become the inside part
-        do
+        Token name = lexer_.get_next_token();
+        if (name.get_token_value() == TokenValue::STRING)
         {
-            cond.push_back(std::move(parse_token(lexer_.get_token())));
-            // after parsing, lexer_.get_token() become the one following.
-        } while (lexer_.get_token().get_token_value() != TokenValue::GROUP_END
-            && lexer_.get_token().get_token_type() != TokenType::END_OF_FILE
-            && lexer_.get_token().get_token_type() != TokenType::UNDEFINED);
-        // after parsing the sub query, current token should be ")"!!!
-
-        if (lexer_.get_token().get_token_value() != TokenValue::GROUP_END)
+            // prefect name!
+            static_cast<GroupExprAST &>(*ptr).set_name(name.get_value());
+            lexer_.get_next_token();
+        }
+        else
         {
-            ptr = nullptr;
             error_flag_ = true;
-            error_msg_ = "the lookaround condition doesn't end correctly";
-            return ptr;
+            error_msg_ = "the name in \"capture (cond) as \"name\"\" is invalid";
+            return nullptr;
         }
-        
-        lexer_.get_next_token(); // now the current one is the one after ")"
-        break;
-    default:
-        error_flag_ = true;
-        error_msg_ = "the lookaround part doesn't have correct following statements";
-        return ptr;
-        //break;
     }
 
-    switch (token_value)
+    // right now the current token
+    // is the one after the whole
+    // capture (cond) [as "name"]
+    if (ptr != nullptr)
     {
+        ptr->set_span(frame.begin, std::max(frame.end, lexer_.get_prev_end()));
+    }
+    return ptr;
+}
+
+inline unique_ptr<ExprAST> Parser::make_group(Frame &frame)
+{
+    unique_ptr<ExprAST> ptr;
+    switch (frame.token_value)
+    {
+    case TokenValue::CAPTURE_AS:
+    case TokenValue::UNTIL:
+        ptr = make_unique<GroupExprAST>(std::move(frame.cond));
+        break;
+    case TokenValue::ANY_OF:
+        ptr = make_unique<AlternationExprAST>(std::move(frame.branches));
+        break;
     case TokenValue::IF_FOLLOWED_BY:
     case TokenValue::IF_NOT_FOLLOWED_BY:
     {
         string left_symbol =
-            (token_value == TokenValue::IF_FOLLOWED_BY ? "(?=" : "(?!");
+            (frame.token_value == TokenValue::IF_FOLLOWED_BY ? "(?=" : "(?!");
         ptr = make_unique<LookAroundExprAST>(
-            vector<string>{left_symbol, ")"}, std::move(cond));
-		break;
+            vector<string>{left_symbol, ")"}, std::move(frame.cond));
+        break;
     }
-
     case TokenValue::IF_ALREADY_HAD:
     case TokenValue::IF_NOT_ALREADY_HAD:
     {
         string left_symbol =
-            (token_value == TokenValue::IF_ALREADY_HAD ? "(?<=" : "(?<!");
+            (frame.token_value == TokenValue::IF_ALREADY_HAD ? "(?<=" : "(?<!");
         ptr = make_unique<LookAroundExprAST>(
-            vector<string>{left_symbol, ")"}, std::move(cond));
-		break;
+            vector<string>{left_symbol, ")"}, std::move(frame.cond));
+        break;
     }
- 
     default:
-        ptr = nullptr;
         error_flag_ = true;
         error_msg_ = "unknown lookaround-like statement";
-        break;
+        return nullptr;
     }
+    return ptr;
+}
 
-    return std::move(ptr);
+inline void Parser::add_ast(unique_ptr<ExprAST> ptr, vector<Frame> &frames, vector<unique_ptr<ExprAST>> &asts)
+{
+    if (frames.empty())
+    {
+        asts.push_back(std::move(ptr));
+        return;
+    }
+    Frame &frame = frames.back();
+    if (frame.token_value != TokenValue::ANY_OF)
+    {
+        frame.cond.push_back(std::move(ptr));
+        return;
+    }
+
+    // every ast is a branch of its own, and a quantifier stays with the
+    // branch before it, e.g. any of (digit once or more, letter)
+    if (ptr != nullptr && ptr->get_type() == ExprType::QUANTIFIER && !frame.branches.empty())
+    {
+        frame.branches.back().push_back(std::move(ptr));
+    }
+    else
+    {
+        frame.branches.push_back(vector<unique_ptr<ExprAST>>());
+        frame.branches.back().push_back(std::move(ptr));
+    }
 }
 
+inline string Parser::get_group_name(const TokenValue &token_value) const
+{
+    // for the error messages
+    switch (token_value)
+    {
+    case TokenValue::CAPTURE_AS:
+        return "capture";
+    case TokenValue::ANY_OF:
+        return "any of";
+    case TokenValue::UNTIL:
+        return "the until";
+    default:
+        return "the lookaround";
+    }
+}
 inline unique_ptr<FlagExprAST> Parser::parse_flag(const TokenValue &token_value)
 {
     unique_ptr<FlagExprAST> ptr;
@@ -588,6 +711,10 @@ inline unique_ptr<FlagExprAST> Parser::parse_flag(const TokenValue &token_value)
         ptr = make_unique<FlagExprAST>("U");
         lexer_.get_next_token();
         break;
+    case TokenValue::UNICODE:
+        ptr = make_unique<FlagExprAST>("u");
+        lexer_.get_next_token();
+        break;
     default:
         ptr = nullptr;
         error_flag_ = true;
@@ -628,6 +755,41 @@ inline unique_ptr<EOFExprAST> Parser::parse_eof(const TokenValue &token_value)
     return make_unique<EOFExprAST>();
 }
 
+inline string Parser::unescape(const string &val) const
+{
+    // the lexer keeps the backslashes inside the string literal,
+    // so \" has to become " before we match it byte by byte
+    string res;
+    for (size_t i = 0; i < val.length(); i++)
+    {
+        if (val[i] == '\\' && i + 1 < val.length())
+        {
+            i++;
+        }
+        res.push_back(val[i]);
+    }
+    return res;
+}
+
+inline bool Parser::parse_number(const Token &token, size_t &number)
+{
+    // the lexer guarantees there are only digits here
+    const string digits = token.get_value();
+    number = 0;
+    for (auto const &c : digits)
+    {
+        size_t digit = static_cast<size_t>(c - '0');
+        if (number > (QUANTIFIER_INFINITY - 1 - digit) / 10)
+        {
+            error_flag_ = true;
+            error_msg_ = "the number " + digits + " is too large";
+            return false;
+        }
+        number = number * 10 + digit;
+    }
+    return true;
+}
+
 }
 
 #endif // !SIMPLEREGEXLANGUAGE_PARSER_H_
@@ -0,0 +1,220 @@
+/*
+ * which part of a query the time of matching goes to
+ *
+ * the query is compiled as usual, but the matcher counts what happens at
+ * every instruction (see Profile in matcher.hpp), and every instruction
+ * knows the source it is compiled from (see Compiler::get_spans()). The
+ * counts of all the inputs searched are then added up per construct,
+ * i.e. per ast with its quantifier, like "anything never or more":
+ *
+ *        steps       %   failures      bytes  source
+ *       339389  100.0%      67226      50490  (the query)
+ *        93428   27.5%      32029      12606    any of (literally "ERROR", literally "WARN")
+ *       129864   38.3%       2794      31132    anything never or more
+ *        75268   22.2%      31363       6271    literally "took "
+ *         5044    1.5%       1040        481    capture (digit once or more) as "ms"
+ *         3523    1.0%       1040        481      digit once or more
+ *
+ * a construct counts what the instructions of its own did, and all of
+ * the constructs nested in it (the "letter" of "capture (letter)"). The
+ * instructions around the whole query, e.g. the final match, belong to
+ * the query itself.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_PROFILER_H_
+#define SIMPLEREGEXLANGUAGE_PROFILER_H_
+
+#include "spre/compiler.hpp"
+#include "spre/lexer.hpp"
+#include "spre/matcher.hpp"
+#include "spre/parser.hpp"
+#include "spre/program.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+struct ConstructProfile
+{
+    size_t begin; // the source of the construct, [begin, end)
+    size_t end;
+    size_t depth; // how many constructs it is nested in
+    uint64_t steps;
+    uint64_t failures;
+    uint64_t bytes;
+};
+
+class Profiler
+{
+  public:
+    explicit Profiler(const string &src, bool show_error = true);
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+    ~Profiler();
+    bool has_error() const;
+    void report_error() const;
+    bool search(const string &text, Match *match = nullptr);
+    bool search(const char *text, size_t len, Match *match = nullptr);
+    void clear();
+    vector<ConstructProfile> get_constructs() const;
+    string report() const;
+
+  private:
+    const string src_;
+    Program program_;
+    vector<std::pair<size_t, size_t>> spans_;
+    Profile profile_;
+    unique_ptr<Matcher> matcher_; // nullptr if the query could not be compiled
+    bool error_flag_;
+    string error_msg_;
+    const bool show_error_;
+};
+
+Profiler::Profiler(const string &src, bool show_error) : src_(src), error_flag_(false), show_error_(show_error)
+{
+    Lexer lexer(src, show_error);
+    Parser parser(lexer, show_error);
+    vector<unique_ptr<ExprAST>> asts = parser.parse();
+    Compiler compiler(show_error);
+    program_ = compiler.compile(asts);
+    if (lexer.has_error() || parser.has_error() || compiler.has_error())
+    {
+        error_flag_ = true;
+        error_msg_ = "the query could not be compiled for the native engine";
+        if (show_error_)
+        {
+            report_error();
+        }
+        return;
+    }
+    spans_ = compiler.get_spans();
+    matcher_.reset(new Matcher(program_));
+    matcher_->set_profile(&profile_);
+}
+
+Profiler::~Profiler()
+{
+}
+
+inline bool Profiler::has_error() const
+{
+    return error_flag_;
+}
+
+inline void Profiler::report_error() const
+{
+    if (!has_error())
+    {
+        return;
+    }
+    fprintf(stderr, "profiler error: ");
+    fprintf(stderr, "%s", error_msg_.c_str());
+    fprintf(stderr, "\n");
+}
+
+inline bool Profiler::search(const string &text, Match *match)
+{
+    return search(text.data(), text.length(), match);
+}
+
+inline bool Profiler::search(const char *text, size_t len, Match *match)
+{
+    // the counts add up over all the searches until clear()
+    if (matcher_ == nullptr)
+    {
+        return false;
+    }
+    return matcher_->search(text, len, match);
+}
+
+inline void Profiler::clear()
+{
+    std::fill(profile_.steps.begin(), profile_.steps.end(), 0);
+    std::fill(profile_.failures.begin(), profile_.failures.end(), 0);
+    std::fill(profile_.bytes.begin(), profile_.bytes.end(), 0);
+}
+
+inline vector<ConstructProfile> Profiler::get_constructs() const
+{
+    // in the order of the source, the outer constructs before the inner
+    // ones, the first one is the whole query
+    std::map<std::pair<size_t, size_t>, ConstructProfile> constructs;
+    auto key = [](size_t begin, size_t end) { return std::make_pair(begin, ~end); };
+    constructs[key(0, src_.size())] = ConstructProfile{0, src_.size(), 0, 0, 0, 0};
+    for (size_t pc = 0; pc < spans_.size() && pc < profile_.steps.size(); pc++)
+    {
+        size_t begin = spans_[pc].first == string::npos ? 0 : spans_[pc].first;
+        size_t end = spans_[pc].first == string::npos ? src_.size() : spans_[pc].second;
+        auto iter = constructs.find(key(begin, end));
+        if (iter == constructs.end())
+        {
+            iter = constructs.insert(std::make_pair(key(begin, end), ConstructProfile{begin, end, 0, 0, 0, 0})).first;
+        }
+        iter->second.steps += profile_.steps[pc];
+        iter->second.failures += profile_.failures[pc];
+        iter->second.bytes += profile_.bytes[pc];
+    }
+
+    vector<ConstructProfile> res;
+    for (auto const &iter : constructs)
+    {
+        res.push_back(iter.second);
+    }
+
+    // every construct adds its counts to all those it is nested in
+    vector<size_t> outer;
+    vector<ConstructProfile> own = res;
+    for (size_t i = 0; i < res.size(); i++)
+    {
+        while (!outer.empty() && res[outer.back()].end < res[i].end)
+        {
+            outer.pop_back();
+        }
+        res[i].depth = outer.size();
+        for (auto const &index : outer)
+        {
+            res[index].steps += own[i].steps;
+            res[index].failures += own[i].failures;
+            res[index].bytes += own[i].bytes;
+        }
+        outer.push_back(i);
+    }
+    return res;
+}
+
+inline string Profiler::report() const
+{
+    vector<ConstructProfile> constructs = get_constructs();
+    uint64_t total = constructs.empty() ? 0 : constructs[0].steps;
+
+    string res;
+    char line[128];
+    snprintf(line, sizeof(line), "%12s %7s %10s %10s  %s\n", "steps", "%", "failures", "bytes", "source");
+    res += line;
+    for (size_t i = 0; i < constructs.size(); i++)
+    {
+        const ConstructProfile &construct = constructs[i];
+        double percent = total == 0 ? 0 : 100.0 * static_cast<double>(construct.steps) / static_cast<double>(total);
+        snprintf(line, sizeof(line), "%12llu %6.1f%% %10llu %10llu  ", static_cast<unsigned long long>(construct.steps),
+                 percent, static_cast<unsigned long long>(construct.failures),
+                 static_cast<unsigned long long>(construct.bytes));
+        res += line;
+        res += string(2 * construct.depth, ' ');
+        string source = i == 0 ? "(the query)" : src_.substr(construct.begin, construct.end - construct.begin);
+        std::replace(source.begin(), source.end(), '\n', ' ');
+        res += source + "\n";
+    }
+    return res;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_PROFILER_H_
@@ -0,0 +1,544 @@
+/*
+ * the compiled form of a SRL query for the native engine
+ *
+ * a program is a flat list of instructions for a Pike VM (see
+ * https://swtch.com/~rsc/regexp/regexp2.html), plus the tables the
+ * instructions refer to (character sets, jump tables, capture names,
+ * counters).
+ * Jump targets are indices into the instruction list, so a program has
+ * no pointers inside and could be copied as it is.
+ *
+ * counted repetitions ("exactly x times", "between x and y times",
+ * "at least x times") are not expanded into x copies of the repeated
+ * part. They use a counter register instead:
+ *
+ *     COUNTER_INIT k
+ * L1: COUNTER_TEST k, min, max -> body L2, exit L3
+ * L2: ...the repeated part...
+ *     COUNTER_INCR k -> L1, exit L3
+ * L3:
+ *
+ * so the size of the program does not depend on the bounds at all. As in
+ * Perl, an iteration past min which consumed nothing ends the loop, so
+ * COUNTER_INCR knows the exit as well.
+ *
+ * besides the instructions, the compiler records what it knows about
+ * every possible match: the shortest and the longest length of it, and
+ * whether it has to start at the beginning ("begin with") or to stop at
+ * the end ("must end") of the input. The matcher uses these to reject
+ * an input without running it, or to run only a part of it.
+ *
+ * the branches of "any of" which are literals share their common prefixes
+ * (see literal_trie.hpp). Where such a prefix forks, a SWITCH reads one
+ * byte and jumps through a table of 256 entries, so the Pike VM keeps a
+ * single thread there instead of one for every branch.
+ *
+ * a query which must end at the end of the input also gets a reversed
+ * copy of itself, appended after the forward one and starting at
+ * get_reverse_start(). It reads the input backwards and has no captures,
+ * it only finds where the match starts.
+ *
+ * a lookaround is an ASSERT_LOOK, which only tells whether a look of the
+ * program holds at the current position, and continues at x if it does.
+ * The body of the look follows it, ending with a MATCH of its own, and
+ * is never run by the thread which reaches the ASSERT_LOOK: the matcher
+ * decides every look at every position of the input beforehand, in one
+ * pass per look (see matcher.hpp). The body of a lookahead is compiled
+ * backwards, so that this pass could read the input from the end, the
+ * one of a lookbehind reads forwards. A look is added after the looks
+ * inside its body, so deciding them in order always finds the inner ones
+ * ready.
+ *
+ * a program could be turned into an image (see image.hpp) and back. A
+ * program loaded from an image uses the tables of the image in place,
+ * so the image has to outlive it, and it could not be changed. The
+ * instructions and the looks are written as they are, their padding is
+ * a field of its own, always 0, so that the same program always gives
+ * the same image.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_PROGRAM_H_
+#define SIMPLEREGEXLANGUAGE_PROGRAM_H_
+
+#include "spre/buffer.hpp"
+#include "spre/charset.hpp"
+#include "spre/image.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+// the upper bound of a counter which has no upper bound
+const uint32_t PROGRAM_INFINITY = static_cast<uint32_t>(-1);
+
+// the longest length of a match which could be as long as it wants
+const size_t LENGTH_INFINITY = static_cast<size_t>(-1);
+
+enum class OpCode : uint8_t
+{
+    BYTE,         // consume the byte arg
+    SET,          // consume one byte inside the set arg
+    SWITCH,       // consume one byte, continue at its entry of the table arg
+    SPLIT,        // continue at x, and at y with a lower priority
+    JUMP,         // continue at x
+    SAVE,         // record the current position into the slot arg
+    ASSERT_BEGIN, // at the beginning (of a line if arg != 0)
+    ASSERT_END,   // at the end (of a line if arg != 0)
+    COUNTER_INIT, // reset the counter arg
+    COUNTER_TEST, // check the counter arg against [min, max], body x, exit y
+    COUNTER_INCR, // increase the counter arg, then continue at x, or exit at y after an empty iteration
+    ASSERT_LOOK,  // the look arg holds here, then continue at x
+    MATCH
+};
+
+struct Instruction
+{
+    Instruction(OpCode op = OpCode::MATCH, uint32_t arg = 0, uint32_t x = 0, uint32_t y = 0);
+
+    OpCode op;
+    bool greedy; // COUNTER_TEST only, whether to prefer one more iteration
+    uint16_t unused; // always 0, where the padding would be
+    uint32_t arg;
+    uint32_t x;
+    uint32_t y;
+    uint32_t min; // COUNTER_TEST and COUNTER_INCR only
+    uint32_t max;
+};
+
+Instruction::Instruction(OpCode op, uint32_t arg, uint32_t x, uint32_t y)
+    : op(op), greedy(true), unused(0), arg(arg), x(x), y(y), min(0), max(0)
+{
+}
+
+struct Look
+{
+    Look();
+
+    uint32_t start; // the pc of the body, which ends with a MATCH
+    bool ahead;     // a lookahead, whose body reads backwards
+    bool negate;    // holds where the body does not match
+    uint16_t unused; // always 0, where the padding would be
+};
+
+Look::Look() : start(0), ahead(false), negate(false), unused(0)
+{
+}
+
+// the instructions and the looks are written into an image as they are,
+// so they must not have a byte of padding, which nothing would set
+static_assert(sizeof(Instruction) == 24, "Instruction must not have padding");
+static_assert(sizeof(Look) == 8, "Look must not have padding");
+
+class Program
+{
+  public:
+    Program();
+    ~Program();
+    size_t size() const;
+    uint32_t emit(const Instruction &inst);
+    Instruction &at(size_t pc);
+    const Instruction &at(size_t pc) const;
+    uint32_t add_set(const CharSet &set);
+    const CharSet &get_set(size_t index) const;
+    uint32_t add_table(const vector<uint32_t> &table);
+    const uint32_t *get_table(size_t index) const;
+    uint32_t add_capture(const string &name);
+    size_t get_capture_count() const;
+    string get_capture_name(size_t index) const;
+    size_t get_capture_index(const string &name) const;
+    uint32_t add_counter();
+    size_t get_counter_count() const;
+    uint32_t add_look(const Look &look);
+    size_t get_look_count() const;
+    const Look &get_look(size_t index) const;
+    void set_length(size_t min_length, size_t max_length);
+    size_t get_min_length() const;
+    size_t get_max_length() const;
+    void set_anchors(bool anchored_begin, bool anchored_end);
+    bool is_anchored_begin() const;
+    bool is_anchored_end() const;
+    void set_reverse_start(uint32_t pc);
+    bool has_reverse() const;
+    uint32_t get_reverse_start() const;
+    void set_utf8(bool utf8);
+    bool is_utf8() const;
+    string to_image() const;
+    bool from_image(const char *image, size_t len);
+    bool is_sound() const;
+
+  private:
+    Buffer<Instruction> insts_;
+    Buffer<CharSet> sets_;
+    Buffer<uint32_t> tables_;        // 256 entries each, PROGRAM_INFINITY for no way
+    Buffer<char> capture_names_;     // all the names one after the other
+    Buffer<uint32_t> capture_ends_;  // where each name ends, the 0th one is the whole match
+    Buffer<Look> looks_;
+    size_t counter_count_;
+    size_t min_length_;
+    size_t max_length_;
+    bool anchored_begin_;
+    bool anchored_end_;
+    uint32_t reverse_start_; // 0 means there is no reversed program
+    bool utf8_;              // the input has to be valid UTF-8
+
+    enum Section
+    {
+        SECTION_META,
+        SECTION_INSTS,
+        SECTION_SETS,
+        SECTION_TABLES,
+        SECTION_CAPTURE_NAMES,
+        SECTION_CAPTURE_ENDS,
+        SECTION_LOOKS,
+        SECTION_COUNT
+    };
+};
+
+Program::Program() : counter_count_(0), min_length_(0), max_length_(LENGTH_INFINITY),
+                     anchored_begin_(false), anchored_end_(false), reverse_start_(0),
+                     utf8_(false)
+{
+    capture_ends_.push_back(0);
+}
+
+Program::~Program()
+{
+}
+
+inline size_t Program::size() const
+{
+    return insts_.size();
+}
+
+inline uint32_t Program::emit(const Instruction &inst)
+{
+    insts_.push_back(inst);
+    return static_cast<uint32_t>(insts_.size() - 1);
+}
+
+inline Instruction &Program::at(size_t pc)
+{
+    return insts_[pc];
+}
+
+inline const Instruction &Program::at(size_t pc) const
+{
+    return insts_[pc];
+}
+
+inline uint32_t Program::add_set(const CharSet &set)
+{
+    // the same set is usually used again and again, e.g. digit
+    for (size_t i = 0; i < sets_.size(); i++)
+    {
+        if (sets_[i] == set)
+        {
+            return static_cast<uint32_t>(i);
+        }
+    }
+    sets_.push_back(set);
+    return static_cast<uint32_t>(sets_.size() - 1);
+}
+
+inline const CharSet &Program::get_set(size_t index) const
+{
+    return sets_[index];
+}
+
+inline uint32_t Program::add_table(const vector<uint32_t> &table)
+{
+    // the table has one entry for every byte
+    tables_.append(table.data(), table.size());
+    return static_cast<uint32_t>(tables_.size() / 256 - 1);
+}
+
+inline const uint32_t *Program::get_table(size_t index) const
+{
+    return tables_.data() + index * 256;
+}
+
+inline uint32_t Program::add_capture(const string &name)
+{
+    capture_names_.append(name.data(), name.length());
+    capture_ends_.push_back(static_cast<uint32_t>(capture_names_.size()));
+    return static_cast<uint32_t>(capture_ends_.size() - 1);
+}
+
+inline size_t Program::get_capture_count() const
+{
+    return capture_ends_.size();
+}
+
+inline string Program::get_capture_name(size_t index) const
+{
+    size_t begin = index == 0 ? 0 : capture_ends_[index - 1];
+    if (begin == capture_ends_[index])
+    {
+        return "";
+    }
+    return string(capture_names_.data() + begin, capture_ends_[index] - begin);
+}
+
+inline size_t Program::get_capture_index(const string &name) const
+{
+    for (size_t i = 1; i < capture_ends_.size(); i++)
+    {
+        if (get_capture_name(i) == name)
+        {
+            return i;
+        }
+    }
+    return string::npos;
+}
+
+inline uint32_t Program::add_counter()
+{
+    counter_count_ += 1;
+    return static_cast<uint32_t>(counter_count_ - 1);
+}
+
+inline size_t Program::get_counter_count() const
+{
+    return counter_count_;
+}
+
+inline uint32_t Program::add_look(const Look &look)
+{
+    looks_.push_back(look);
+    return static_cast<uint32_t>(looks_.size() - 1);
+}
+
+inline size_t Program::get_look_count() const
+{
+    return looks_.size();
+}
+
+inline const Look &Program::get_look(size_t index) const
+{
+    return looks_[index];
+}
+
+inline void Program::set_length(size_t min_length, size_t max_length)
+{
+    min_length_ = min_length;
+    max_length_ = max_length;
+}
+
+inline size_t Program::get_min_length() const
+{
+    return min_length_;
+}
+
+inline size_t Program::get_max_length() const
+{
+    return max_length_;
+}
+
+inline void Program::set_anchors(bool anchored_begin, bool anchored_end)
+{
+    anchored_begin_ = anchored_begin;
+    anchored_end_ = anchored_end;
+}
+
+inline bool Program::is_anchored_begin() const
+{
+    return anchored_begin_;
+}
+
+inline bool Program::is_anchored_end() const
+{
+    return anchored_end_;
+}
+
+inline void Program::set_reverse_start(uint32_t pc)
+{
+    reverse_start_ = pc;
+}
+
+inline bool Program::has_reverse() const
+{
+    return reverse_start_ != 0;
+}
+
+inline uint32_t Program::get_reverse_start() const
+{
+    return reverse_start_;
+}
+
+inline void Program::set_utf8(bool utf8)
+{
+    utf8_ = utf8;
+}
+
+inline bool Program::is_utf8() const
+{
+    // compiled with the unicode flag, see utf8_automaton.hpp
+    return utf8_;
+}
+
+inline string Program::to_image() const
+{
+    const uint64_t meta[] = {counter_count_, min_length_, max_length_, anchored_begin_ ? 1u : 0u,
+                             anchored_end_ ? 1u : 0u, reverse_start_, utf8_ ? 1u : 0u};
+    ImageWriter writer(ImageKind::PROGRAM, SECTION_COUNT);
+    writer.write(SECTION_META, meta, sizeof(meta) / sizeof(meta[0]));
+    writer.write(SECTION_INSTS, insts_.data(), insts_.size());
+    writer.write(SECTION_SETS, sets_.data(), sets_.size());
+    writer.write(SECTION_TABLES, tables_.data(), tables_.size());
+    writer.write(SECTION_CAPTURE_NAMES, capture_names_.data(), capture_names_.size());
+    writer.write(SECTION_CAPTURE_ENDS, capture_ends_.data(), capture_ends_.size());
+    writer.write(SECTION_LOOKS, looks_.data(), looks_.size());
+    return writer.finish();
+}
+
+inline bool Program::from_image(const char *image, size_t len)
+{
+    // returns false, and leaves the program as it was, for a bad image
+    ImageReader reader(image, len, ImageKind::PROGRAM, SECTION_COUNT);
+    const uint64_t *meta = nullptr;
+    const Instruction *insts = nullptr;
+    const CharSet *sets = nullptr;
+    const uint32_t *tables = nullptr;
+    const char *names = nullptr;
+    const uint32_t *ends = nullptr;
+    const Look *looks = nullptr;
+    size_t meta_count = 0;
+    size_t insts_count = 0;
+    size_t sets_count = 0;
+    size_t tables_count = 0;
+    size_t names_count = 0;
+    size_t ends_count = 0;
+    size_t looks_count = 0;
+    if (!reader.read(SECTION_META, meta, meta_count) || meta_count != 7
+        || !reader.read(SECTION_INSTS, insts, insts_count) || !reader.read(SECTION_SETS, sets, sets_count)
+        || !reader.read(SECTION_TABLES, tables, tables_count)
+        || !reader.read(SECTION_CAPTURE_NAMES, names, names_count)
+        || !reader.read(SECTION_CAPTURE_ENDS, ends, ends_count)
+        || !reader.read(SECTION_LOOKS, looks, looks_count))
+    {
+        return false;
+    }
+
+    Program program;
+    program.insts_.view(insts, insts_count);
+    program.sets_.view(sets, sets_count);
+    program.tables_.view(tables, tables_count);
+    program.capture_names_.view(names, names_count);
+    program.capture_ends_.view(ends, ends_count);
+    program.looks_.view(looks, looks_count);
+    program.counter_count_ = static_cast<size_t>(meta[0]);
+    program.min_length_ = static_cast<size_t>(meta[1]);
+    program.max_length_ = static_cast<size_t>(meta[2]);
+    program.anchored_begin_ = meta[3] != 0;
+    program.anchored_end_ = meta[4] != 0;
+    program.reverse_start_ = static_cast<uint32_t>(meta[5]);
+    program.utf8_ = meta[6] != 0;
+    if (!program.is_sound())
+    {
+        return false;
+    }
+    *this = std::move(program);
+    return true;
+}
+
+inline bool Program::is_sound() const
+{
+    // whether the program could be run at all. An image is not trusted
+    // blindly, every index inside has to be in range, or a broken file
+    // would make the matcher read anywhere. The empty program of a query
+    // which could not be compiled is not sound either
+    uint32_t size = static_cast<uint32_t>(insts_.size());
+    if (insts_.empty() || insts_.size() >= PROGRAM_INFINITY || tables_.size() % 256 != 0
+        || capture_ends_.empty() || reverse_start_ >= size || counter_count_ > insts_.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < capture_ends_.size(); i++)
+    {
+        if (capture_ends_[i] > capture_names_.size() || (i > 0 && capture_ends_[i] < capture_ends_[i - 1]))
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < tables_.size(); i++)
+    {
+        if (tables_[i] != PROGRAM_INFINITY && tables_[i] >= size)
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < looks_.size(); i++)
+    {
+        unsigned char flags[2] = {0, 0};
+        memcpy(&flags[0], &looks_[i].ahead, 1);
+        memcpy(&flags[1], &looks_[i].negate, 1);
+        if (looks_[i].start >= size || flags[0] > 1 || flags[1] > 1)
+        {
+            return false;
+        }
+    }
+    for (size_t pc = 0; pc < insts_.size(); pc++)
+    {
+        const Instruction &inst = insts_[pc];
+        unsigned char greedy = 0;
+        memcpy(&greedy, &inst.greedy, 1); // even a bool could hold a bad byte
+        if (greedy > 1)
+        {
+            return false;
+        }
+        bool ok = true;
+        switch (inst.op)
+        {
+        case OpCode::BYTE:
+            ok = inst.arg < 256 && pc + 1 < size;
+            break;
+        case OpCode::SET:
+            ok = inst.arg < sets_.size() && pc + 1 < size;
+            break;
+        case OpCode::SWITCH:
+            ok = inst.arg < tables_.size() / 256;
+            break;
+        case OpCode::SPLIT:
+            ok = inst.x < size && inst.y < size;
+            break;
+        case OpCode::JUMP:
+            ok = inst.x < size;
+            break;
+        case OpCode::SAVE:
+            ok = inst.arg < 2 * capture_ends_.size() && pc + 1 < size;
+            break;
+        case OpCode::ASSERT_BEGIN:
+        case OpCode::ASSERT_END:
+        case OpCode::COUNTER_INIT:
+            ok = pc + 1 < size && (inst.op != OpCode::COUNTER_INIT || inst.arg < counter_count_);
+            break;
+        case OpCode::COUNTER_TEST:
+            ok = inst.arg < counter_count_ && inst.x < size && inst.y < size;
+            break;
+        case OpCode::COUNTER_INCR:
+            ok = inst.arg < counter_count_ && inst.x < size && inst.y < size;
+            break;
+        case OpCode::ASSERT_LOOK:
+            ok = inst.arg < looks_.size() && inst.x < size;
+            break;
+        case OpCode::MATCH:
+            break;
+        default:
+            ok = false;
+            break;
+        }
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_PROGRAM_H_
@@ -0,0 +1,462 @@
+/*
+ * many SRL queries (rules) matched against the same text at once
+ *
+ * every rule gets an id (the order it is added in), and match() reports
+ * the ids of all the rules which match somewhere in the text.
+ *
+ * rules made of nothing but literals, e.g. literally "ERROR", or any of
+ * (literally "GET", literally "PUT") literally " /", are not run one by
+ * one. They all go into a single Aho-Corasick automaton (a rule with
+ * "any of" as all the literals it could spell, up to MAX_RULE_LITERALS),
+ * which finds all of them in one pass over the text however many there
+ * are. The rules with the case insensitive flag go into a second
+ * automaton, which folds the case of ASCII letters. The other rules run
+ * on the native engine, one after the other.
+ * They are compiled with one FragmentCache (see fragment_cache.hpp), so a
+ * group or an any of repeated across the rules is only compiled once, and
+ * so is a fragment "name" of the FragmentLibrary the set is given.
+ *
+ * a compiled rule set could be saved as an image (see image.hpp) and
+ * loaded again without compiling anything, the automaton and the
+ * programs are used right inside the image. A loaded rule set keeps the
+ * file mapped for as long as it lives, and no rule could be added to it.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_RULE_SET_H_
+#define SIMPLEREGEXLANGUAGE_RULE_SET_H_
+
+#include "spre/aho_corasick.hpp"
+#include "spre/ast.hpp"
+#include "spre/compiler.hpp"
+#include "spre/fragment_library.hpp"
+#include "spre/image.hpp"
+#include "spre/instrument.hpp"
+#include "spre/lexer.hpp"
+#include "spre/matcher.hpp"
+#include "spre/parser.hpp"
+#include "spre/program.hpp"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+class RuleSet
+{
+  public:
+    explicit RuleSet(bool show_error = true, const FragmentLibrary *library = nullptr);
+    ~RuleSet();
+    bool has_error() const;
+    void report_error() const;
+    size_t add(const string &src);
+    template <typename Policy>
+    size_t add(const string &src, Policy &&policy);
+    void compile();
+    template <typename Policy>
+    void compile(Policy &&policy);
+    size_t size() const;
+    size_t get_literal_count() const;
+    vector<size_t> match(const string &text) const;
+    vector<size_t> match(const char *text, size_t len) const;
+    string to_image() const;
+    bool from_image(const char *image, size_t len);
+    bool save(const string &path) const;
+    bool load(const string &path);
+
+  private:
+    std::shared_ptr<const MappedFile> file_; // the loaded image, if any
+    bool loaded_;
+    AhoCorasick literals_;
+    AhoCorasick folded_literals_; // those of the case insensitive rules
+    size_t literal_count_;
+    vector<std::pair<size_t, Program>> programs_; // the rules which are not literals
+    FragmentCache fragments_;                     // shared by the programs of all the rules
+    const FragmentLibrary *library_;              // what fragment "name" refers to, if any
+    size_t size_;
+    bool compiled_;
+    mutable bool error_flag_;
+    mutable string error_msg_;
+    const bool show_error_;
+
+    bool get_literals(const vector<unique_ptr<ExprAST>> &asts, vector<string> &literals, bool &fold) const;
+    void set_error(const string &msg) const;
+
+    enum Section
+    {
+        SECTION_META,
+        SECTION_FOLDED_LITERALS = 1 + AhoCorasick::SECTION_COUNT,
+        SECTION_PROGRAM_INDEX = 1 + 2 * AhoCorasick::SECTION_COUNT, // after both automata
+        SECTION_PROGRAMS,
+        SECTION_COUNT
+    };
+
+    static const size_t MAX_RULE_LITERALS = 64;
+};
+
+RuleSet::RuleSet(bool show_error, const FragmentLibrary *library)
+    : loaded_(false), folded_literals_(true), literal_count_(0), library_(library), size_(0), compiled_(false), error_flag_(false),
+      show_error_(show_error)
+{
+}
+
+RuleSet::~RuleSet()
+{
+}
+
+inline bool RuleSet::has_error() const
+{
+    return error_flag_;
+}
+
+inline void RuleSet::report_error() const
+{
+    if (!has_error())
+    {
+        return;
+    }
+    fprintf(stderr, "rule set error: ");
+    fprintf(stderr, "%s", error_msg_.c_str());
+    fprintf(stderr, "\n");
+}
+
+inline size_t RuleSet::add(const string &src)
+{
+    return add(src, NoInstrumentation());
+}
+
+template <typename Policy>
+inline size_t RuleSet::add(const string &src, Policy &&policy)
+{
+    // returns the id of the rule, or string::npos if it is invalid. The
+    // policy gets the stats of compiling the rule (see instrument.hpp),
+    // unless it is invalid
+    if (loaded_)
+    {
+        set_error("no rule could be added to a loaded rule set");
+        return string::npos;
+    }
+
+    PhaseRecorder<Policy> recorder(policy);
+    recorder.lex(src);
+    Lexer lexer(src, show_error_);
+    Parser parser(lexer, show_error_);
+    if (library_ != nullptr)
+    {
+        parser.set_fragments(&library_->get_fragments());
+    }
+    vector<unique_ptr<ExprAST>> asts = parser.parse();
+    recorder.end_phase(CompilePhase::PARSING);
+    if (lexer.has_error() || parser.has_error())
+    {
+        set_error("the rule \"" + src + "\" could not be parsed");
+        return string::npos;
+    }
+    recorder.set_nodes(asts);
+
+    vector<string> literals;
+    bool fold = false;
+    if (get_literals(asts, literals, fold))
+    {
+        for (auto const &literal : literals)
+        {
+            (fold ? folded_literals_ : literals_).add(literal, size_);
+        }
+        literal_count_ += 1;
+    }
+    else
+    {
+        Compiler compiler(show_error_, &fragments_);
+        Program program = compiler.compile(asts);
+        if (compiler.has_error())
+        {
+            set_error("the rule \"" + src + "\" could not be compiled");
+            return string::npos;
+        }
+        recorder.set_instruction_count(program.size());
+        programs_.push_back(std::make_pair(size_, std::move(program)));
+    }
+    recorder.end_phase(CompilePhase::COMPILING);
+    recorder.finish();
+
+    compiled_ = false;
+    size_ += 1;
+    return size_ - 1;
+}
+
+inline void RuleSet::compile()
+{
+    compile(NoInstrumentation());
+}
+
+template <typename Policy>
+inline void RuleSet::compile(Policy &&policy)
+{
+    // the policy gets the time building the automaton took
+    if (loaded_)
+    {
+        // already compiled when it was saved
+        return;
+    }
+    PhaseRecorder<Policy> recorder(policy);
+    literals_.build();
+    folded_literals_.build();
+    recorder.end_phase(CompilePhase::BUILDING_AUTOMATON);
+    recorder.finish();
+    compiled_ = true;
+}
+
+inline size_t RuleSet::size() const
+{
+    return size_;
+}
+
+inline size_t RuleSet::get_literal_count() const
+{
+    return literal_count_;
+}
+
+inline vector<size_t> RuleSet::match(const string &text) const
+{
+    return match(text.data(), text.length());
+}
+
+inline vector<size_t> RuleSet::match(const char *text, size_t len) const
+{
+    // a rule set has to be compiled after the last add()
+    vector<size_t> res;
+    if (!compiled_)
+    {
+        return res;
+    }
+
+    vector<bool> found(size_, false);
+    if (!literals_.empty())
+    {
+        literals_.find(text, len, found);
+    }
+    if (!folded_literals_.empty())
+    {
+        folded_literals_.find(text, len, found);
+    }
+    for (auto const &iter : programs_)
+    {
+        Matcher matcher(iter.second);
+        found[iter.first] = matcher.search(text, len);
+    }
+
+    for (size_t i = 0; i < size_; i++)
+    {
+        if (found[i])
+        {
+            res.push_back(i);
+        }
+    }
+    return res;
+}
+
+inline string RuleSet::to_image() const
+{
+    // the programs are images of their own, one after the other inside
+    // SECTION_PROGRAMS, and SECTION_PROGRAM_INDEX tells where each one is
+    if (!compiled_)
+    {
+        set_error("a rule set has to be compiled before it is saved");
+        return "";
+    }
+
+    const uint64_t meta[] = {size_, literal_count_};
+    vector<uint64_t> index;
+    string programs;
+    for (auto const &iter : programs_)
+    {
+        string image = iter.second.to_image();
+        index.push_back(iter.first);
+        index.push_back(programs.size());
+        index.push_back(image.size());
+        programs.append(image);
+        programs.append((8 - programs.size() % 8) % 8, '\0');
+    }
+
+    ImageWriter writer(ImageKind::RULE_SET, SECTION_COUNT);
+    writer.write(SECTION_META, meta, sizeof(meta) / sizeof(meta[0]));
+    literals_.write(writer, SECTION_META + 1);
+    folded_literals_.write(writer, SECTION_FOLDED_LITERALS);
+    writer.write(SECTION_PROGRAM_INDEX, index.data(), index.size());
+    writer.write(SECTION_PROGRAMS, programs.data(), programs.size());
+    return writer.finish();
+}
+
+inline bool RuleSet::from_image(const char *image, size_t len)
+{
+    // the image has to outlive the rule set, and it replaces all the rules
+    ImageReader reader(image, len, ImageKind::RULE_SET, SECTION_COUNT);
+    const uint64_t *meta = nullptr;
+    const uint64_t *index = nullptr;
+    const char *programs = nullptr;
+    size_t meta_count = 0;
+    size_t index_count = 0;
+    size_t programs_len = 0;
+    AhoCorasick literals;
+    AhoCorasick folded_literals(true);
+    bool ok = reader.read(SECTION_META, meta, meta_count) && meta_count == 2
+              && reader.read(SECTION_PROGRAM_INDEX, index, index_count) && index_count % 3 == 0
+              && reader.read(SECTION_PROGRAMS, programs, programs_len)
+              && literals.read(reader, SECTION_META + 1, static_cast<size_t>(meta[0]))
+              && folded_literals.read(reader, SECTION_FOLDED_LITERALS, static_cast<size_t>(meta[0]));
+
+    vector<std::pair<size_t, Program>> loaded;
+    for (size_t i = 0; ok && i < index_count; i += 3)
+    {
+        Program program;
+        ok = index[i] < meta[0] && index[i + 1] <= programs_len && index[i + 2] <= programs_len - index[i + 1]
+             && program.from_image(programs + index[i + 1], static_cast<size_t>(index[i + 2]));
+        loaded.push_back(std::make_pair(static_cast<size_t>(index[i]), std::move(program)));
+    }
+    // every rule is either literals or a program, which also keeps the
+    // number of rules (and what match() allocates for them) in check
+    ok = ok && meta[1] <= literals.get_id_count() + folded_literals.get_id_count() && meta[0] == meta[1] + loaded.size();
+    if (!ok)
+    {
+        set_error("the image is not a valid rule set");
+        return false;
+    }
+
+    file_.reset();
+    loaded_ = true;
+    literals_ = std::move(literals);
+    folded_literals_ = std::move(folded_literals);
+    programs_ = std::move(loaded);
+    size_ = static_cast<size_t>(meta[0]);
+    literal_count_ = static_cast<size_t>(meta[1]);
+    compiled_ = true;
+    return true;
+}
+
+inline bool RuleSet::save(const string &path) const
+{
+    string image = to_image();
+    if (image.empty())
+    {
+        return false;
+    }
+    if (!write_image_file(path, image))
+    {
+        set_error("the image could not be written to " + path);
+        return false;
+    }
+    return true;
+}
+
+inline bool RuleSet::load(const string &path)
+{
+    std::shared_ptr<const MappedFile> file = std::make_shared<MappedFile>(path);
+    if (!file->is_open())
+    {
+        set_error("the image could not be read from " + path);
+        return false;
+    }
+    if (!from_image(file->data(), file->size()))
+    {
+        return false;
+    }
+    file_ = file;
+    return true;
+}
+
+inline bool RuleSet::get_literals(const vector<unique_ptr<ExprAST>> &asts, vector<string> &literals,
+                                  bool &fold) const
+{
+    // a rule is literals if it is a sequence of "literally" and of "any of"
+    // whose branches are literals themselves, which spells every
+    // combination of the branches. fold is set by the case insensitive
+    // flag, any other flag changes what the literals mean
+    literals.assign(1, "");
+    for (auto const &iter : asts)
+    {
+        if (iter == nullptr)
+        {
+            return false;
+        }
+        if (iter->get_type() == ExprType::END_OF_FILE)
+        {
+            continue;
+        }
+        if (iter->get_type() == ExprType::FLAG)
+        {
+            if (iter->get_val() != "i")
+            {
+                return false;
+            }
+            fold = true;
+            continue;
+        }
+
+        vector<string> choices;
+        if (iter->get_type() == ExprType::CHARACTER)
+        {
+            const CharacterExprAST &character = static_cast<const CharacterExprAST &>(*iter);
+            if (character.get_kind() != CharacterExprAST::Kind::LITERAL)
+            {
+                return false;
+            }
+            choices.push_back(character.get_literal());
+        }
+        else if (iter->get_type() == ExprType::ALTERNATION)
+        {
+            for (auto const &branch : static_cast<const AlternationExprAST &>(*iter).get_branches())
+            {
+                vector<string> branch_literals;
+                if (!get_literals(branch, branch_literals, fold))
+                {
+                    return false;
+                }
+                choices.insert(choices.end(), branch_literals.begin(), branch_literals.end());
+            }
+        }
+        else if (iter->get_type() == ExprType::FRAGMENT)
+        {
+            if (!get_literals(static_cast<const FragmentExprAST &>(*iter).get_asts(), choices, fold))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        if (literals.size() * choices.size() > MAX_RULE_LITERALS)
+        {
+            return false;
+        }
+        vector<string> next;
+        for (auto const &prefix : literals)
+        {
+            for (auto const &choice : choices)
+            {
+                next.push_back(prefix + choice);
+            }
+        }
+        literals.swap(next);
+    }
+    return true;
+}
+
+inline void RuleSet::set_error(const string &msg) const
+{
+    error_flag_ = true;
+    error_msg_ = msg;
+    if (show_error_)
+    {
+        report_error();
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_RULE_SET_H_
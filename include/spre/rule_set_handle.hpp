@@ -0,0 +1,325 @@
+/*
+ * a rule set which could be replaced while other threads match with it
+ *
+ * a writer compiles (or loads) a new rule set and publishes it, readers
+ * pick up whatever is current every time they start matching. Readers
+ * never take a lock and never wait for a writer, a version which is
+ * replaced is freed later, once no reader could still be using it.
+ *
+ * that is decided with epochs. Every reader owns a slot, and when it
+ * starts matching it writes the current epoch into the slot before it
+ * reads the current version, and it writes 0 there when it is done. A
+ * writer first swaps the version, then bumps the epoch, and remembers
+ * the old version with the epoch from before the bump. Any reader that
+ * could have read the old version wrote an epoch no later than that
+ * into its slot, so the old version is freed once every busy slot holds
+ * a later epoch:
+ *
+ *     reader                          writer
+ *     slot = epoch                    old = current.exchange(new)
+ *     rules = current                 retired = epoch++
+ *     ...match with rules...          free old once all busy slots > retired
+ *     slot = 0
+ *
+ * all of these are sequentially consistent atomics, which is what makes
+ * "wrote an epoch no later than that" hold. Writers are serialized with
+ * a mutex among themselves, the freeing happens on the writer's thread.
+ *
+ * a writer which fails sets the error while others may be checking it,
+ * so the flag is atomic and the message has a mutex of its own. Writers
+ * compile outside of writer_mutex_, and the error never waits for it.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_RULE_SET_HANDLE_H_
+#define SIMPLEREGEXLANGUAGE_RULE_SET_HANDLE_H_
+
+#include "spre/rule_set.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace spre
+{
+class RuleSetHandle
+{
+  public:
+    class Reader;
+
+    explicit RuleSetHandle(bool show_error = true);
+    RuleSetHandle(const RuleSetHandle &) = delete;
+    RuleSetHandle &operator=(const RuleSetHandle &) = delete;
+    ~RuleSetHandle();
+    bool has_error() const;
+    void report_error() const;
+    void publish(unique_ptr<RuleSet> rules);
+    bool publish(const vector<string> &srcs);
+    bool load(const string &path);
+    uint64_t get_version() const;
+    size_t reclaim();
+
+  private:
+    struct Slot
+    {
+        std::atomic<uint64_t> epoch; // 0 while the reader is not matching
+        std::atomic<bool> in_use;    // owned by a Reader
+        Slot *next;
+    };
+
+    std::atomic<const RuleSet *> current_;
+    std::atomic<uint64_t> epoch_;
+    std::atomic<uint64_t> version_;
+    std::atomic<Slot *> slots_; // a list which only grows, slots are reused
+    std::mutex writer_mutex_;
+    vector<std::pair<uint64_t, const RuleSet *>> retired_;
+    std::atomic<bool> error_flag_;
+    mutable std::mutex error_mutex_; // for error_msg_
+    string error_msg_;
+    const bool show_error_;
+
+    void set_error(const string &msg);
+    Slot *acquire_slot();
+    void release_slot(Slot *slot);
+    size_t reclaim_locked();
+};
+
+class RuleSetHandle::Reader
+{
+  public:
+    // a reader belongs to a single thread
+    explicit Reader(RuleSetHandle &handle);
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+    ~Reader();
+    const RuleSet *enter();
+    void leave();
+    vector<size_t> match(const string &text);
+    vector<size_t> match(const char *text, size_t len);
+
+  private:
+    RuleSetHandle &handle_;
+    Slot *slot_;
+    size_t depth_; // enter() could be nested
+};
+
+RuleSetHandle::RuleSetHandle(bool show_error)
+    : current_(nullptr), epoch_(1), version_(0), slots_(nullptr), error_flag_(false), show_error_(show_error)
+{
+}
+
+RuleSetHandle::~RuleSetHandle()
+{
+    // there must not be any reader left by now
+    for (auto const &iter : retired_)
+    {
+        delete iter.second;
+    }
+    delete current_.load();
+    Slot *slot = slots_.load();
+    while (slot != nullptr)
+    {
+        Slot *next = slot->next;
+        delete slot;
+        slot = next;
+    }
+}
+
+inline bool RuleSetHandle::has_error() const
+{
+    return error_flag_.load();
+}
+
+inline void RuleSetHandle::report_error() const
+{
+    if (!has_error())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(error_mutex_);
+    fprintf(stderr, "rule set handle error: ");
+    fprintf(stderr, "%s", error_msg_.c_str());
+    fprintf(stderr, "\n");
+}
+
+inline void RuleSetHandle::publish(unique_ptr<RuleSet> rules)
+{
+    // the rule set has to be compiled already
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    const RuleSet *old = current_.exchange(rules.release());
+    uint64_t retired = epoch_.fetch_add(1);
+    version_.fetch_add(1);
+    if (old != nullptr)
+    {
+        retired_.push_back(std::make_pair(retired, old));
+    }
+    reclaim_locked();
+}
+
+inline bool RuleSetHandle::publish(const vector<string> &srcs)
+{
+    // compiled on the calling thread, nothing is published on an error
+    unique_ptr<RuleSet> rules(new RuleSet(show_error_));
+    for (auto const &src : srcs)
+    {
+        rules->add(src);
+    }
+    if (rules->has_error())
+    {
+        set_error("the new rule set has errors, the current one is kept");
+        return false;
+    }
+    rules->compile();
+    publish(std::move(rules));
+    return true;
+}
+
+inline bool RuleSetHandle::load(const string &path)
+{
+    unique_ptr<RuleSet> rules(new RuleSet(show_error_));
+    if (!rules->load(path))
+    {
+        set_error("the image " + path + " could not be loaded, the current rule set is kept");
+        return false;
+    }
+    publish(std::move(rules));
+    return true;
+}
+
+inline uint64_t RuleSetHandle::get_version() const
+{
+    // how many times a rule set has been published
+    return version_.load();
+}
+
+inline size_t RuleSetHandle::reclaim()
+{
+    // returns how many old versions are still in use
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    return reclaim_locked();
+}
+
+inline void RuleSetHandle::set_error(const string &msg)
+{
+    {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        error_msg_ = msg;
+        error_flag_.store(true);
+    }
+    if (show_error_)
+    {
+        report_error();
+    }
+}
+
+inline RuleSetHandle::Slot *RuleSetHandle::acquire_slot()
+{
+    for (Slot *slot = slots_.load(); slot != nullptr; slot = slot->next)
+    {
+        bool expected = false;
+        if (!slot->in_use.load() && slot->in_use.compare_exchange_strong(expected, true))
+        {
+            return slot;
+        }
+    }
+
+    Slot *slot = new Slot;
+    slot->epoch.store(0);
+    slot->in_use.store(true);
+    slot->next = slots_.load();
+    while (!slots_.compare_exchange_weak(slot->next, slot))
+    {
+    }
+    return slot;
+}
+
+inline void RuleSetHandle::release_slot(Slot *slot)
+{
+    slot->epoch.store(0);
+    slot->in_use.store(false);
+}
+
+inline size_t RuleSetHandle::reclaim_locked()
+{
+    // the oldest epoch any reader is matching in right now
+    uint64_t oldest = UINT64_MAX;
+    for (Slot *slot = slots_.load(); slot != nullptr; slot = slot->next)
+    {
+        uint64_t epoch = slot->epoch.load();
+        if (epoch != 0)
+        {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+
+    size_t kept = 0;
+    for (auto const &iter : retired_)
+    {
+        if (iter.first < oldest)
+        {
+            delete iter.second;
+        }
+        else
+        {
+            retired_[kept++] = iter;
+        }
+    }
+    retired_.resize(kept);
+    return kept;
+}
+
+RuleSetHandle::Reader::Reader(RuleSetHandle &handle) : handle_(handle), slot_(handle.acquire_slot()), depth_(0)
+{
+}
+
+RuleSetHandle::Reader::~Reader()
+{
+    handle_.release_slot(slot_);
+}
+
+inline const RuleSet *RuleSetHandle::Reader::enter()
+{
+    // the rule set stays valid until the matching leave(), it is nullptr
+    // if nothing has been published yet
+    if (depth_++ == 0)
+    {
+        slot_->epoch.store(handle_.epoch_.load());
+    }
+    return handle_.current_.load();
+}
+
+inline void RuleSetHandle::Reader::leave()
+{
+    if (--depth_ == 0)
+    {
+        slot_->epoch.store(0);
+    }
+}
+
+inline vector<size_t> RuleSetHandle::Reader::match(const string &text)
+{
+    return match(text.data(), text.length());
+}
+
+inline vector<size_t> RuleSetHandle::Reader::match(const char *text, size_t len)
+{
+    vector<size_t> res;
+    const RuleSet *rules = enter();
+    if (rules != nullptr)
+    {
+        res = rules->match(text, len);
+    }
+    leave();
+    return res;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_RULE_SET_HANDLE_H_
@@ -1,10 +1,30 @@
 #ifndef SIMPLEREGEXLANGUAGE_SPRE_H_
 #define SIMPLEREGEXLANGUAGE_SPRE_H_
 
+#include <memory>
+#include <mutex>
+#include <regex>
 #include <string>
 #include "spre/lexer.hpp"
 #include "spre/parser.hpp"
 #include "spre/generator.hpp"
+#include "spre/compiler.hpp"
+#include "spre/fragment_library.hpp"
+#include "spre/matcher.hpp"
+#include "spre/ngram.hpp"
+#include "spre/trigram_index.hpp"
+#include "spre/dfa.hpp"
+#include "spre/jit.hpp"
+#include "spre/instrument.hpp"
+#include "spre/profiler.hpp"
+#include "spre/incremental.hpp"
+#include "spre/rule_set.hpp"
+#include "spre/rule_set_handle.hpp"
+#include "spre/extractor.hpp"
+
+#if __cplusplus >= 201703L && (!defined(__GLIBCXX__) || _GLIBCXX_RELEASE >= 11)
+#define SPRE_HAS_REGEX_MULTILINE 1 // std::regex::multiline
+#endif
 
 using std::string;
 
@@ -14,18 +34,91 @@ class SRL
 {
   public:
     explicit SRL(const string &src = "");
+    SRL(const string &src, const FragmentLibrary &library);
+    template <typename Policy, bool = std::decay<Policy>::type::enabled>
+    SRL(const string &src, Policy &&policy, const FragmentLibrary *library = nullptr);
     ~SRL();
     string get_pattern() const;
+    bool get_pattern(Dialect dialect, string &pattern, PatternOptions *options = nullptr) const;
+    std::shared_ptr<const std::regex> as_std_regex() const;
+    NGramQuery get_ngram_query() const;
+    bool is_compiled() const;
+    const Program &get_program() const;
+    bool match(const string &text, Match *match = nullptr, size_t step_limit = 0,
+               const std::atomic<bool> *cancel_flag = nullptr) const;
+    void match_batch(const vector<string> &texts, vector<uint64_t> &bitmap) const;
+    void match_batch(const char *const *texts, const size_t *lens, size_t count, uint64_t *bitmap) const;
   private:
+    struct StdRegexCache
+    {
+        std::once_flag once;
+        std::shared_ptr<const std::regex> regex; // nullptr if it could not be built
+    };
+
+    struct DfaCache
+    {
+        std::once_flag once;
+        std::mutex mutex; // held while matching, the DFA adds states as it goes
+        Program program;  // what the DFA runs, so that it does not depend on any one copy
+        unique_ptr<Dfa> dfa;
+    };
+
+    string src_;
+    const FragmentLibrary *library_; // has to outlive the SRL, if any
     string result_;
+    Program program_;
+    bool compiled_; // whether the native engine could run the query
+    std::shared_ptr<StdRegexCache> std_regex_; // shared by the copies of this SRL
+    std::shared_ptr<DfaCache> dfa_;            // as well
+
+    std::shared_ptr<const std::regex> build_std_regex() const;
+    DfaCache &get_dfa_cache() const;
 };
 
-SRL::SRL(const string &src)
+SRL::SRL(const string &src) : SRL(src, NoInstrumentation())
 {
+}
+
+SRL::SRL(const string &src, const FragmentLibrary &library) : SRL(src, NoInstrumentation(), &library)
+{
+}
+
+template <typename Policy, bool>
+SRL::SRL(const string &src, Policy &&policy, const FragmentLibrary *library)
+    : src_(src), library_(library), compiled_(false), std_regex_(std::make_shared<StdRegexCache>()),
+      dfa_(std::make_shared<DfaCache>())
+{
+    // policy.report() gets the compile stats, see instrument.hpp
+    PhaseRecorder<Policy> recorder(policy);
+    recorder.lex(src);
     Lexer lexer(src);
     Parser parser(lexer);
+    if (library_ != nullptr)
+    {
+        parser.set_fragments(&library_->get_fragments());
+    }
+    vector<unique_ptr<ExprAST>> asts = parser.parse();
+    recorder.end_phase(CompilePhase::PARSING);
+    recorder.set_nodes(asts);
     Generator generator(parser);
-    result_ = generator.generate();
+    result_ = generator.generate(asts);
+    recorder.end_phase(CompilePhase::GENERATING);
+
+    // not every query could run natively (e.g. raw), the pattern is
+    // still useful then, so the native errors are kept quiet here. The
+    // parts written more than once in the query are compiled once
+    FragmentCache fragments;
+    Compiler compiler(false, &fragments);
+    program_ = compiler.compile(asts);
+    compiled_ = !lexer.has_error() && !parser.has_error() && !compiler.has_error();
+    if (!compiled_)
+    {
+        // the asts of a query which did not parse are not the query
+        program_ = Program();
+    }
+    recorder.end_phase(CompilePhase::COMPILING);
+    recorder.set_instruction_count(program_.size());
+    recorder.finish();
 }
 
 SRL::~SRL()
@@ -37,6 +130,168 @@ inline string SRL::get_pattern() const
     return result_;
 }
 
+inline bool SRL::get_pattern(Dialect dialect, string &pattern, PatternOptions *options) const
+{
+    // the regex for a given library, and the options it has to be given,
+    // false if the query could not be written for that library
+    Lexer lexer(src_, false);
+    Parser parser(lexer, false);
+    if (library_ != nullptr)
+    {
+        parser.set_fragments(&library_->get_fragments());
+    }
+    vector<unique_ptr<ExprAST>> asts = parser.parse();
+    Generator generator(parser, true, dialect);
+    pattern = generator.generate(asts);
+    if (options != nullptr)
+    {
+        *options = generator.get_options();
+    }
+    return !lexer.has_error() && !parser.has_error() && !generator.has_error();
+}
+
+inline std::shared_ptr<const std::regex> SRL::as_std_regex() const
+{
+    // built the first time it is asked for, every later call (from any
+    // thread) gets the same regex back. nullptr if std::regex could not
+    // run the query, e.g. a lookbehind, or multi line before C++17
+    StdRegexCache &cache = *std_regex_;
+    std::call_once(cache.once, [this, &cache]() { cache.regex = build_std_regex(); });
+    return cache.regex;
+}
+
+inline NGramQuery SRL::get_ngram_query() const
+{
+    // the trigrams a text needs to be matched, for TrigramIndex::search.
+    // A query with errors needs none
+    Lexer lexer(src_, false);
+    Parser parser(lexer, false);
+    if (library_ != nullptr)
+    {
+        parser.set_fragments(&library_->get_fragments());
+    }
+    vector<unique_ptr<ExprAST>> asts = parser.parse();
+    if (lexer.has_error() || parser.has_error())
+    {
+        return NGramQuery(NGramQuery::Op::ALL);
+    }
+    NGramExtractor extractor;
+    return extractor.extract(asts);
+}
+
+inline std::shared_ptr<const std::regex> SRL::build_std_regex() const
+{
+    string pattern;
+    PatternOptions options;
+    if (!get_pattern(Dialect::ECMASCRIPT, pattern, &options))
+    {
+        return nullptr;
+    }
+
+    // the regex is used over and over, so it is worth optimizing for
+    // matching at the cost of an even slower construction
+    std::regex::flag_type flags = std::regex::ECMAScript | std::regex::optimize;
+    if (options.case_insensitive)
+    {
+        flags |= std::regex::icase;
+    }
+    if (options.multi_line)
+    {
+#ifdef SPRE_HAS_REGEX_MULTILINE
+        flags |= std::regex::multiline;
+#else
+        return nullptr;
+#endif
+    }
+    try
+    {
+        return std::make_shared<const std::regex>(pattern, flags);
+    }
+    catch (const std::regex_error &)
+    {
+        // e.g. raw text std::regex does not accept
+        return nullptr;
+    }
+}
+
+inline bool SRL::is_compiled() const
+{
+    return compiled_;
+}
+
+inline const Program &SRL::get_program() const
+{
+    return program_;
+}
+
+inline bool SRL::match(const string &text, Match *match, size_t step_limit,
+                       const std::atomic<bool> *cancel_flag) const
+{
+    if (!compiled_)
+    {
+        return false;
+    }
+    Matcher matcher(program_);
+    matcher.set_step_limit(step_limit);
+    matcher.set_cancel_flag(cancel_flag);
+    return matcher.search(text, match);
+}
+
+inline void SRL::match_batch(const vector<string> &texts, vector<uint64_t> &bitmap) const
+{
+    // bit i % 64 of bitmap[i / 64] tells whether texts[i] matches
+    bitmap.assign((texts.size() + 63) / 64, 0);
+    if (!compiled_)
+    {
+        return;
+    }
+    DfaCache &cache = get_dfa_cache();
+    std::unique_lock<std::mutex> lock(cache.mutex, std::try_to_lock);
+    if (lock.owns_lock())
+    {
+        cache.dfa->match_batch(texts, bitmap);
+        return;
+    }
+    Dfa dfa(program_);
+    dfa.match_batch(texts, bitmap);
+}
+
+inline void SRL::match_batch(const char *const *texts, const size_t *lens, size_t count, uint64_t *bitmap) const
+{
+    // bitmap has to hold (count + 63) / 64 words
+    if (!compiled_)
+    {
+        for (size_t i = 0; i < (count + 63) / 64; i++)
+        {
+            bitmap[i] = 0;
+        }
+        return;
+    }
+    DfaCache &cache = get_dfa_cache();
+    std::unique_lock<std::mutex> lock(cache.mutex, std::try_to_lock);
+    if (lock.owns_lock())
+    {
+        cache.dfa->match_batch(texts, lens, count, bitmap);
+        return;
+    }
+    Dfa dfa(program_);
+    dfa.match_batch(texts, lens, count, bitmap);
+}
+
+inline SRL::DfaCache &SRL::get_dfa_cache() const
+{
+    // the DFA keeps the states it has built for the next batches, so it
+    // is built once and shared like the std::regex. Only one thread at a
+    // time could match on it: a batch which finds it busy runs on a DFA
+    // of its own instead of waiting
+    DfaCache &cache = *dfa_;
+    std::call_once(cache.once, [this, &cache]() {
+        cache.program = program_;
+        cache.dfa = make_unique<Dfa>(cache.program);
+    });
+    return cache;
+}
+
 class Builder
 {
   public:
@@ -45,6 +45,7 @@ enum class TokenValue
     NO_WHITESPACE,
     TAB,
     RAW,
+    FRAGMENT,
     FROM,
     TO,
 
@@ -74,6 +75,7 @@ enum class TokenValue
     CASE_INSENSITIVE,
     MULTI_LINE,
     ALL_LAZY,
+    UNICODE,
 
     BEGIN_WITH,
     STARTS_WITH,
@@ -99,15 +101,20 @@ class Token
     string get_value() const;
     TokenType get_token_type() const;
     TokenValue get_token_value() const;
+    void set_span(size_t begin, size_t end);
+    size_t get_begin() const;
+    size_t get_end() const;
 
   private:
     string val_;
     TokenType token_type_;
     TokenValue token_value_;
+    size_t begin_; // where the token is in the source, [begin_, end_)
+    size_t end_;
 };
 
 Token::Token(string val, TokenType token_type, TokenValue token_value)
-    : val_(val), token_type_(token_type), token_value_(token_value)
+    : val_(val), token_type_(token_type), token_value_(token_value), begin_(0), end_(0)
 {
 }
 
@@ -129,6 +136,22 @@ inline TokenValue Token::get_token_value() const
 {
     return token_value_;
 }
+
+inline void Token::set_span(size_t begin, size_t end)
+{
+    begin_ = begin;
+    end_ = end;
+}
+
+inline size_t Token::get_begin() const
+{
+    return begin_;
+}
+
+inline size_t Token::get_end() const
+{
+    return end_;
+}
 }
 
 #endif // !SIMPLEREGEXLANGUAGE_TOKEN_H_
@@ -0,0 +1,218 @@
+/*
+ * the documents of a corpus by the trigrams they contain
+ *
+ * for searching a corpus which does not change, e.g. archived logs, with
+ * many queries. The index keeps, for every trigram, the ids of the
+ * documents which contain it (its posting list, sorted), and search()
+ * evaluates an NGramQuery (see ngram.hpp) on them: the lists of all of
+ * are intersected, those of any of are merged. What comes out are the
+ * candidates, the only documents a query could match, which still have to
+ * be matched one by one:
+ *
+ *     TrigramIndex index;
+ *     for (auto const &document : documents)
+ *     {
+ *         index.add(document);
+ *     }
+ *     SRL srl("literally \"ERROR\", anything never or more, literally \"timeout\"");
+ *     for (size_t id : index.search(srl.get_ngram_query()))
+ *     {
+ *         srl.match(documents[id]);
+ *     }
+ *
+ * the index does not keep the documents themselves.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_TRIGRAM_INDEX_H_
+#define SIMPLEREGEXLANGUAGE_TRIGRAM_INDEX_H_
+
+#include "spre/ngram.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+class TrigramIndex
+{
+  public:
+    TrigramIndex();
+    ~TrigramIndex();
+    size_t add(const string &document);
+    size_t add(const char *document, size_t len);
+    vector<size_t> search(const NGramQuery &query) const;
+    size_t size() const;
+    size_t get_trigram_count() const;
+    size_t get_posting_count() const;
+
+  private:
+    std::unordered_map<uint32_t, vector<uint32_t>> postings_; // by the trigram, see pack()
+    size_t size_;
+    size_t posting_count_;
+
+    vector<uint32_t> evaluate(const NGramQuery &query, bool &everything) const;
+    const vector<uint32_t> *find(const string &gram) const;
+    static uint32_t pack(const char *gram);
+};
+
+TrigramIndex::TrigramIndex() : size_(0), posting_count_(0)
+{
+}
+
+TrigramIndex::~TrigramIndex()
+{
+}
+
+inline size_t TrigramIndex::add(const string &document)
+{
+    return add(document.data(), document.length());
+}
+
+inline size_t TrigramIndex::add(const char *document, size_t len)
+{
+    // returns the id of the document, the order it is added in
+    uint32_t id = static_cast<uint32_t>(size_);
+    for (size_t i = 0; i + NGRAM_LENGTH <= len; i++)
+    {
+        vector<uint32_t> &posting = postings_[pack(document + i)];
+        // the ids only grow, so a document seen before is the last one
+        if (posting.empty() || posting.back() != id)
+        {
+            posting.push_back(id);
+            posting_count_++;
+        }
+    }
+    return size_++;
+}
+
+inline vector<size_t> TrigramIndex::search(const NGramQuery &query) const
+{
+    // the ids of the documents which satisfy the query, in order
+    bool everything = false;
+    vector<uint32_t> ids = evaluate(query, everything);
+    vector<size_t> res;
+    if (everything)
+    {
+        res.resize(size_);
+        for (size_t i = 0; i < size_; i++)
+        {
+            res[i] = i;
+        }
+        return res;
+    }
+    res.assign(ids.begin(), ids.end());
+    return res;
+}
+
+inline size_t TrigramIndex::size() const
+{
+    return size_;
+}
+
+inline size_t TrigramIndex::get_trigram_count() const
+{
+    // the distinct trigrams of all the documents
+    return postings_.size();
+}
+
+inline size_t TrigramIndex::get_posting_count() const
+{
+    // the lengths of all the posting lists added up
+    return posting_count_;
+}
+
+inline vector<uint32_t> TrigramIndex::evaluate(const NGramQuery &query, bool &everything) const
+{
+    // everything is set rather than listing all of the ids, when the
+    // query does not narrow anything down
+    bool all = query.get_op() == NGramQuery::Op::ALL;
+    everything = all;
+    vector<uint32_t> res;
+    vector<uint32_t> merged;
+
+    // the shortest lists are intersected first, so that the result only
+    // gets smaller
+    vector<const vector<uint32_t> *> lists;
+    vector<uint32_t> empty;
+    for (auto const &gram : query.get_grams())
+    {
+        const vector<uint32_t> *posting = find(gram);
+        lists.push_back(posting == nullptr ? &empty : posting);
+    }
+    vector<vector<uint32_t>> subs;
+    for (auto const &sub : query.get_subs())
+    {
+        bool sub_everything = false;
+        vector<uint32_t> ids = evaluate(sub, sub_everything);
+        if (!sub_everything)
+        {
+            subs.push_back(std::move(ids));
+        }
+        else if (!all)
+        {
+            // e.g. "abc" | (+), which any document satisfies
+            everything = true;
+            return vector<uint32_t>();
+        }
+    }
+    for (auto const &sub : subs)
+    {
+        lists.push_back(&sub);
+    }
+    if (all)
+    {
+        std::sort(lists.begin(), lists.end(),
+                  [](const vector<uint32_t> *a, const vector<uint32_t> *b) { return a->size() < b->size(); });
+    }
+
+    for (auto list : lists)
+    {
+        if (everything)
+        {
+            res = *list;
+            everything = false;
+            continue;
+        }
+        merged.clear();
+        if (all)
+        {
+            std::set_intersection(res.begin(), res.end(), list->begin(), list->end(), std::back_inserter(merged));
+        }
+        else
+        {
+            std::set_union(res.begin(), res.end(), list->begin(), list->end(), std::back_inserter(merged));
+        }
+        res.swap(merged);
+        if (all && res.empty())
+        {
+            break;
+        }
+    }
+    return res;
+}
+
+inline const vector<uint32_t> *TrigramIndex::find(const string &gram) const
+{
+    if (gram.length() != NGRAM_LENGTH)
+    {
+        return nullptr;
+    }
+    auto iter = postings_.find(pack(gram.data()));
+    return iter == postings_.end() ? nullptr : &iter->second;
+}
+
+inline uint32_t TrigramIndex::pack(const char *gram)
+{
+    return static_cast<uint32_t>(static_cast<unsigned char>(gram[0])) << 16
+           | static_cast<uint32_t>(static_cast<unsigned char>(gram[1])) << 8
+           | static_cast<uint32_t>(static_cast<unsigned char>(gram[2]));
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_TRIGRAM_INDEX_H_
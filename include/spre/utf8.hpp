@@ -0,0 +1,262 @@
+/*
+ * UTF-8, as bytes: validating it, and the byte sequences of code points
+ *
+ * with the unicode flag the native engine still reads bytes, there is no
+ * pass which decodes the text into code points. A class of code points
+ * is compiled into the byte sequences which encode them instead (see
+ * get_utf8_sequences()), e.g. U+0080 to U+07FF is
+ *
+ *     [C2-DF][80-BF]
+ *
+ * and a text has to be valid UTF-8 for a search to mean anything. Most
+ * texts are nothing but ASCII, or nearly so, so validating skips runs of
+ * ASCII 16 bytes at a time (with SSE2, 8 bytes at a time in a word
+ * elsewhere), and only checks the bytes around the others one by one.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_UTF8_H_
+#define SIMPLEREGEXLANGUAGE_UTF8_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SPRE_HAS_SSE2 1
+#endif
+
+using std::string;
+using std::vector;
+
+namespace spre
+{
+const uint32_t MAX_CODE_POINT = 0x10FFFF;
+
+// the bytes of a code point which is encoded, each one inside a range
+using Utf8Sequence = vector<std::pair<unsigned char, unsigned char>>;
+
+inline size_t find_non_ascii(const char *text, size_t len)
+{
+    // where the first byte >= 0x80 is, len if there is none
+    size_t pos = 0;
+#ifdef SPRE_HAS_SSE2
+    for (; pos + 16 <= len; pos += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + pos));
+        if (_mm_movemask_epi8(chunk) != 0) // the top bit of every byte
+        {
+            break;
+        }
+    }
+#else
+    for (; pos + 8 <= len; pos += 8)
+    {
+        uint64_t word;
+        memcpy(&word, text + pos, sizeof(word));
+        if ((word & UINT64_C(0x8080808080808080)) != 0)
+        {
+            break;
+        }
+    }
+#endif
+    while (pos < len && static_cast<unsigned char>(text[pos]) < 0x80)
+    {
+        pos++;
+    }
+    return pos;
+}
+
+inline size_t decode_utf8(const char *text, size_t len, uint32_t &code_point)
+{
+    // the length of the code point at text, 0 if it is not valid UTF-8:
+    // truncated, overlong, a surrogate or above U+10FFFF
+    if (len == 0)
+    {
+        return 0;
+    }
+    unsigned char lead = static_cast<unsigned char>(text[0]);
+    size_t length = 0;
+    uint32_t min = 0;
+    if (lead < 0x80)
+    {
+        code_point = lead;
+        return 1;
+    }
+    else if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        length = 2;
+        min = 0x80;
+        code_point = lead & 0x1F;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        length = 3;
+        min = 0x800;
+        code_point = lead & 0x0F;
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        length = 4;
+        min = 0x10000;
+        code_point = lead & 0x07;
+    }
+    else
+    {
+        return 0;
+    }
+    if (len < length)
+    {
+        return 0;
+    }
+    for (size_t i = 1; i < length; i++)
+    {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if ((c & 0xC0) != 0x80)
+        {
+            return 0;
+        }
+        code_point = (code_point << 6) | (c & 0x3F);
+    }
+    if (code_point < min || code_point > MAX_CODE_POINT || (code_point >= 0xD800 && code_point <= 0xDFFF))
+    {
+        return 0;
+    }
+    return length;
+}
+
+inline bool is_valid_utf8(const char *text, size_t len)
+{
+    size_t pos = 0;
+    while (true)
+    {
+        pos += find_non_ascii(text + pos, len - pos);
+        if (pos == len)
+        {
+            return true;
+        }
+        uint32_t code_point = 0;
+        size_t length = decode_utf8(text + pos, len - pos, code_point);
+        if (length == 0)
+        {
+            return false;
+        }
+        pos += length;
+    }
+}
+
+inline bool is_valid_utf8(const string &text)
+{
+    return is_valid_utf8(text.data(), text.length());
+}
+
+inline size_t get_utf8_length(uint32_t code_point)
+{
+    return code_point < 0x80 ? 1 : code_point < 0x800 ? 2 : code_point < 0x10000 ? 3 : 4;
+}
+
+inline void encode_utf8(uint32_t code_point, unsigned char *bytes)
+{
+    // get_utf8_length(code_point) bytes are written
+    switch (get_utf8_length(code_point))
+    {
+    case 1:
+        bytes[0] = static_cast<unsigned char>(code_point);
+        break;
+    case 2:
+        bytes[0] = static_cast<unsigned char>(0xC0 | (code_point >> 6));
+        bytes[1] = static_cast<unsigned char>(0x80 | (code_point & 0x3F));
+        break;
+    case 3:
+        bytes[0] = static_cast<unsigned char>(0xE0 | (code_point >> 12));
+        bytes[1] = static_cast<unsigned char>(0x80 | ((code_point >> 6) & 0x3F));
+        bytes[2] = static_cast<unsigned char>(0x80 | (code_point & 0x3F));
+        break;
+    default:
+        bytes[0] = static_cast<unsigned char>(0xF0 | (code_point >> 18));
+        bytes[1] = static_cast<unsigned char>(0x80 | ((code_point >> 12) & 0x3F));
+        bytes[2] = static_cast<unsigned char>(0x80 | ((code_point >> 6) & 0x3F));
+        bytes[3] = static_cast<unsigned char>(0x80 | (code_point & 0x3F));
+        break;
+    }
+}
+
+inline void get_utf8_sequences(uint32_t first, uint32_t last, vector<Utf8Sequence> &sequences)
+{
+    // appends the sequences which encode [first, last], leaving out the
+    // surrogates. A range is split until all of its code points have the
+    // same length, and every byte but the first could take any value in
+    // a range independently of the others
+    vector<std::pair<uint32_t, uint32_t>> stack;
+    stack.push_back(std::make_pair(first, std::min(last, MAX_CODE_POINT)));
+    while (!stack.empty())
+    {
+        uint32_t lo = stack.back().first;
+        uint32_t hi = stack.back().second;
+        stack.pop_back();
+        if (lo > hi)
+        {
+            continue;
+        }
+        if (lo <= 0xDFFF && hi >= 0xD800)
+        {
+            // the part after is pushed first, so the sequences come in order
+            stack.push_back(std::make_pair(0xE000, hi));
+            stack.push_back(std::make_pair(lo, 0xD7FF));
+            continue;
+        }
+        bool split = false;
+        const uint32_t bounds[] = {0x7F, 0x7FF, 0xFFFF};
+        for (auto const bound : bounds)
+        {
+            if (lo <= bound && hi > bound)
+            {
+                stack.push_back(std::make_pair(bound + 1, hi));
+                stack.push_back(std::make_pair(lo, bound));
+                split = true;
+                break;
+            }
+        }
+        for (size_t i = 1; i < get_utf8_length(lo) && !split; i++)
+        {
+            // the low 6 * i bits have to cover everything for the bytes
+            // before them to be a range
+            uint32_t mask = (uint32_t(1) << (6 * i)) - 1;
+            if ((lo & ~mask) != (hi & ~mask))
+            {
+                if ((lo & mask) != 0)
+                {
+                    stack.push_back(std::make_pair((lo | mask) + 1, hi));
+                    stack.push_back(std::make_pair(lo, lo | mask));
+                    split = true;
+                }
+                else if ((hi & mask) != mask)
+                {
+                    stack.push_back(std::make_pair(hi & ~mask, hi));
+                    stack.push_back(std::make_pair(lo, (hi & ~mask) - 1));
+                    split = true;
+                }
+            }
+        }
+        if (split)
+        {
+            continue;
+        }
+
+        unsigned char lo_bytes[4];
+        unsigned char hi_bytes[4];
+        encode_utf8(lo, lo_bytes);
+        encode_utf8(hi, hi_bytes);
+        Utf8Sequence sequence;
+        for (size_t i = 0; i < get_utf8_length(lo); i++)
+        {
+            sequence.push_back(std::make_pair(lo_bytes[i], hi_bytes[i]));
+        }
+        sequences.push_back(sequence);
+    }
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_UTF8_H_
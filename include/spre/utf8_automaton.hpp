@@ -0,0 +1,173 @@
+/*
+ * a class of code points, compiled into the bytes which encode them
+ *
+ * with the unicode flag, letter is every code point of Ll rather than
+ * [a-z], yet the native engine still reads one byte at a time. The code
+ * points are turned into their UTF-8 sequences (see utf8.hpp) and the
+ * sequences into a small automaton of SETs and SWITCHes: the first byte
+ * is read by a SWITCH, which sends an ASCII byte straight to the end of
+ * the class, and the lead of a longer sequence to the continuation bytes
+ * it could be followed by. Nodes which are left with the same sequences
+ * to read are emitted only once, e.g. the last byte of all of [E1-EC]
+ * [80-BF][80-BF] is the same code.
+ *
+ * in reverse mode (see compiler.hpp) every sequence is read back to
+ * front, the continuation bytes first and the lead last.
+ */
+
+#ifndef SIMPLEREGEXLANGUAGE_UTF8_AUTOMATON_H_
+#define SIMPLEREGEXLANGUAGE_UTF8_AUTOMATON_H_
+
+#include "spre/charset.hpp"
+#include "spre/program.hpp"
+#include "spre/unicode.hpp"
+#include "spre/utf8.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+using std::vector;
+
+namespace spre
+{
+class Utf8Automaton
+{
+  public:
+    Utf8Automaton(const CodePointRanges &ranges, bool reverse);
+    ~Utf8Automaton();
+    bool empty() const;
+    uint32_t compile(Program &program, vector<uint32_t> &exits);
+
+  private:
+    vector<Utf8Sequence> sequences_;
+    std::map<vector<Utf8Sequence>, uint32_t> emitted_; // by the sequences left to read
+
+    uint32_t emit_node(const vector<Utf8Sequence> &sequences, Program &program, vector<uint32_t> &exits);
+};
+
+Utf8Automaton::Utf8Automaton(const CodePointRanges &ranges, bool reverse)
+{
+    for (auto const &range : ranges)
+    {
+        get_utf8_sequences(range.first, range.second, sequences_);
+    }
+    if (reverse)
+    {
+        for (auto &sequence : sequences_)
+        {
+            std::reverse(sequence.begin(), sequence.end());
+        }
+    }
+}
+
+Utf8Automaton::~Utf8Automaton()
+{
+}
+
+inline bool Utf8Automaton::empty() const
+{
+    return sequences_.empty();
+}
+
+inline uint32_t Utf8Automaton::compile(Program &program, vector<uint32_t> &exits)
+{
+    // returns the entry of the code, every pc left in exits is a JUMP
+    // whose target is where the matching continues after the class
+    emitted_.clear();
+    return emit_node(sequences_, program, exits);
+}
+
+inline uint32_t Utf8Automaton::emit_node(const vector<Utf8Sequence> &sequences, Program &program,
+                                         vector<uint32_t> &exits)
+{
+    auto found = emitted_.find(sequences);
+    if (found != emitted_.end())
+    {
+        return found->second;
+    }
+    uint32_t entry = static_cast<uint32_t>(program.size());
+    emitted_[sequences] = entry;
+
+    // valid UTF-8 is a prefix code, so a node either has read a whole
+    // sequence or none of its sequences is done yet
+    if (sequences.empty() || sequences[0].empty())
+    {
+        exits.push_back(program.emit(Instruction(OpCode::JUMP)));
+        return entry;
+    }
+
+    // the bytes where the first ranges start or stop cut 0-255 into
+    // segments, inside of which every byte leads to the same sequences
+    vector<unsigned> cuts;
+    for (auto const &sequence : sequences)
+    {
+        cuts.push_back(sequence[0].first);
+        cuts.push_back(static_cast<unsigned>(sequence[0].second) + 1);
+    }
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+    vector<std::pair<CharSet, vector<Utf8Sequence>>> children;
+    for (size_t i = 0; i + 1 < cuts.size(); i++)
+    {
+        vector<Utf8Sequence> rests;
+        for (auto const &sequence : sequences)
+        {
+            if (sequence[0].first <= cuts[i] && cuts[i] <= sequence[0].second)
+            {
+                rests.push_back(Utf8Sequence(sequence.begin() + 1, sequence.end()));
+            }
+        }
+        if (rests.empty())
+        {
+            continue;
+        }
+        std::sort(rests.begin(), rests.end());
+        rests.erase(std::unique(rests.begin(), rests.end()), rests.end());
+
+        auto iter = std::find_if(children.begin(), children.end(),
+                                 [&rests](const std::pair<CharSet, vector<Utf8Sequence>> &child) {
+                                     return child.second == rests;
+                                 });
+        if (iter == children.end())
+        {
+            children.push_back(std::make_pair(CharSet(), rests));
+            iter = children.end() - 1;
+        }
+        iter->first.add_range(static_cast<unsigned char>(cuts[i]), static_cast<unsigned char>(cuts[i + 1] - 1));
+    }
+
+    if (children.size() == 1)
+    {
+        program.emit(Instruction(OpCode::SET, program.add_set(children[0].first)));
+        uint32_t next = static_cast<uint32_t>(program.size());
+        uint32_t target = emit_node(children[0].second, program, exits);
+        if (target != next)
+        {
+            // already emitted somewhere else, nothing new follows the SET
+            program.emit(Instruction(OpCode::JUMP, 0, target));
+        }
+        return entry;
+    }
+
+    // the table is added after the children are emitted, as in literal_trie.hpp
+    uint32_t pc_switch = program.emit(Instruction(OpCode::SWITCH));
+    vector<uint32_t> table(256, PROGRAM_INFINITY);
+    for (auto const &child : children)
+    {
+        uint32_t target = emit_node(child.second, program, exits);
+        for (unsigned c = 0; c < 256; c++)
+        {
+            if (child.first.has(static_cast<unsigned char>(c)))
+            {
+                table[c] = target;
+            }
+        }
+    }
+    program.at(pc_switch).arg = program.add_table(table);
+    return entry;
+}
+}
+
+#endif // !SIMPLEREGEXLANGUAGE_UTF8_AUTOMATON_H_
@@ -0,0 +1,542 @@
+/*
+ * checks of the native engine and of the parts around it, run by ctest
+ *
+ * expect_span() and expect_groups() run a query on every engine which
+ * could match it (see run_all()), and compare the span and the groups
+ * with those Perl and Python's re give. Nothing but the library is
+ * needed: a failed check prints where it is, and the exit status is the
+ * number of them.
+ */
+
+#include "spre/spre.hpp"
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace spre;
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace
+{
+int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+void check(bool ok, const char *what, int line)
+{
+    if (!ok)
+    {
+        std::cerr << "engine_test.cpp:" << line << ": failed: " << what << std::endl;
+        failures++;
+    }
+}
+
+// the groups of a match, from 1, (-1, -1) for a group which did not take part
+typedef vector<pair<long, long>> Groups;
+
+Groups get_groups(const Match &match)
+{
+    Groups groups;
+    for (size_t i = 1; i < match.get_group_count(); i++)
+    {
+        if (match.has_group(i))
+        {
+            groups.emplace_back(match.get_group_begin(i), match.get_group_end(i));
+        }
+        else
+        {
+            groups.emplace_back(-1, -1);
+        }
+    }
+    return groups;
+}
+
+bool run_all(const string &src, const string &text, long begin, long end, Match &match)
+{
+    // (-1, -1) for no match at all
+    SRL srl(src);
+    if (!srl.is_compiled())
+    {
+        std::cerr << "not compiled: " << src << std::endl;
+        return false;
+    }
+    bool expected = begin >= 0;
+    bool ok = srl.match(text, &match) == expected;
+    if (expected)
+    {
+        ok = ok && static_cast<long>(match.get_begin()) == begin && static_cast<long>(match.get_end()) == end;
+    }
+
+    // the program loaded back from its image gives the same match
+    Program loaded;
+    string image = srl.get_program().to_image();
+    Match loaded_match;
+    ok = ok && loaded.from_image(image.data(), image.size());
+    ok = ok && Matcher(loaded).search(text, &loaded_match) == expected;
+    ok = ok && (!expected || (loaded_match.get_begin() == match.get_begin() &&
+                              loaded_match.get_end() == match.get_end() &&
+                              get_groups(loaded_match) == get_groups(match)));
+
+    // the DFA only tells whether there is a match
+    Dfa dfa(srl.get_program());
+    ok = ok && dfa.match(text) == expected;
+    vector<uint64_t> bitmap;
+    srl.match_batch({text}, bitmap);
+    ok = ok && (bitmap[0] & 1) == (expected ? 1u : 0u);
+    Jit jit(srl.get_program());
+    ok = ok && jit.match(text) == expected;
+    if (!ok)
+    {
+        std::cerr << "engines: " << src << " on \"" << text << "\"" << std::endl;
+    }
+    return ok;
+}
+
+bool expect_span(const string &src, const string &text, long begin, long end)
+{
+    Match match;
+    return run_all(src, text, begin, end, match);
+}
+
+bool expect_groups(const string &src, const string &text, long begin, long end, const Groups &groups)
+{
+    Match match;
+    if (!run_all(src, text, begin, end, match))
+    {
+        return false;
+    }
+    return get_groups(match) == groups;
+}
+
+void test_counters()
+{
+    CHECK(expect_span("digit between 2 and 3 times", "a12345", 1, 4));
+    CHECK(expect_span("digit exactly 3 times", "12a34", -1, -1));
+    CHECK(expect_span("begin with digit at least 2 times, must end", "12345", 0, 5));
+    CHECK(expect_span("literally \"a\", digit between 1000 and 1000 times", "a12", -1, -1));
+    // the size of the program does not depend on the bounds
+    CHECK(SRL("digit between 1000 and 4000 times").get_program().size() < 16);
+    CHECK(expect_groups("capture (digit) between 2 and 3 times", "1234", 0, 3, {{2, 3}}));
+}
+
+void test_empty_iterations()
+{
+    // an iteration which matched nothing ends the loop, as in Perl
+    CHECK(expect_span("any of (digit optional, literally \"a\") never or more", "aa", 0, 0));
+    CHECK(expect_span("any of (digit optional, literally \"a\") once or more", "aa", 0, 0));
+    CHECK(expect_span("any of (digit optional, literally \"a\") between 1 and 3 times", "aa", 0, 0));
+    CHECK(expect_span("any of (digit optional) between 2 and 4 times", "1a", 0, 1));
+    CHECK(expect_span("any of (literally \"a\", digit optional) never or more", "aa1b", 0, 3));
+    CHECK(expect_span("any of (letter never or more) never or more, digit", "ab1", 0, 3));
+    CHECK(expect_groups("any of (capture (digit optional)) between 2 and 3 times", "1a", 0, 1, {{1, 1}}));
+}
+
+void test_failed_compiles()
+{
+    // what was compiled before the error is not run in place of the query
+    SRL srl("raw \"a|b\"");
+    CHECK(!srl.is_compiled() && srl.get_program().size() == 0);
+    CHECK(!Matcher(srl.get_program()).search("a b"));
+    Dfa dfa(srl.get_program());
+    CHECK(!dfa.match("a b") && !dfa.build());
+    Jit jit(srl.get_program());
+    CHECK(!jit.is_native() && !jit.match("a b"));
+    Extractor extractor(srl.get_program(), 2, 1024, false);
+    CHECK(extractor.has_error() && !extractor.add("a b") && extractor.get_row_count() == 0);
+    SRL reversed("literally \"a\", digit between 3 and 2 times");
+    CHECK(!reversed.is_compiled() && reversed.get_program().size() == 0);
+}
+
+void test_limits()
+{
+    SRL srl("letter never or more, literally \"!\"");
+    string text(1000, 'a');
+    Match match;
+    CHECK(!srl.match(text, &match, 10));
+    CHECK(match.get_result() == MatchResult::STEP_LIMIT_EXCEEDED);
+    std::atomic<bool> cancel(true);
+    CHECK(!srl.match(text, &match, 0, &cancel));
+    CHECK(match.get_result() == MatchResult::CANCELLED);
+    CHECK(!srl.match(text, &match));
+    CHECK(match.get_result() == MatchResult::NOT_MATCHED);
+}
+
+void test_length_bounds()
+{
+    CHECK(expect_span("begin with literally \"ab\"", "xab", -1, -1));
+    CHECK(expect_span("starts with literally \"ab\"", "abab", 0, 2));
+    CHECK(expect_span("digit exactly 4 times", "123", -1, -1));
+    CHECK(expect_span("digit exactly 4 times, must end", "12345a", -1, -1));
+    SRL srl("literally \"ab\", digit between 2 and 3 times");
+    CHECK(srl.get_program().get_min_length() == 4 && srl.get_program().get_max_length() == 5);
+}
+
+void test_reverse()
+{
+    // compiled backwards, the match is found from the end
+    CHECK(expect_span("literally \".txt\" must end", "a.txt.txt", 5, 9));
+    CHECK(expect_span("literally \".txt\" must end", "a.txt.", -1, -1));
+    CHECK(expect_groups("capture (letter once or more), literally \".txt\" must end", "1 ab.txt", 2, 8, {{2, 4}}));
+    CHECK(expect_span("digit once or more, literally \"x\" must end", "1 23x", 2, 5));
+}
+
+void test_rule_sets()
+{
+    RuleSet rules(false);
+    rules.add("literally \"ERROR\"");
+    rules.add("literally \"WARN\"");
+    rules.add("literally \"took \", digit once or more");
+    rules.add("begin with literally \"GET\"");
+    rules.compile();
+    CHECK(!rules.has_error());
+    CHECK(rules.size() == 4 && rules.get_literal_count() == 2);
+    CHECK(rules.match("WARN: took 120ms") == vector<size_t>({1, 2}));
+    CHECK(rules.match("GET / ERROR") == vector<size_t>({0, 3}));
+    CHECK(rules.match("nothing").empty());
+}
+
+void test_any_of()
+{
+    // the branches are tried in the order they are written
+    CHECK(expect_span("any of (literally \"GET\", literally \"GEX\")", "a GEX", 2, 5));
+    CHECK(expect_span("any of (literally \"a\", literally \"ab\")", "ab", 0, 1));
+    CHECK(expect_span("any of (literally \"ab\", literally \"a\", literally \"abc\")", "abc", 0, 2));
+    CHECK(expect_span("any of (literally \"put\", literally \"post\", literally \"get\") must end", "a post", 2, 6));
+}
+
+void test_images()
+{
+    // a corrupted image is refused rather than run
+    SRL srl("capture (digit once or more) as \"n\", literally \"x\"");
+    string image = srl.get_program().to_image();
+    Program loaded;
+    CHECK(loaded.from_image(image.data(), image.size()));
+    CHECK(loaded.get_capture_index("n") == 1);
+    CHECK(!loaded.from_image(image.data(), image.size() / 2));
+    // nothing uninitialized is written, the same query gives the same bytes
+    CHECK(SRL("capture (digit once or more) as \"n\", literally \"x\"").get_program().to_image() == image);
+    string look = "digit, if followed by (letter)";
+    CHECK(SRL(look).get_program().get_look_count() == 1);
+    CHECK(SRL(look).get_program().to_image() == SRL(look).get_program().to_image());
+
+    RuleSet rules(false);
+    rules.add("literally \"ERROR\"");
+    rules.add("literally \"WARN\"");
+    rules.add("literally \"took \", digit once or more");
+    rules.compile();
+    string rules_image = rules.to_image();
+    RuleSet loaded_rules(false);
+    CHECK(loaded_rules.from_image(rules_image.data(), rules_image.size()));
+    CHECK(loaded_rules.match("WARN: took 120ms") == vector<size_t>({1, 2}));
+}
+
+void test_handle()
+{
+    RuleSetHandle handle(false);
+    CHECK(handle.publish({"literally \"ERROR\"", "literally \"WARN\""}));
+    RuleSetHandle::Reader reader(handle);
+    CHECK(reader.match("a WARN") == vector<size_t>({1}));
+    CHECK(handle.publish({"literally \"WARN\""}));
+    CHECK(reader.match("a WARN") == vector<size_t>({0}));
+    CHECK(handle.get_version() == 2);
+    // a rule set which does not compile is not published
+    CHECK(!handle.has_error());
+    CHECK(!handle.publish({"raw \"a|b\""}) && handle.has_error() && handle.get_version() == 2);
+    CHECK(reader.match("a WARN") == vector<size_t>({0}));
+}
+
+void test_batches()
+{
+    SRL date("begin with digit exactly 4 times, literally \"-\", digit exactly 2 times, must end");
+    vector<string> fields = {"2017-05", "17-05", "2017-12"};
+    vector<uint64_t> bitmap;
+    date.match_batch(fields, bitmap);
+    CHECK(bitmap.size() == 1 && bitmap[0] == 5);
+
+    vector<string> many;
+    for (size_t i = 0; i < 130; i++)
+    {
+        many.push_back(i % 3 == 0 ? "2017-05" : "2017-5");
+    }
+    date.match_batch(many, bitmap);
+    CHECK(bitmap.size() == 3);
+    size_t count = 0;
+    for (size_t i = 0; i < many.size(); i++)
+    {
+        count += (bitmap[i / 64] >> (i % 64)) & 1;
+        CHECK(((bitmap[i / 64] >> (i % 64)) & 1) == (i % 3 == 0 ? 1u : 0u));
+    }
+    CHECK(count == 44);
+
+    // the same bits again, from the DFA the first call built
+    date.match_batch(fields, bitmap);
+    CHECK(bitmap.size() == 1 && bitmap[0] == 5);
+
+    // the copies share the DFA, which outlives the SRL that built it
+    unique_ptr<SRL> original(new SRL("digit exactly 2 times, must end"));
+    original->match_batch(fields, bitmap);
+    CHECK(bitmap[0] == 7);
+    SRL copy(*original);
+    original.reset();
+    copy.match_batch({"1", "12", "a123"}, bitmap);
+    CHECK(bitmap[0] == 6);
+}
+
+void test_jit()
+{
+    SRL date("begin with digit exactly 4 times, literally \"-\", digit exactly 2 times, must end");
+    Jit jit(date.get_program());
+    CHECK(jit.match("2017-05") && !jit.match("2017-5") && !jit.match("x2017-05"));
+    vector<uint64_t> bitmap;
+    jit.match_batch({"2017-05", "17-05", "2017-12"}, bitmap);
+    CHECK(bitmap.size() == 1 && bitmap[0] == 5);
+}
+
+void test_dialects()
+{
+    SRL srl("literally \"1.5\", case insensitive");
+    string pattern;
+    PatternOptions options;
+    CHECK(srl.get_pattern(Dialect::RE2, pattern, &options));
+    CHECK(pattern == "1\\.5" && options.case_insensitive);
+    CHECK(!SRL("digit, if followed by (letter)").get_pattern(Dialect::RE2, pattern));
+}
+
+void test_std_regex()
+{
+    // built once, and the same regex for every later call
+    SRL srl("literally \"1.5\", case insensitive");
+    std::shared_ptr<const std::regex> regex = srl.as_std_regex();
+    CHECK(regex != nullptr && regex == srl.as_std_regex());
+    CHECK(regex != nullptr && std::regex_search("x1.5", *regex) && !std::regex_search("x125", *regex));
+}
+
+void test_instrumentation()
+{
+    CompileStatsRecorder recorder;
+    SRL srl("begin with letter once or more, literally \"@\"", recorder);
+    CHECK(recorder.get_report_count() == 1);
+    CHECK(recorder.get_last().instruction_count == srl.get_program().size());
+    CHECK(recorder.get_last().node_count > 0 && recorder.get_last().token_count > 0);
+
+    // the nodes of a fragment are counted wherever it is used
+    FragmentLibrary library(false);
+    CHECK(library.define("pair", "digit, letter"));
+    SRL inline_srl("digit, letter, digit, letter", recorder);
+    size_t inline_nodes = recorder.get_last().node_count;
+    SRL fragment_srl("fragment \"pair\", fragment \"pair\"", recorder, &library);
+    CHECK(fragment_srl.is_compiled() && recorder.get_last().node_count == inline_nodes + 2);
+}
+
+void test_profiler()
+{
+    Profiler profiler("any of (literally \"ERROR\", literally \"WARN\"), anything never or more, literally \"took \"",
+                      false);
+    CHECK(!profiler.has_error());
+    Match match;
+    CHECK(profiler.search("WARN: it took 5ms", &match));
+    CHECK(match.get_begin() == 0 && match.get_end() == 14);
+    vector<ConstructProfile> constructs = profiler.get_constructs();
+    CHECK(!constructs.empty() && constructs[0].depth == 0 && constructs[0].steps > 0);
+}
+
+void test_incremental()
+{
+    IncrementalParser parser("capture (letter from a to f) as \"hex\"");
+    CHECK(parser.edit(26, 1, "z"));
+    CHECK(parser.get_source() == "capture (letter from a to z) as \"hex\"");
+    CHECK(parser.get_pattern() == SRL(parser.get_source()).get_pattern());
+    CHECK(parser.get_reparsed_length() == 18);
+    // an error keeps the asts of the last valid version
+    CHECK(!parser.edit(0, 7, "captur"));
+    CHECK(parser.has_error());
+    CHECK(parser.get_pattern() == SRL("capture (letter from a to z) as \"hex\"").get_pattern());
+}
+
+void test_deep_nesting()
+{
+    // nesting is only limited by the depth of the parser
+    string deep;
+    for (size_t i = 0; i < 5000; i++)
+    {
+        deep += "any of (";
+    }
+    deep += "digit";
+    deep += string(5000, ')');
+    CHECK(expect_span(deep, "a1", 1, 2));
+    Lexer lexer("capture (" + deep + ")", false);
+    Parser deeper(lexer, false, 5000);
+    deeper.parse();
+    CHECK(deeper.has_error());
+}
+
+void test_fragment_cache()
+{
+    // the same group written twice is compiled once, with the same results
+    CHECK(expect_groups("capture (digit once or more) as \"a\", literally \":\", "
+                        "capture (digit once or more) as \"b\"",
+                        "x 12:345", 2, 8, {{2, 4}, {5, 8}}));
+    CHECK(expect_span("any of (literally \"ab\", digit), literally \"-\", any of (literally \"ab\", digit)", "1-ab", 0, 4));
+}
+
+void test_fragment_library()
+{
+    FragmentLibrary library(false);
+    CHECK(library.define("octet", "digit between 1 and 3 times"));
+    CHECK(library.define("ipv4", "fragment \"octet\", literally \".\", fragment \"octet\", literally \".\", "
+                                 "fragment \"octet\", literally \".\", fragment \"octet\""));
+    SRL srl("literally \"from \", capture (fragment \"ipv4\")", library);
+    Match match;
+    CHECK(srl.is_compiled() && srl.match("ok from 10.0.0.255", &match));
+    CHECK(get_groups(match) == Groups({{8, 18}}));
+
+    RuleSet rules(false, &library);
+    rules.add("fragment \"ipv4\", must end");
+    rules.add("literally \"from \", fragment \"ipv4\"");
+    rules.compile();
+    CHECK(rules.match("from 1.2.3.4") == vector<size_t>({0, 1}));
+    CHECK(rules.match("from 1.2.3.4 x") == vector<size_t>({1}));
+}
+
+void test_trigrams()
+{
+    vector<string> documents = {"ERROR 5 timeout", "ERROR 6 refused", "WARN timeout"};
+    TrigramIndex index;
+    for (auto const &document : documents)
+    {
+        index.add(document);
+    }
+    SRL srl("literally \"ERROR \", anything never or more, literally \"timeout\"");
+    NGramQuery ngrams = srl.get_ngram_query();
+    CHECK(ngrams.matches(documents[0]) && !ngrams.matches(documents[1]) && !ngrams.matches(documents[2]));
+    CHECK(index.search(ngrams) == vector<size_t>({0}));
+    CHECK(SRL("literally \"abc\", case insensitive").get_ngram_query().is_all());
+}
+
+void test_unicode()
+{
+    CHECK(expect_span("letter, unicode", "1\xC3\xA9", 1, 3));
+    CHECK(expect_span("any character once or more, unicode", "\xCE\xB1\xCE\xB2!", 0, 4));
+    CHECK(expect_span("one of \"\xC3\xA9\xC3\xA8\", unicode", "e\xC3\xA8", 1, 3));
+
+    SRL srl("letter, unicode");
+    Match match;
+    CHECK(!srl.match("\xFF", &match));
+    CHECK(match.get_result() == MatchResult::INVALID_UTF8);
+}
+
+void test_case_folding()
+{
+    CHECK(expect_span("literally \"abc\", case insensitive", "xABC", 1, 4));
+    CHECK(expect_span("any of (literally \"get\", literally \"post\"), case insensitive", "a PoSt", 2, 6));
+    CHECK(expect_span("letter from a to c once or more, case insensitive", "xAbC", 1, 4));
+    CHECK(expect_span("literally \"\xC3\xBC\", case insensitive, unicode", "\xC3\x9C", 0, 2));
+    // a letter matches every code point it folds together with, e.g. k
+    // and U+212A KELVIN SIGN, or σ, ς and Σ, which need not be as long
+    CHECK(expect_span("literally \"k\", case insensitive, unicode", "x\xE2\x84\xAA", 1, 4));
+    CHECK(expect_span("literally \"k\", case insensitive", "x\xE2\x84\xAA", -1, -1));
+    CHECK(expect_span("literally \"\xCF\x83\", case insensitive, unicode", "\xCF\x82", 0, 2));
+    CHECK(expect_span("literally \"sk\" must end, case insensitive, unicode", "a\xC5\xBF\xE2\x84\xAA", 1, 6));
+    CHECK(expect_span("any of (literally \"ok\", literally \"no\"), case insensitive, unicode", "O\xE2\x84\xAA", 0, 4));
+    CHECK(expect_span("one of \"k\", case insensitive, unicode", "\xE2\x84\xAA", 0, 3));
+
+    RuleSet rules(false);
+    rules.add("literally \"error\", case insensitive");
+    rules.add("literally \"WARN\"");
+    rules.compile();
+    CHECK(rules.match("Error, WARN") == vector<size_t>({0, 1}));
+    CHECK(rules.match("warn").empty());
+}
+
+void test_lookarounds()
+{
+    CHECK(expect_span("digit, if followed by (letter)", "12a", 1, 2));
+    CHECK(expect_span("digit, if not followed by (letter)", "1a2", 2, 3));
+    CHECK(expect_span("if already had (letter), digit", "1a2", 2, 3));
+    CHECK(expect_span("if not already had (letter), digit", "a1", -1, -1));
+    // a lookbehind need not have a bounded length
+    CHECK(expect_span("if already had (literally \"x\", digit never or more), letter", "x123a", 4, 5));
+    CHECK(expect_span("digit, if followed by (digit once or more, literally \"!\")", "1 23!", 2, 3));
+    // the groups inside keep their numbers, but are not captured
+    CHECK(expect_groups("digit, if followed by (capture (letter)), capture (letter)", "1a", 0, 2, {{-1, -1}, {1, 2}}));
+}
+
+void test_lazy()
+{
+    CHECK(expect_span("digit once or more, all lazy", "123", 0, 1));
+    CHECK(expect_span("digit never or more, all lazy", "123", 0, 0));
+    CHECK(expect_span("digit between 2 and 4 times, all lazy", "12345", 0, 2));
+    CHECK(expect_groups("capture (digit once or more), literally \"x\", all lazy", "12x", 0, 3, {{0, 2}}));
+    CHECK(expect_groups("capture (anything once or more), capture (digit once or more) must end, all lazy", "ab12", 0, 4,
+                        {{0, 2}, {2, 4}}));
+    CHECK(expect_span("any of (digit optional, literally \"a\") never or more, literally \"b\", all lazy", "aab", 0, 3));
+}
+
+void test_extractor()
+{
+    SRL srl("capture (letter once or more) as \"level\", literally \" \", "
+            "capture (digit once or more) as \"code\", capture (literally \"!\") optional");
+    Extractor extractor(srl.get_program(), 2);
+    const char chunk[] = "warn 12!\nnothing\nerr";
+    extractor.feed(chunk, sizeof(chunk) - 1);
+    CHECK(extractor.get_row_count() == 1 && !extractor.is_full());
+    extractor.feed(" 7\n", 3);
+    CHECK(extractor.is_full());
+    ExtractBatch batch;
+    extractor.take(batch);
+    CHECK(batch.lines == vector<uint64_t>({0, 2}));
+    CHECK(batch.columns.size() == 3 && batch.columns[0].name == "level" && batch.columns[1].name == "code");
+    CHECK(batch.columns[0].bytes == "warnerr" && batch.columns[1].bytes == "127");
+    CHECK(batch.columns[1].offsets == vector<uint32_t>({0, 2}) && batch.columns[1].lengths == vector<uint32_t>({2, 1}));
+    CHECK(batch.columns[2].present.size() == 1 && batch.columns[2].present[0] == 1);
+
+    extractor.feed("info 1", 6);
+    CHECK(extractor.get_row_count() == 0);
+    extractor.finish();
+    extractor.take(batch);
+    CHECK(batch.lines == vector<uint64_t>({3}) && batch.columns[0].bytes == "info");
+    CHECK(extractor.get_line_count() == 4 && extractor.get_row_count() == 0);
+    CHECK(!extractor.is_full() && !extractor.has_error());
+}
+}
+
+int main()
+{
+    test_counters();
+    test_empty_iterations();
+    test_failed_compiles();
+    test_limits();
+    test_length_bounds();
+    test_reverse();
+    test_rule_sets();
+    test_any_of();
+    test_images();
+    test_handle();
+    test_batches();
+    test_jit();
+    test_dialects();
+    test_std_regex();
+    test_instrumentation();
+    test_profiler();
+    test_incremental();
+    test_deep_nesting();
+    test_fragment_cache();
+    test_fragment_library();
+    test_trigrams();
+    test_unicode();
+    test_case_folding();
+    test_lookarounds();
+    test_lazy();
+    test_extractor();
+    if (failures != 0)
+    {
+        std::cerr << failures << " failed" << std::endl;
+    }
+    return failures;
+}